@@ -1 +1 @@
-brew install glfw glm spdlog
\ No newline at end of file
+brew install glfw glm spdlog shaderc
\ No newline at end of file
@@ -1,89 +1,346 @@
 #version 450
 #extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_ballot : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
 
 #include "Constants.glsl"
 #include "UBO.glsl"
 #include "Textures.glsl"
 #include "Brdf.glsl"
 #include "Ray.glsl"
+#include "Environment.glsl"
 #include "primitive/Primitive.glsl"
 #include "KDTree.glsl"
 #include "Scene.glsl"
 #include "light/Light.glsl"
 #include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
 
 
-layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+// Default 16x16, the size is specialized from KernelTuner::GetConfig() (src/vulkan/KernelTuner.h)
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1, local_size_x_id = 3, local_size_y_id = 4) in;
 layout(binding = 255, rgba32f) uniform image2D resultImage;
 
-// Global random state
-uint g_rngState;
-uint g_rngCounter;
-
-uint hash(uint x) {
-    x ^= x >> 16;
-    x *= 0x85ebca6bu;
-    x ^= x >> 13;
-    x *= 0xc2b2ae35u;
-    x ^= x >> 16;
-    return x;
+// Set by ComputePipeline::CreatePipeline from Params::s_SortedShading, Params::s_ShadingStats,
+// Params::s_PersistentThreads and the KernelConfig. The sorted shading queues hold one path per
+// invocation, sizing them by the specialization keeps the shared memory out of the pipeline when
+// sorted shading is off
+layout(constant_id = 0) const uint SORTED_SHADING_SLOTS = 1u;  // the workgroup size enables sorted shading
+layout(constant_id = 1) const bool SHADING_STATS = false;
+layout(constant_id = 2) const bool PERSISTENT_THREADS = false;
+layout(constant_id = 5) const bool MORTON_PIXEL_ORDER = false;
+const bool SORTED_SHADING = SORTED_SHADING_SLOTS > 1u;
+
+// Must match ComputePushConstants in src/vulkan/ComputePipeline.h
+layout(push_constant) uniform PushConstants {
+    uint pc_SampleOffset;   // first sample of this dispatch, relative to u_SampleIndex
+    uint pc_SampleCount;    // samples accumulated per pixel by this dispatch
+    uvec2 pc_TileOffset;    // first pixel of the tile this dispatch covers (see src/vulkan/TileScheduler.h)
+    uint pc_Slot;           // submission slot, the entry of shadingStats and workCounters this dispatch uses
+    uint pc_TileRows;       // rows of the tile, persistent threads derive their work from it
+};
+
+// Per submission: x = lanes that ran a shader, y = lanes the subgroups issued for it (see src/vulkan/ShadingStats.h)
+layout(binding = 63, std430) buffer ShadingStats {
+    uvec4 shadingStats[];
+};
+
+// Per submission: pixels the persistent threads already took (see src/vulkan/PersistentThreads.h)
+layout(binding = 64, std430) buffer WorkCounters {
+    uint workCounters[];
+};
+
+uint g_activeShadingLanes = 0u;
+uint g_issuedShadingLanes = 0u;
+
+// The subgroup runs one pass per distinct shader type among its active lanes. Counts the lane
+// itself and, once per pass, the full subgroup width the pass occupies
+void recordShadingLanes(uint shaderType) {
+    if (!SHADING_STATS) {
+        return;
+    }
+    for (;;) {
+        if (subgroupBroadcastFirst(shaderType) == shaderType) {
+            if (subgroupElect()) {
+                g_issuedShadingLanes += gl_SubgroupSize;
+            }
+            break;
+        }
+    }
+    g_activeShadingLanes++;
 }
 
-float rand() {
-    g_rngCounter++;
-    return float(hash(g_rngState + g_rngCounter)) / 4294967295.0;
+void flushShadingStats() {
+    if (!SHADING_STATS) {
+        return;
+    }
+    const uint activeLanes = subgroupAdd(g_activeShadingLanes);
+    const uint issuedLanes = subgroupAdd(g_issuedShadingLanes);
+    if (subgroupElect()) {
+        atomicAdd(shadingStats[pc_Slot].x, activeLanes);
+        atomicAdd(shadingStats[pc_Slot].y, issuedLanes);
+    }
+}
+
+vec3 traceRay(inout Ray ray) {
+    vec3 radiance = vec3(0);
+    vec3 throughput = vec3(1);
+
+    while (ray.remainingBounces > 0) {
+        if (intersectScene(ray)) {
+            // If the ray has hit an object, call the shader ...
+            recordShadingLanes(ray.primitive.shaderType);
+            radiance += shadeHit(ray, throughput);
+        } else {
+            // ... otherwise the ray escaped the scene
+            return radiance + throughput * shadeMiss(ray);
+        }
+    }
+    return radiance;
 }
 
-void initRng(uvec2 pixel, uint sampleIndex) {
-    g_rngState = hash(pixel.x + hash(pixel.y + hash(sampleIndex)));
-    g_rngCounter = 0u;
+// Sorted shading: after every extension the hits of the workgroup are sorted by shader type in
+// shared memory, then each invocation shades the path at its sorted position. Neighbouring lanes
+// thereby run the same shader instead of serializing the switch in shade().
+// A path travels as its Ray, throughput, RNG state and the radiance its shading returned.
+// Must match SORTED_SHADING_SHARED_MEMORY in src/vulkan/ComputePipeline.h
+const uint SHADER_TYPE_COUNT = 12u;     // shader types 1..11
+shared vec4 s_PathFloats[7][SORTED_SHADING_SLOTS];
+shared uvec4 s_PathBits[2][SORTED_SHADING_SLOTS];
+shared uint s_ShadeOrder[SORTED_SHADING_SLOTS];
+shared uint s_BinCount[SHADER_TYPE_COUNT];
+shared uint s_HitCount;
+
+void storeSharedPath(uint slot, in Ray ray, vec3 throughput, vec3 contribution) {
+    s_PathFloats[0][slot] = vec4(ray.origin, ray.rayLength);
+    s_PathFloats[1][slot] = vec4(ray.direction, ray.bsdfPdf);
+    s_PathFloats[2][slot] = vec4(ray.normal, ray.coneWidth);
+    s_PathFloats[3][slot] = vec4(ray.tangent, ray.coneSpread);
+    s_PathFloats[4][slot] = vec4(ray.bitangent, ray.uvLodBias);
+    s_PathFloats[5][slot] = vec4(throughput, ray.surface.x);
+    s_PathFloats[6][slot] = vec4(contribution, ray.surface.y);
+    s_PathBits[0][slot] = uvec4(ray.primitive.primitiveType, uint(ray.primitive.primitiveIndex), ray.primitive.shaderType, uint(ray.primitive.shaderIndex));
+    s_PathBits[1][slot] = uvec4(uint(ray.remainingBounces), g_rngState, g_rngCounter, 0u);
 }
 
-vec3 clamp32(vec3 c) {
-  return vec3(max(0.0, min(c.x, 32.0)), max(0.0, min(c.y, 32.0)), max(0.0, min(c.z, 32.0)));
+// Restores the RNG state of the path as well
+Ray loadSharedPath(uint slot, out vec3 throughput, out vec3 contribution) {
+    Ray ray;
+    ray.origin = s_PathFloats[0][slot].xyz;
+    ray.rayLength = s_PathFloats[0][slot].w;
+    ray.direction = s_PathFloats[1][slot].xyz;
+    ray.bsdfPdf = s_PathFloats[1][slot].w;
+    ray.normal = s_PathFloats[2][slot].xyz;
+    ray.coneWidth = s_PathFloats[2][slot].w;
+    ray.tangent = s_PathFloats[3][slot].xyz;
+    ray.coneSpread = s_PathFloats[3][slot].w;
+    ray.bitangent = s_PathFloats[4][slot].xyz;
+    ray.uvLodBias = s_PathFloats[4][slot].w;
+    throughput = s_PathFloats[5][slot].xyz;
+    contribution = s_PathFloats[6][slot].xyz;
+    ray.surface = vec2(s_PathFloats[5][slot].w, s_PathFloats[6][slot].w);
+    const uvec4 primitive = s_PathBits[0][slot];
+    ray.primitive = Primitive(primitive.x, int(primitive.y), primitive.z, int(primitive.w));
+    ray.remainingBounces = int(s_PathBits[1][slot].x);
+    g_rngState = s_PathBits[1][slot].y;
+    g_rngCounter = s_PathBits[1][slot].z;
+    return ray;
 }
 
-void main() {
-    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
-    ivec2 screenDims = imageSize(resultImage);
+// Has to be reached by every invocation of the workgroup, active is false outside the image
+vec3 traceRaySorted(inout Ray ray, bool active) {
+    const uint slot = gl_LocalInvocationIndex;
+    vec3 radiance = vec3(0);
+    vec3 throughput = vec3(1);
+    bool alive = active && ray.remainingBounces > 0;
 
-    // Because workgroups are fixed size (e.g., 16x16), the total threads might 
-    // slightly exceed the image size. We must return early to avoid writing out of bounds.
-    if (pixelCoords.x >= screenDims.x || pixelCoords.y >= screenDims.y) {
-        return;
-    }
+    for (;;) {
+        // Extend the path, hits remember the shader type they need
+        uint shaderType = 0u;
+        if (alive) {
+            if (intersectScene(ray)) {
+                shaderType = ray.primitive.shaderType;
+            } else {
+                radiance += throughput * shadeMiss(ray);
+            }
+            // Hits without a known shader end the path like shade() does
+            if (shaderType >= SHADER_TYPE_COUNT) {
+                shaderType = 0u;
+            }
+            alive = shaderType != 0u;
+        }
 
-    // Initialize global RNG
-    initRng(uvec2(pixelCoords), u_SampleIndex);
+        if (slot == 0u) {
+            s_HitCount = 0u;
+            for (uint type = 0u; type < SHADER_TYPE_COUNT; type++) {
+                s_BinCount[type] = 0u;
+            }
+        }
+        barrier();
+        uint rank = 0u;
+        if (alive) {
+            rank = atomicAdd(s_BinCount[shaderType], 1u);
+            atomicAdd(s_HitCount, 1u);
+        }
+        barrier();
+        // Uniform exit, every invocation reads the same count
+        if (s_HitCount == 0u) {
+            break;
+        }
 
-    // center the ray in the pixel.
-    vec2 antiAliasJitter = vec2(rand(), rand()) - 0.5;
-    antiAliasJitter *= 0.5; // reduce jitter amount
-    vec2 uv = (vec2(pixelCoords) + vec2(0.5) + antiAliasJitter) / vec2(screenDims);
+        // Counting sort: the paths of a shader type follow the paths of all lower types
+        if (alive) {
+            uint position = rank;
+            for (uint type = 0u; type < shaderType; type++) {
+                position += s_BinCount[type];
+            }
+            s_ShadeOrder[position] = slot;
+            storeSharedPath(slot, ray, throughput, vec3(0));
+        }
+        barrier();
 
-    // conversion from [0,1] UV to [-1,1] Clip Space for ray direction
-    vec2 ndc = uv * 2.0 - 1.0; 
-    
-    // Correct for Aspect Ratio
-    ndc.y *= -1.0;
-    ndc.y *= u_aspectRatio;
+        if (slot < s_HitCount) {
+            const uint owner = s_ShadeOrder[slot];
+            vec3 ownerThroughput;
+            vec3 contribution;
+            Ray ownerRay = loadSharedPath(owner, ownerThroughput, contribution);
+            recordShadingLanes(ownerRay.primitive.shaderType);
+            contribution = shadeHit(ownerRay, ownerThroughput);
+            storeSharedPath(owner, ownerRay, ownerThroughput, contribution);
+        }
+        barrier();
 
-    vec3 origin = u_CameraPosition;
-    vec3 direction = normalize(
-        ndc.x * u_CameraRight +
-        ndc.y * u_CameraUp +
-        u_FocusDistance * u_CameraForward
-    );
+        if (alive) {
+            vec3 contribution;
+            ray = loadSharedPath(slot, throughput, contribution);
+            radiance += contribution;
+            alive = ray.remainingBounces > 0;
+        }
+    }
+    return radiance;
+}
 
-    Ray ray = createRay(origin, direction, int(u_RayBounces));
+// Traces one camera ray through the pixel, the RNG has to be initialized for the sample
+vec3 tracePixelSample(ivec2 pixelCoords, ivec2 screenDims, bool insideImage) {
+    Ray ray = createCameraRay(pixelCoords, screenDims);
 
     // Raytrace
-    vec3 pixelColor = clamp32(traceRay(ray));
+    if (SORTED_SHADING) {
+        return clamp32(traceRaySorted(ray, insideImage));
+    }
+    return clamp32(traceRay(ray));
+}
+
+// Accumulates all samples of this dispatch in registers, the image is only touched once
+void renderPixel(ivec2 pixelCoords, ivec2 screenDims, bool insideImage) {
+    const uint firstSample = u_SampleIndex + pc_SampleOffset;
+    vec3 sampleSum = vec3(0);
+    for (uint s = 0u; s < pc_SampleCount; s++) {
+        initRng(uvec2(pixelCoords), firstSample + s);
+        sampleSum += tracePixelSample(pixelCoords, screenDims, insideImage);
+    }
+    if (!insideImage) {
+        return;
+    }
 
     // Write Output over multiple samples
     // Format must match the image layout (rgba8 -> vec4)
     vec4 prev = imageLoad(resultImage, pixelCoords);
-    float n = float(u_SampleIndex);
-    vec4 outColor = (prev * n + vec4(pixelColor, 1.0)) / (n + 1.0);
+    float n = float(firstSample);
+    float k = float(pc_SampleCount);
+    vec4 outColor = (prev * n + vec4(sampleSum, k)) / (n + k);
     imageStore(resultImage, pixelCoords, outColor);
 }
+
+// Pixel of the workgroup block an invocation renders, row by row or along a Morton curve. The
+// Morton curve takes x from the even and y from the odd bits, the block is square or twice as wide
+uvec2 blockPixel(uint invocation) {
+    if (MORTON_PIXEL_ORDER) {
+        uvec2 pixel = uvec2(0u);
+        for (uint bit = 0u; bit < 5u; bit++) {
+            pixel.x |= ((invocation >> (2u * bit)) & 1u) << bit;
+            pixel.y |= ((invocation >> (2u * bit + 1u)) & 1u) << bit;
+        }
+        return pixel;
+    }
+    return uvec2(invocation % gl_WorkGroupSize.x, invocation / gl_WorkGroupSize.x);
+}
+
+// Persistent threads: the work of a dispatch are the pixels of the tile, numbered in workgroup
+// sized blocks like the workgroups of a regular dispatch. Pixels of partial blocks outside the
+// image are skipped
+shared uint s_WorkBatch;
+
+ivec2 workPixel(uint work, ivec2 screenDims) {
+    const uint blockSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    const uint blocksX = (uint(screenDims.x) + gl_WorkGroupSize.x - 1u) / gl_WorkGroupSize.x;
+    const uint block = work / blockSize;
+    const uvec2 blockOrigin = uvec2(block % blocksX, block / blocksX) * gl_WorkGroupSize.xy;
+    return ivec2(pc_TileOffset + blockOrigin + blockPixel(work % blockSize));
+}
+
+// First work index of the next batch, one per subgroup. Sorted shading takes a batch for the whole
+// workgroup instead, its barriers need every invocation to leave the loop together
+uint fetchWorkBatch(uint batchSize) {
+    if (SORTED_SHADING) {
+        barrier();
+        if (gl_LocalInvocationIndex == 0u) {
+            s_WorkBatch = atomicAdd(workCounters[pc_Slot], batchSize);
+        }
+        barrier();
+        return s_WorkBatch;
+    }
+    uint batch = 0u;
+    if (subgroupElect()) {
+        batch = atomicAdd(workCounters[pc_Slot], batchSize);
+    }
+    return subgroupBroadcastFirst(batch);
+}
+
+void renderPersistent(ivec2 screenDims) {
+    const uint blocksX = (uint(screenDims.x) + gl_WorkGroupSize.x - 1u) / gl_WorkGroupSize.x;
+    const uint blocksY = (pc_TileRows + gl_WorkGroupSize.y - 1u) / gl_WorkGroupSize.y;
+    const uint workCount = blocksX * blocksY * gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    // Small workgroups may leave subgroups partially filled, only their active lanes take work
+    const uvec4 subgroupLanes = subgroupBallot(true);
+    const uint batchSize = SORTED_SHADING ? gl_WorkGroupSize.x * gl_WorkGroupSize.y : subgroupBallotBitCount(subgroupLanes);
+    const uint lane = SORTED_SHADING ? gl_LocalInvocationIndex : subgroupBallotExclusiveBitCount(subgroupLanes);
+
+    for (;;) {
+        // Uniform exit, the batch is the same for the subgroup or workgroup
+        const uint batch = fetchWorkBatch(batchSize);
+        if (batch >= workCount) {
+            break;
+        }
+        const ivec2 pixelCoords = workPixel(batch + lane, screenDims);
+        const bool insideImage = pixelCoords.x < screenDims.x && pixelCoords.y < screenDims.y && uint(pixelCoords.y) < pc_TileOffset.y + pc_TileRows;
+        if (insideImage || SORTED_SHADING) {
+            renderPixel(pixelCoords, screenDims, insideImage);
+        }
+    }
+}
+
+void main() {
+    ivec2 screenDims = imageSize(resultImage);
+    if (PERSISTENT_THREADS) {
+        renderPersistent(screenDims);
+        flushShadingStats();
+        return;
+    }
+
+    ivec2 pixelCoords = ivec2(pc_TileOffset + gl_WorkGroupID.xy * gl_WorkGroupSize.xy + blockPixel(gl_LocalInvocationIndex));
+    const bool insideImage = pixelCoords.x < screenDims.x && pixelCoords.y < screenDims.y;
+
+    // Because workgroups are fixed size (e.g., 16x16), the total threads might
+    // slightly exceed the image size. We must return early to avoid writing out of bounds.
+    // Sorted shading keeps these invocations around for the barriers of the workgroup
+    if (!insideImage && !SORTED_SHADING) {
+        return;
+    }
+
+    renderPixel(pixelCoords, screenDims, insideImage);
+    flushShadingStats();
+}
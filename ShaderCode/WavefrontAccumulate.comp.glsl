@@ -0,0 +1,42 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: adds the finished sample of every path to its sum and writes the
+// pixels once the last sample of the dispatch is done, like Raytracer.comp.glsl does
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+layout(binding = 255, rgba32f) uniform image2D resultImage;
+
+void main() {
+    if (gl_GlobalInvocationID.x >= pc_TileSize.x || gl_GlobalInvocationID.y >= pc_TileSize.y) {
+        return;
+    }
+    const uint path = gl_GlobalInvocationID.y * pc_TileSize.x + gl_GlobalInvocationID.x;
+    const vec3 sampleSum = paths[path].sampleSum.xyz + clamp32(paths[path].radiance.xyz);
+    paths[path].sampleSum.xyz = sampleSum;
+    if (pc_Sample + 1u < pc_SampleCount) {
+        return;
+    }
+
+    const ivec2 pixelCoords = ivec2(pathPixel(path));
+    vec4 prev = imageLoad(resultImage, pixelCoords);
+    float n = float(u_SampleIndex + pc_SampleOffset);
+    float k = float(pc_SampleCount);
+    vec4 outColor = (prev * n + vec4(sampleSum, k)) / (n + k);
+    imageStore(resultImage, pixelCoords, outColor);
+}
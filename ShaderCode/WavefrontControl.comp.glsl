@@ -0,0 +1,46 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: single invocation that turns the queue counters into indirect dispatch arguments
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+// 0: before extend, 1: between extend and sort
+layout(constant_id = 0) const uint WAVEFRONT_CONTROL_STAGE = 0u;
+
+void main() {
+    if (WAVEFRONT_CONTROL_STAGE == 0u) {
+        extendArgs = dispatchArgs(rayCount);
+        hitCount = 0u;
+        for (uint type = 0u; type < WAVEFRONT_SHADER_TYPE_COUNT; type++) {
+            binCount[type] = 0u;
+        }
+        return;
+    }
+
+    // Exclusive prefix sum over the bins gives each shader type its range of the sorted hit queue
+    uint offset = 0u;
+    for (uint type = 0u; type < WAVEFRONT_SHADER_TYPE_COUNT; type++) {
+        binOffset[type] = offset;
+        binCursor[type] = offset;
+        shadeArgs[type] = dispatchArgs(binCount[type]);
+        offset += binCount[type];
+    }
+    sortArgs = dispatchArgs(hitCount);
+    // The shade kernels refill the ray queue
+    rayCount = 0u;
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: intersects the paths of the ray queue with the scene. Escaping paths
+// pick up the environment and end, hits are counted per shader type and appended to the hit queue
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= rayCount) {
+        return;
+    }
+    const uint path = queues[RAY_QUEUE + index];
+    Ray ray = loadRay(path);
+
+    if (!intersectScene(ray)) {
+        paths[path].radiance.xyz += paths[path].throughput.xyz * shadeMiss(ray);
+        return;
+    }
+    storeRay(path, ray);
+
+    // Primitives without a known shader end the path like shade() does
+    const uint shaderType = ray.primitive.shaderType;
+    if (shaderType == 0u || shaderType >= WAVEFRONT_SHADER_TYPE_COUNT) {
+        return;
+    }
+    atomicAdd(binCount[shaderType], 1u);
+    queues[HIT_QUEUE + atomicAdd(hitCount, 1u)] = path;
+}
@@ -0,0 +1,43 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: starts the paths of one sample, one per pixel of the chunk
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+layout(binding = 255, rgba32f) uniform image2D resultImage;
+
+void main() {
+    if (gl_GlobalInvocationID.x >= pc_TileSize.x || gl_GlobalInvocationID.y >= pc_TileSize.y) {
+        return;
+    }
+    const uint path = gl_GlobalInvocationID.y * pc_TileSize.x + gl_GlobalInvocationID.x;
+    if (path == 0u) {
+        rayCount = (u_RayBounces > 0u) ? pc_TileSize.x * pc_TileSize.y : 0u;
+    }
+
+    initRng(pathPixel(path), pathSampleIndex());
+    const Ray ray = createCameraRay(ivec2(pathPixel(path)), imageSize(resultImage));
+    storeRay(path, ray);
+    storeRng(path);
+    paths[path].throughput = vec4(1.0);
+    paths[path].radiance = vec4(0.0);
+    if (pc_Sample == 0u) {
+        paths[path].sampleSum = vec4(0.0);
+    }
+    queues[RAY_QUEUE + path] = path;
+}
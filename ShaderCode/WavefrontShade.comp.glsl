@@ -0,0 +1,45 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: runs the shader of one shader type on its range of the sorted hit queue.
+// Surviving paths are compacted into the ray queue for the next extend
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+layout(constant_id = 0) const uint WAVEFRONT_SHADER_TYPE = 0u;
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= binCount[WAVEFRONT_SHADER_TYPE]) {
+        return;
+    }
+    const uint path = queues[SORTED_HIT_QUEUE + binOffset[WAVEFRONT_SHADER_TYPE] + index];
+    Ray ray = loadRay(path);
+    // Equal to the stored type, but as specialization constant the driver drops the other shaders
+    ray.primitive.shaderType = WAVEFRONT_SHADER_TYPE;
+
+    loadRng(path);
+    vec3 throughput = paths[path].throughput.xyz;
+    paths[path].radiance.xyz += shadeHit(ray, throughput);
+    paths[path].throughput.xyz = throughput;
+    storeRay(path, ray);
+    storeRng(path);
+
+    if (ray.remainingBounces > 0) {
+        queues[RAY_QUEUE + atomicAdd(rayCount, 1u)] = path;
+    }
+}
@@ -0,0 +1,31 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "Constants.glsl"
+#include "UBO.glsl"
+#include "Textures.glsl"
+#include "Brdf.glsl"
+#include "Ray.glsl"
+#include "Environment.glsl"
+#include "primitive/Primitive.glsl"
+#include "KDTree.glsl"
+#include "Scene.glsl"
+#include "light/Light.glsl"
+#include "shader/Shader.glsl"
+#include "Random.glsl"
+#include "Camera.glsl"
+#include "Wavefront.glsl"
+
+// Wavefront path tracing: scatters the hit queue into one contiguous range per shader type
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= hitCount) {
+        return;
+    }
+    const uint path = queues[HIT_QUEUE + index];
+    const uint shaderType = paths[path].primitive.shaderType;
+    queues[SORTED_HIT_QUEUE + atomicAdd(binCursor[shaderType], 1u)] = path;
+}
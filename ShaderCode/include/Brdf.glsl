@@ -4,69 +4,39 @@
 #define BRDF_SAMPLING_RES_THETA_H 90
 #define BRDF_SAMPLING_RES_THETA_D 90
 #define BRDF_SAMPLING_RES_PHI_D 360
-#define BRDF_DATA_SIZE (BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_D * BRDF_SAMPLING_RES_PHI_D / 2 * 3)
-
-#define RED_SCALE   (1.0 / 1500.0)
-#define GREEN_SCALE (1.15 / 1500.0)
-#define BLUE_SCALE  (1.66 / 1500.0)
+#define BRDF_CHANNEL_SIZE (BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_D * BRDF_SAMPLING_RES_PHI_D / 2)
+#define BRDF_DATA_SIZE (BRDF_CHANNEL_SIZE * 3)
+// Two half float samples per uint
+#define BRDF_PACKED_SIZE (BRDF_DATA_SIZE / 2)
 
+// Samples are already multiplied by the MERL channel scales (see src/vulkan/Brdf.cpp)
 layout(binding = 53, std430) buffer BrdfDataBuffer {
-    float brdfData[];
+    uint brdfData[];
 };
 
 int getBrdfDataOffset(int brdfId) {
-    return brdfId * BRDF_DATA_SIZE;
+    return brdfId * BRDF_PACKED_SIZE;
 }
 
-vec3 rotate_vector(vec3 vector, vec3 axis, float angle) {
-    float cos_ang = cos(angle);
-    float sin_ang = sin(angle);
-
-    vec3 out_vec = vector * cos_ang;
-    float temp = dot(axis, vector) * (1.0 - cos_ang);
-    out_vec += axis * temp;
-    out_vec += cross(axis, vector) * sin_ang;
-
-    return out_vec;
+float getBrdfSample(int baseOffset, int index) {
+    const vec2 samples = unpackHalf2x16(brdfData[baseOffset + index / 2]);
+    return (index & 1) == 0 ? samples.x : samples.y;
 }
 
-void std_coords_to_half_diff_coords(float theta_in, float phi_in, float theta_out, float phi_out,
-                                    out float theta_half, out float phi_half, out float theta_diff,
-                                    out float phi_diff) {
-    // Compute in vector
-    float in_vec_z = cos(theta_in);
-    float proj_in_vec = sin(theta_in);
-    float in_vec_x = proj_in_vec * cos(phi_in);
-    float in_vec_y = proj_in_vec * sin(phi_in);
-    vec3 in_vec = normalize(vec3(in_vec_x, in_vec_y, in_vec_z));
-
-    // Compute out vector
-    float out_vec_z = cos(theta_out);
-    float proj_out_vec = sin(theta_out);
-    float out_vec_x = proj_out_vec * cos(phi_out);
-    float out_vec_y = proj_out_vec * sin(phi_out);
-    vec3 out_vec = normalize(vec3(out_vec_x, out_vec_y, out_vec_z));
-
-    // Compute halfway vector
-    float half_x = (in_vec_x + out_vec_x) / 2.0;
-    float half_y = (in_vec_y + out_vec_y) / 2.0;
-    float half_z = (in_vec_z + out_vec_z) / 2.0;
-    vec3 half_vec = normalize(vec3(half_x, half_y, half_z));
-
-    // Compute theta_half, phi_half
-    theta_half = acos(half_vec.z);
-    phi_half = atan(half_vec.y, half_vec.x);
-
-    // Compute diff vector
-    vec3 bi_normal = vec3(0.0, 1.0, 0.0);
-    vec3 normal = vec3(0.0, 0.0, 1.0);
-
-    vec3 temp = rotate_vector(in_vec, normal, -phi_half);
-    vec3 diff = rotate_vector(temp, bi_normal, -theta_half);
-
-    // Compute theta_diff, phi_diff
-    theta_diff = acos(diff.z);
-    phi_diff = atan(diff.y, diff.x);
+// Half / difference angles (Rusinkiewicz) of the directions wi and wo around normal, computed from the vectors.
+// phi_half is not needed, the BRDFs are isotropic
+void half_diff_coords(vec3 normal, vec3 wi, vec3 wo, out float theta_half, out float theta_diff, out float phi_diff) {
+    const vec3 half_vec = normalize(wi + wo);
+    const float cos_theta_half = clamp(dot(normal, half_vec), -1.0, 1.0);
+    theta_half = acos(cos_theta_half);
+    theta_diff = acos(clamp(dot(wi, half_vec), -1.0, 1.0));
+
+    // Frame of the half vector, x points away from the normal in the plane of normal and half vector
+    vec3 x = half_vec * cos_theta_half - normal;
+    const float x_length = length(x);
+    x = (x_length > 1e-6) ? x / x_length : normalize(cross(half_vec, abs(half_vec.x) < 0.9 ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+    const vec3 y = cross(half_vec, x);
+    phi_diff = atan(dot(wi, y), dot(wi, x));
 }
 
 int theta_half_index(float theta_half) {
@@ -111,12 +81,12 @@ int phi_diff_index(float phi_diff) {
         return BRDF_SAMPLING_RES_PHI_D / 2 - 1;
 }
 
-vec3 lookup_brdf_values(float theta_in, float phi_in, float theta_out, float phi_out, int brdfId) {
+// Measured BRDF of brdfId for light arriving from wo and leaving towards wi
+vec3 lookupBrdf(int brdfId, vec3 normal, vec3 wi, vec3 wo) {
     int baseOffset = getBrdfDataOffset(brdfId);
 
-    // Convert to halfangle / difference angle coordinates
-    float theta_half, phi_half, theta_diff, phi_diff;
-    std_coords_to_half_diff_coords(theta_in, phi_in, theta_out, phi_out, theta_half, phi_half, theta_diff, phi_diff);
+    float theta_half, theta_diff, phi_diff;
+    half_diff_coords(normal, wi, wo, theta_half, theta_diff, phi_diff);
 
     // Find index.
     // Note that phi_half is ignored, since isotropic BRDFs are assumed
@@ -124,9 +94,99 @@ vec3 lookup_brdf_values(float theta_in, float phi_in, float theta_out, float phi
               theta_half_index(theta_half) * BRDF_SAMPLING_RES_PHI_D / 2 * BRDF_SAMPLING_RES_THETA_D;
 
     vec3 color;
-    color.r = brdfData[baseOffset + ind] * RED_SCALE;
-    color.g = brdfData[baseOffset + ind + BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_D * BRDF_SAMPLING_RES_PHI_D / 2] * GREEN_SCALE;
-    color.b = brdfData[baseOffset + ind + BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_D * BRDF_SAMPLING_RES_PHI_D] * BLUE_SCALE;
+    color.r = getBrdfSample(baseOffset, ind);
+    color.g = getBrdfSample(baseOffset, ind + BRDF_CHANNEL_SIZE);
+    color.b = getBrdfSample(baseOffset, ind + 2 * BRDF_CHANNEL_SIZE);
 
     return color;
 }
+
+// ---------- Importance sampling (tables built by src/vulkan/Brdf.cpp) ----------
+// Per cos(theta_in) bin: marginal CDF over cos(theta_out), then one CDF over phi_out in [0, pi]
+// per cos(theta_out) bin. phi_out is measured from the plane of normal and wi and mirrored randomly
+#define BRDF_SAMPLING_THETA_IN 32
+#define BRDF_SAMPLING_THETA_OUT 32
+#define BRDF_SAMPLING_PHI_OUT 32
+#define BRDF_SAMPLING_SLICE_SIZE ((BRDF_SAMPLING_THETA_OUT + 1) + BRDF_SAMPLING_THETA_OUT * (BRDF_SAMPLING_PHI_OUT + 1))
+#define BRDF_SAMPLING_TABLE_SIZE (BRDF_SAMPLING_THETA_IN * BRDF_SAMPLING_SLICE_SIZE)
+
+layout(binding = 55, std430) buffer BrdfSamplingBuffer {
+    float brdfSampling[];
+};
+
+float rand();
+
+// Last index i in [0, count) with brdfSampling[offset + i] <= value
+int findBrdfCDFInterval(int offset, int count, float value) {
+    int low = 0;
+    int high = count;
+    while (low + 1 < high) {
+        const int middle = (low + high) / 2;
+        if (brdfSampling[offset + middle] <= value) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Tangent frame with x along the projection of wi
+void brdfSamplingFrame(vec3 normal, vec3 wi, out vec3 x, out vec3 y) {
+    x = wi - normal * dot(normal, wi);
+    const float x_length = length(x);
+    x = (x_length > 1e-6) ? x / x_length : normalize(cross(normal, abs(normal.x) < 0.9 ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+    y = cross(normal, x);
+}
+
+int brdfSamplingSliceOffset(int brdfId, vec3 normal, vec3 wi) {
+    const int thetaIn = clamp(int(dot(normal, wi) * BRDF_SAMPLING_THETA_IN), 0, BRDF_SAMPLING_THETA_IN - 1);
+    return brdfId * BRDF_SAMPLING_TABLE_SIZE + thetaIn * BRDF_SAMPLING_SLICE_SIZE;
+}
+
+// Solid angle density of the table bin (thetaOut, phiOut), both phi mirror images are equally likely
+float brdfSamplingBinPdf(int slice, int thetaOut, int phiOut) {
+    const int conditional = slice + BRDF_SAMPLING_THETA_OUT + 1 + thetaOut * (BRDF_SAMPLING_PHI_OUT + 1);
+    const float pdfTheta = (brdfSampling[slice + thetaOut + 1] - brdfSampling[slice + thetaOut]) * BRDF_SAMPLING_THETA_OUT;
+    const float pdfPhi = (brdfSampling[conditional + phiOut + 1] - brdfSampling[conditional + phiOut]) * BRDF_SAMPLING_PHI_OUT / PI;
+    return pdfTheta * pdfPhi * 0.5;
+}
+
+// Density of sampleBrdfDirection generating wo
+float brdfSamplingPdf(int brdfId, vec3 normal, vec3 wi, vec3 wo) {
+    const float cosThetaOut = dot(normal, wo);
+    if (cosThetaOut <= 0.0) {
+        return 0.0;
+    }
+    vec3 x, y;
+    brdfSamplingFrame(normal, wi, x, y);
+    const float phi = abs(atan(dot(wo, y), dot(wo, x)));
+    const int thetaOut = clamp(int(cosThetaOut * BRDF_SAMPLING_THETA_OUT), 0, BRDF_SAMPLING_THETA_OUT - 1);
+    const int phiOut = clamp(int(phi / PI * BRDF_SAMPLING_PHI_OUT), 0, BRDF_SAMPLING_PHI_OUT - 1);
+    return brdfSamplingBinPdf(brdfSamplingSliceOffset(brdfId, normal, wi), thetaOut, phiOut);
+}
+
+// Samples an incident direction proportionally to the tabulated luminance * cos(theta_out)
+vec3 sampleBrdfDirection(int brdfId, vec3 normal, vec3 wi, out float pdf) {
+    const int slice = brdfSamplingSliceOffset(brdfId, normal, wi);
+
+    const float r1 = rand();
+    const int thetaOut = findBrdfCDFInterval(slice, BRDF_SAMPLING_THETA_OUT, r1);
+    const float thetaWidth = brdfSampling[slice + thetaOut + 1] - brdfSampling[slice + thetaOut];
+    const float cosThetaOut = (float(thetaOut) + clamp((r1 - brdfSampling[slice + thetaOut]) / max(thetaWidth, EPSILON), 0.0, 1.0)) / BRDF_SAMPLING_THETA_OUT;
+
+    const float r2 = rand();
+    const int conditional = slice + BRDF_SAMPLING_THETA_OUT + 1 + thetaOut * (BRDF_SAMPLING_PHI_OUT + 1);
+    const int phiOut = findBrdfCDFInterval(conditional, BRDF_SAMPLING_PHI_OUT, r2);
+    const float phiWidth = brdfSampling[conditional + phiOut + 1] - brdfSampling[conditional + phiOut];
+    float phi = (float(phiOut) + clamp((r2 - brdfSampling[conditional + phiOut]) / max(phiWidth, EPSILON), 0.0, 1.0)) / BRDF_SAMPLING_PHI_OUT * PI;
+    if (rand() < 0.5) {
+        phi = -phi;
+    }
+
+    pdf = brdfSamplingBinPdf(slice, thetaOut, phiOut);
+    vec3 x, y;
+    brdfSamplingFrame(normal, wi, x, y);
+    const float sinThetaOut = sqrt(max(0.0, 1.0 - cosThetaOut * cosThetaOut));
+    return normalize(sinThetaOut * (cos(phi) * x + sin(phi) * y) + cosThetaOut * normal);
+}
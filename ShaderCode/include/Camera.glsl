@@ -0,0 +1,30 @@
+vec3 clamp32(vec3 c) {
+  return vec3(max(0.0, min(c.x, 32.0)), max(0.0, min(c.y, 32.0)), max(0.0, min(c.z, 32.0)));
+}
+
+// Camera ray through the pixel, jittered for anti-aliasing. The RNG has to be initialized for the sample
+Ray createCameraRay(ivec2 pixelCoords, ivec2 screenDims) {
+    // center the ray in the pixel.
+    vec2 antiAliasJitter = vec2(rand(), rand()) - 0.5;
+    antiAliasJitter *= 0.5; // reduce jitter amount
+    vec2 uv = (vec2(pixelCoords) + vec2(0.5) + antiAliasJitter) / vec2(screenDims);
+
+    // conversion from [0,1] UV to [-1,1] Clip Space for ray direction
+    vec2 ndc = uv * 2.0 - 1.0; 
+    
+    // Correct for Aspect Ratio
+    ndc.y *= -1.0;
+    ndc.y *= u_aspectRatio;
+
+    vec3 origin = u_CameraPosition;
+    vec3 direction = normalize(
+        ndc.x * u_CameraRight +
+        ndc.y * u_CameraUp +
+        u_FocusDistance * u_CameraForward
+    );
+
+    Ray ray = createRay(origin, direction, int(u_RayBounces));
+    // Ray cone of one pixel, the image plane spans 2 units horizontally at u_FocusDistance
+    ray.coneSpread = atan(2.0 / (float(screenDims.x) * u_FocusDistance));
+    return ray;
+}
@@ -6,4 +6,13 @@ const float REFR_EPS = 1e-4;
 const float NORM_EPS = 1E-12;
 const float INFINITY = 1e500;
 const float PI = 3.1415926535897932384;
-const int MAX_STACK = 128;
\ No newline at end of file
+// kd-tree traversal stack entries, set by src/vulkan/KernelTuner.h
+layout(constant_id = 10) const int MAX_STACK = 128;
+// Object types of the loaded scene, bit n stands for type n (SceneFeatures in src/vulkan/ComputePipeline.h). The
+// raytracing kernel gets a variant per scene that compiles out the other types, the defaults keep all
+layout(constant_id = 6) const uint SCENE_PRIMITIVE_TYPES = 0xFFFFFFFFu;
+layout(constant_id = 7) const uint SCENE_SHADER_TYPES = 0xFFFFFFFFu;
+layout(constant_id = 8) const uint SCENE_LIGHT_TYPES = 0xFFFFFFFFu;
+#define HAS_PRIMITIVE_TYPE(type) ((SCENE_PRIMITIVE_TYPES & (1u << (type))) != 0u)
+#define HAS_SHADER_TYPE(type) ((SCENE_SHADER_TYPES & (1u << (type))) != 0u)
+#define HAS_LIGHT_TYPE(type) ((SCENE_LIGHT_TYPES & (1u << (type))) != 0u)
@@ -0,0 +1,122 @@
+// Importance sampling of the environment map, the distribution is built by src/vulkan/EnvironmentMap.cpp
+// envDistributionCDF holds the marginal CDF over the rows (height + 1 entries)
+// followed by one conditional CDF per row (width + 1 entries each)
+layout(binding = 54, std430) buffer EnvironmentDistribution {
+    uint envDistributionWidth;
+    uint envDistributionHeight;
+    int envDistributionTexture;
+    float envDistributionIntegral;
+    float envDistributionCDF[];
+};
+
+// Environment light gathered by next event estimation at the current hit, added to the radiance by traceRay
+vec3 g_environmentLight;
+
+float rand();
+vec3 traceTransmission(Ray shadowRay);
+
+bool hasEnvironmentDistribution() {
+    return envDistributionWidth > 0u && envDistributionTexture == u_EnvMapTexture;
+}
+
+// Equirectangular mapping of the environment lookup, the azimuth wraps around the texture twice
+vec2 environmentUV(vec3 direction) {
+    const float phi = acos(clamp(direction.y, -1.0, 1.0));
+    const float rho = 2 * atan(direction.z, direction.x) + float(PI);
+    return vec2(rho / (2.0f * float(PI)), phi / float(PI));
+}
+
+float powerHeuristic(float pdfA, float pdfB) {
+    const float a = pdfA * pdfA;
+    const float b = pdfB * pdfB;
+    return (a + b > 0.0) ? a / (a + b) : 0.0;
+}
+
+// Last index i in [0, count) with cdf[offset + i] <= value
+int findCDFInterval(int offset, int count, float value) {
+    int low = 0;
+    int high = count;
+    while (low + 1 < high) {
+        const int middle = (low + high) / 2;
+        if (envDistributionCDF[offset + middle] <= value) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Density of the 2D distribution at texel bin (column, row) with respect to uv
+float environmentBinPdf(int column, int row) {
+    const int width = int(envDistributionWidth);
+    const int height = int(envDistributionHeight);
+    const int rowOffset = height + 1 + row * (width + 1);
+    const float pdfV = (envDistributionCDF[row + 1] - envDistributionCDF[row]) * float(height);
+    const float pdfU = (envDistributionCDF[rowOffset + column + 1] - envDistributionCDF[rowOffset + column]) * float(width);
+    return pdfV * pdfU;
+}
+
+// Solid angle pdf of sampling direction with sampleEnvironmentDirection.
+// Both azimuth copies of a texel are picked with equal probability, so dw = 2 pi^2 sin(theta) du dv
+float environmentPdf(vec3 direction) {
+    const float sinTheta = sqrt(max(0.0, 1.0 - direction.y * direction.y));
+    if (sinTheta <= 0.0) {
+        return 0.0;
+    }
+    const vec2 uv = environmentUV(direction);
+    const int column = clamp(int(fract(uv.x) * float(envDistributionWidth)), 0, int(envDistributionWidth) - 1);
+    const int row = clamp(int(uv.y * float(envDistributionHeight)), 0, int(envDistributionHeight) - 1);
+    return environmentBinPdf(column, row) / (2.0 * PI * PI * sinTheta);
+}
+
+// Direction sampled proportionally to the environment luminance, pdf is with respect to solid angle
+vec3 sampleEnvironmentDirection(out float pdf) {
+    const int width = int(envDistributionWidth);
+    const int height = int(envDistributionHeight);
+
+    const float r1 = rand();
+    const int row = findCDFInterval(0, height, r1);
+    const float rowWidth = envDistributionCDF[row + 1] - envDistributionCDF[row];
+    const float v = (float(row) + clamp((r1 - envDistributionCDF[row]) / max(rowWidth, EPSILON), 0.0, 1.0)) / float(height);
+
+    const float r2 = rand();
+    const int rowOffset = height + 1 + row * (width + 1);
+    const int column = findCDFInterval(rowOffset, width, r2);
+    const float columnWidth = envDistributionCDF[rowOffset + column + 1] - envDistributionCDF[rowOffset + column];
+    const float u = (float(column) + clamp((r2 - envDistributionCDF[rowOffset + column]) / max(columnWidth, EPSILON), 0.0, 1.0)) / float(width);
+
+    // Invert environmentUV, u maps to two azimuths half a turn apart
+    const float theta = v * PI;
+    const float azimuth = (2.0 * PI * u - PI) * 0.5 + ((rand() < 0.5) ? 0.0 : PI);
+    const float sinTheta = sin(theta);
+    pdf = (sinTheta > 0.0) ? environmentBinPdf(column, row) / (2.0 * PI * PI * sinTheta) : 0.0;
+    return vec3(sinTheta * cos(azimuth), cos(theta), sinTheta * sin(azimuth));
+}
+
+// Samples the environment from a surface with the given normal for next event estimation,
+// returns the transmitted radiance / pdf, or 0 if the direction is below the surface or occluded
+vec3 sampleEnvironmentRadiance(vec3 hitpoint, vec3 normal, out vec3 direction, out float pdf) {
+    direction = sampleEnvironmentDirection(pdf);
+    if (pdf <= 0.0 || dot(normal, direction) <= 0.0) {
+        return vec3(0);
+    }
+
+    const vec3 transmission = traceTransmission(createRay(hitpoint, direction, 0));
+    if (transmission == vec3(0)) {
+        return vec3(0);
+    }
+    return transmission * sampleTex(int(u_EnvMapTexture), environmentUV(direction)).rgb / pdf;
+}
+
+// Next event estimation towards the environment for a surface with the given normal,
+// returns L * cos / pdf weighted against a BSDF sample of density bsdfPdf (multiply by the BRDF)
+vec3 sampleEnvironmentLight(vec3 hitpoint, vec3 normal, float bsdfPdf) {
+    vec3 direction;
+    float pdf;
+    const vec3 radiance = sampleEnvironmentRadiance(hitpoint, normal, direction, pdf);
+    if (radiance == vec3(0)) {
+        return vec3(0);
+    }
+    return radiance * (dot(normal, direction) * powerHeuristic(pdf, bsdfPdf));
+}
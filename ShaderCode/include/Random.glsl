@@ -0,0 +1,22 @@
+// Per invocation random numbers, initRng seeds the sequence of one pixel sample
+uint g_rngState;
+uint g_rngCounter;
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+float rand() {
+    g_rngCounter++;
+    return float(hash(g_rngState + g_rngCounter)) / 4294967295.0;
+}
+
+void initRng(uvec2 pixel, uint sampleIndex) {
+    g_rngState = hash(pixel.x + hash(pixel.y + hash(sampleIndex)));
+    g_rngCounter = 0u;
+}
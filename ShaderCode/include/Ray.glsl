@@ -1,5 +1,10 @@
 #include "primitive/Primitive.h.glsl"
 
+// Marks hits whose primitive does not provide a uv parameterization for ray cone LOD
+const float UV_LOD_UNKNOWN = -1e30;
+// Spread angle added by a diffuse bounce, the outgoing cone is much wider than the incoming one
+const float DIFFUSE_CONE_SPREAD = 0.1;
+
 struct Ray {
     vec3 origin;
     vec3 direction;
@@ -10,6 +15,11 @@ struct Ray {
     vec3 tangent;
     vec3 bitangent;
     int remainingBounces;
+    // Ray cone (Akenine-Möller et al., "Texture Level of Detail Strategies for Real-Time Ray Tracing")
+    float coneWidth;    // cone width at the origin
+    float coneSpread;   // cone spread angle
+    float uvLodBias;    // 0.5 * log2(uv area / world area) at the hit, set by the intersection routines
+    float bsdfPdf;      // solid angle pdf the direction was sampled with, 0 for deterministic directions
 };
 
 Ray createRay(vec3 origin, vec3 direction, int remainingBounces) {
@@ -19,5 +29,55 @@ Ray createRay(vec3 origin, vec3 direction, int remainingBounces) {
     ray.rayLength = INFINITY;
     ray.primitive = NULLPRIMITIVE;
     ray.remainingBounces = remainingBounces;
+    ray.coneWidth = 0.0;
+    ray.coneSpread = 0.0;
+    ray.uvLodBias = UV_LOD_UNKNOWN;
+    ray.bsdfPdf = 0.0;
+    return ray;
+}
+
+// Continues the cone of parent from its hit point (specular bounces and refraction keep the spread)
+Ray createSecondaryRay(in Ray parent, vec3 origin, vec3 direction, int remainingBounces) {
+    Ray ray = createRay(origin, direction, remainingBounces);
+    ray.coneWidth = parent.coneWidth + parent.coneSpread * parent.rayLength;
+    ray.coneSpread = parent.coneSpread;
     return ray;
 }
+
+// Mip level for looking up texture ID at the hit of ray
+float computeTextureLod(in Ray ray, int ID) {
+    if (ray.uvLodBias == UV_LOD_UNKNOWN) {
+        return 0.0;
+    }
+    const float width = ray.coneWidth + ray.coneSpread * ray.rayLength;
+    const float cosine = max(abs(dot(ray.normal, ray.direction)), 1e-3);
+    const float texelCount = float(textures[ID].width) * float(textures[ID].height);
+    return ray.uvLodBias + 0.5 * log2(texelCount) + log2(max(width, EPSILON) / cosine);
+}
+
+// Samples texture ID at the surface position of the hit of ray
+vec4 sampleTex(int ID, in Ray ray) {
+    if (!isValidTexture(ID)) {
+        return vec4(0.0);
+    }
+    return sampleTexLod(ID, ray.surface, computeTextureLod(ray, ID));
+}
+
+// Tangent space normal from normal map ID, two channel maps get z reconstructed
+vec3 sampleNormalMap(int ID, in Ray ray) {
+    const vec3 normalColor = sampleTex(ID, ray).rgb;
+    if (isValidTexture(ID) && (textures[ID].flags & TEXTURE_FLAG_RG_NORMAL) != 0u) {
+        const vec2 xy = 2.0 * normalColor.rg - vec2(1.0);
+        return vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
+    }
+    return 2.0 * normalColor - vec3(1.0);
+}
+
+// Samples an equirectangular texture in the direction of ray, filtered by the cone spread
+vec4 sampleTexDirection(int ID, in Ray ray, vec2 uv) {
+    if (!isValidTexture(ID)) {
+        return vec4(0.0);
+    }
+    const float lod = (ray.coneSpread > 0.0) ? log2(ray.coneSpread * float(textures[ID].height) / PI) : 0.0;
+    return sampleTexLod(ID, uv, lod);
+}
@@ -69,25 +69,25 @@ vec3 getSkyColor(vec3 direction) {
     }
 }
 
-vec3 traceRay(inout Ray ray) {
-    vec3 radiance = vec3(0);
-    vec3 throughput = vec3(1);
-
-    while (ray.remainingBounces > 0) {
-        if (intersectScene(ray)) {
-            // If the ray has hit an object, call the shader ...
-            vec3 currentThroughput = throughput;
-            vec3 emission = (u_EnableGI > 0) ? shadeGI(ray, throughput) : shade(ray, throughput);
-            radiance += currentThroughput * emission;
-        } else if (u_EnvMapTexture != 0xFFFFFFFF) {
-            // ... otherwise look up the environment map ...
-            const float phi = acos(ray.direction.y);
-            const float rho = 2 * atan(ray.direction.z, ray.direction.x) + float(PI);
-            return radiance + throughput * sampleTex(int(u_EnvMapTexture), vec2(rho / (2.0f * float(PI)), phi / float(PI))).xyz;
-        } else {
-            // ... if all else fails, just return the background color
-            return radiance + throughput * getSkyColor(ray.direction);
+// Radiance an escaping ray picks up from the environment map or the sky
+vec3 shadeMiss(in Ray ray) {
+    if (u_EnvMapTexture != 0xFFFFFFFF) {
+        // ... look up the environment map ...
+        vec3 environment = sampleTexDirection(int(u_EnvMapTexture), ray, environmentUV(ray.direction)).xyz;
+        if (ray.bsdfPdf > 0.0 && hasEnvironmentDistribution()) {
+            // The diffuse bounce that spawned the ray sampled the environment directly as well
+            environment *= powerHeuristic(ray.bsdfPdf, environmentPdf(ray.direction));
         }
+        return environment;
     }
-    return radiance;
+    // ... if all else fails, just return the background color
+    return getSkyColor(ray.direction);
+}
+
+// Calls the shader of the hit primitive, turns ray into the next path segment and returns the radiance it adds
+vec3 shadeHit(inout Ray ray, inout vec3 throughput) {
+    vec3 currentThroughput = throughput;
+    g_environmentLight = vec3(0);
+    vec3 emission = (u_EnableGI > 0) ? shadeGI(ray, throughput) : shade(ray, throughput);
+    return currentThroughput * emission + g_environmentLight;
 }
\ No newline at end of file
@@ -1,55 +1,39 @@
+// Must match MAX_TEXTURES in src/vulkan/Texture.h
+#define MAX_TEXTURES 256
+#define TEXTURE_FLAG_VALID 1u
+#define TEXTURE_FLAG_RG_NORMAL 2u   // BC5 normal map, only xy are stored
+
 struct Texture {
-    int index;
     int width;
     int height;
+    uint mipLevels;
+    uint flags;
 };
 
 layout(binding = 51, std430) buffer Textures {
     uint textureCount;
+    uint _texturePadding0;
+    uint _texturePadding1;
+    uint _texturePadding2;
     Texture textures[];
 };
 
-layout(binding = 52, std430) buffer TextureData {
-    vec4 textureData[];
-};
+// Indexed by TextureID, unused slots hold a 1x1 placeholder
+layout(binding = 52) uniform sampler2D textureSamplers[MAX_TEXTURES];
 
-vec4 getTexPixelAt(Texture tex, int x, int y) {
-    x = x % tex.width;
-    if (x < 0) x += tex.width;
-    y = y % tex.height;
-    if (y < 0) y += tex.height;
-    int idx = tex.index + y * tex.width + x;
-    return textureData[idx];
+bool isValidTexture(int ID) {
+    return ID >= 0 && ID < int(textureCount) && (textures[ID].flags & TEXTURE_FLAG_VALID) != 0u;
 }
 
-vec4 sampleTex(int ID, vec2 uv) {
-    if (ID < 0 || ID >= int(textureCount)) {
+// The sampler repeats, filters trilinearly and clamps lod to the mip chain of the texture
+vec4 sampleTexLod(int ID, vec2 uv, float lod) {
+    if (!isValidTexture(ID)) {
         return vec4(0.0); // invalid texture ID
     }
-    Texture tex = textures[ID];
-    uv = fract(uv);
-
-    // bilinear interpolation
-    // adjacent pixel coordinates
-    float px = uv.x * float(tex.width);
-    float py = uv.y * float(tex.height);
-
-    int left = int(floor(px));
-    int right = int(ceil(px));
-    int top = int(floor(py));
-    int bottom = int(ceil(py));
-
-    // weights
-    float w0 = float(right) - px;
-    float w1 = 1.0 - w0;
-    float w2 = float(bottom) - py;
-    float w3 = 1.0 - w2;
-
-    // get color values and interpolate
-    vec4 val0 = getTexPixelAt(tex, left, top);
-    vec4 val1 = getTexPixelAt(tex, right, top);
-    vec4 val2 = getTexPixelAt(tex, left, bottom);
-    vec4 val3 = getTexPixelAt(tex, right, bottom);
+    return textureLod(textureSamplers[nonuniformEXT(ID)], uv, lod);
+}
 
-    return w2 * w0 * val0 + w2 * w1 * val1 + w3 * w0 * val2 + w3 * w1 * val3;
-}
\ No newline at end of file
+// Samples mip level 0, see sampleTex(int, Ray) in Ray.glsl for ray cone filtering
+vec4 sampleTex(int ID, vec2 uv) {
+    return sampleTexLod(ID, uv, 0.0);
+}
@@ -0,0 +1,112 @@
+// Path state and queues of the wavefront path tracer, see src/vulkan/WavefrontPipeline.h.
+// Every pixel of the dispatched chunk owns one path, the kernels only pass path indices around
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+// Must match WAVEFRONT_PATH_POOL_SIZE and WAVEFRONT_SHADER_TYPE_COUNT in src/vulkan/WavefrontPipeline.h
+const uint WAVEFRONT_PATH_POOL_SIZE = 262144u;
+const uint WAVEFRONT_SHADER_TYPE_COUNT = 12u;   // shader types 1..11, 0 marks primitives without shader
+
+// Must match WavefrontPushConstants in src/vulkan/WavefrontPipeline.h
+layout(push_constant) uniform WavefrontPushConstants {
+    uint pc_SampleOffset;   // first sample of the dispatch, relative to u_SampleIndex
+    uint pc_SampleCount;    // samples accumulated per pixel by the dispatch
+    uvec2 pc_TileOffset;    // first pixel of the chunk
+    uvec2 pc_TileSize;      // pixels of the chunk, at most WAVEFRONT_PATH_POOL_SIZE
+    uint pc_Sample;         // sample the paths currently trace, 0..pc_SampleCount-1
+};
+
+// The Ray of the current path segment packed into vec4s, followed by the path throughput and radiance
+struct PathState {
+    vec4 origin_rayLength;
+    vec4 direction_bsdfPdf;
+    vec4 normal_coneWidth;
+    vec4 tangent_coneSpread;
+    vec4 bitangent_uvLodBias;
+    vec4 surface;           // xy: surface parameters of the hit
+    vec4 throughput;
+    vec4 radiance;          // of the sample being traced
+    vec4 sampleSum;         // clamped radiance summed over the samples of the dispatch
+    Primitive primitive;
+    uvec4 state;            // x: remaining bounces, y: RNG counter
+};
+
+layout(binding = 60, std430) buffer WavefrontPaths {
+    PathState paths[];
+};
+
+// Three queues of WAVEFRONT_PATH_POOL_SIZE path indices each
+const uint RAY_QUEUE = 0u;                                  // paths waiting for the extend kernel
+const uint HIT_QUEUE = WAVEFRONT_PATH_POOL_SIZE;            // paths that hit a surface, unordered
+const uint SORTED_HIT_QUEUE = 2u * WAVEFRONT_PATH_POOL_SIZE; // the hit queue sorted by shader type
+layout(binding = 61, std430) buffer WavefrontQueues {
+    uint queues[];
+};
+
+// Queue counters and the indirect dispatch arguments derived from them (w of the arguments is unused)
+layout(binding = 62, std430) buffer WavefrontControl {
+    uvec4 extendArgs;
+    uvec4 sortArgs;
+    uvec4 shadeArgs[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint rayCount;
+    uint hitCount;
+    uint binCount[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint binOffset[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint binCursor[WAVEFRONT_SHADER_TYPE_COUNT];
+};
+
+// Threads per workgroup of the queue driven kernels
+const uint WAVEFRONT_GROUP_SIZE = 64u;
+
+uvec4 dispatchArgs(uint count) {
+    return uvec4((count + WAVEFRONT_GROUP_SIZE - 1u) / WAVEFRONT_GROUP_SIZE, 1u, 1u, 0u);
+}
+
+uvec2 pathPixel(uint path) {
+    return pc_TileOffset + uvec2(path % pc_TileSize.x, path / pc_TileSize.x);
+}
+
+uint pathSampleIndex() {
+    return u_SampleIndex + pc_SampleOffset + pc_Sample;
+}
+
+// Continues the random sequence of the path where the previous kernel left it
+void loadRng(uint path) {
+    initRng(pathPixel(path), pathSampleIndex());
+    g_rngCounter = paths[path].state.y;
+}
+
+void storeRng(uint path) {
+    paths[path].state.y = g_rngCounter;
+}
+
+Ray loadRay(uint path) {
+    Ray ray;
+    ray.origin = paths[path].origin_rayLength.xyz;
+    ray.rayLength = paths[path].origin_rayLength.w;
+    ray.direction = paths[path].direction_bsdfPdf.xyz;
+    ray.bsdfPdf = paths[path].direction_bsdfPdf.w;
+    ray.normal = paths[path].normal_coneWidth.xyz;
+    ray.coneWidth = paths[path].normal_coneWidth.w;
+    ray.tangent = paths[path].tangent_coneSpread.xyz;
+    ray.coneSpread = paths[path].tangent_coneSpread.w;
+    ray.bitangent = paths[path].bitangent_uvLodBias.xyz;
+    ray.uvLodBias = paths[path].bitangent_uvLodBias.w;
+    ray.surface = paths[path].surface.xy;
+    ray.primitive = paths[path].primitive;
+    ray.remainingBounces = int(paths[path].state.x);
+    return ray;
+}
+
+void storeRay(uint path, in Ray ray) {
+    paths[path].origin_rayLength = vec4(ray.origin, ray.rayLength);
+    paths[path].direction_bsdfPdf = vec4(ray.direction, ray.bsdfPdf);
+    paths[path].normal_coneWidth = vec4(ray.normal, ray.coneWidth);
+    paths[path].tangent_coneSpread = vec4(ray.tangent, ray.coneSpread);
+    paths[path].bitangent_uvLodBias = vec4(ray.bitangent, ray.uvLodBias);
+    paths[path].surface = vec4(ray.surface, 0.0, 0.0);
+    paths[path].primitive = ray.primitive;
+    paths[path].state.x = uint(max(ray.remainingBounces, 0));
+}
+
+#endif
@@ -6,9 +6,9 @@
 
 Illumination illuminate(inout Ray ray, in Light light) {
     switch (light.lightType) {
-        case 1: return illuminatePointLight(ray, pointLights[light.lightIndex]);
-        case 2: return illuminateAmbientLight(ray, ambientLights[light.lightIndex]);
-        case 3: return illuminateSpotLight(ray, spotLights[light.lightIndex]);
+        case 1: if (HAS_LIGHT_TYPE(1)) return illuminatePointLight(ray, pointLights[light.lightIndex]); break;
+        case 2: if (HAS_LIGHT_TYPE(2)) return illuminateAmbientLight(ray, ambientLights[light.lightIndex]); break;
+        case 3: if (HAS_LIGHT_TYPE(3)) return illuminateSpotLight(ray, spotLights[light.lightIndex]); break;
     }
     return createIllumination(ray.normal);
 }
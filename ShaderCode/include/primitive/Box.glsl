@@ -71,7 +71,11 @@ bool intersectBox(inout Ray ray, in Primitive primitive) {
 
     // Calculate the surface position and tangent vector
     const vec3 target = ray.origin + t * ray.direction;
-    const vec3 surface = componentQuotient(target - minBounds, maxBounds - minBounds);
+    const vec3 extent = maxBounds - minBounds;
+    const vec3 surface = componentQuotient(target - minBounds, extent);
+    // Texture LOD: the uv square covers the whole face
+    const float faceArea = (extent.x * extent.y * extent.z) / extent[tIndex];
+    ray.uvLodBias = (faceArea > 0.0) ? -0.5 * log2(faceArea) : UV_LOD_UNKNOWN;
     if (tIndex == 0) {
         ray.surface = vec2(surface[2], surface[1]);
         ray.tangent = vec3(0, 0, 1);
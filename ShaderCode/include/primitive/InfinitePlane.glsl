@@ -27,6 +27,8 @@ bool intersectInfinitePlane(inout Ray ray, in Primitive primitive) {
 
     // Set the normal
     ray.normal = plane.normal.xyz;
+    // Planes have no uv parameterization, textures fall back to mip level 0
+    ray.uvLodBias = UV_LOD_UNKNOWN;
 
     // Set the new length and the current primitive
     ray.rayLength = t;
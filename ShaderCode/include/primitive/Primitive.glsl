@@ -8,11 +8,11 @@
 
 bool intersect(inout Ray ray, in Primitive primitive) {
     switch (primitive.primitiveType) {
-        case 1: return intersectSphere(ray, primitive);
-        case 2: return intersectTriangle(ray, primitive);
-        case 3: return intersectInfinitePlane(ray, primitive);
-        case 4: return intersectBox(ray, primitive);
-        case 5: return intersectMesh(ray, primitive);
+        case 1: if (HAS_PRIMITIVE_TYPE(1)) return intersectSphere(ray, primitive); break;
+        case 2: if (HAS_PRIMITIVE_TYPE(2)) return intersectTriangle(ray, primitive); break;
+        case 3: if (HAS_PRIMITIVE_TYPE(3)) return intersectInfinitePlane(ray, primitive); break;
+        case 4: if (HAS_PRIMITIVE_TYPE(4)) return intersectBox(ray, primitive); break;
+        case 5: if (HAS_PRIMITIVE_TYPE(5)) return intersectMesh(ray, primitive); break;
     }
     return false;
 }
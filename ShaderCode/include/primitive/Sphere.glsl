@@ -43,6 +43,8 @@ bool intersectSphere(inout Ray ray, in Primitive primitive) {
     ray.surface = vec2(rho / (2 * PI), phi / PI);
     ray.tangent = vec3(sin(rho), 0, cos(rho));
     ray.bitangent = normalize(cross(ray.normal, ray.tangent));
+    // Texture LOD: the uv square covers 2*PI*r by PI*r at the equator
+    ray.uvLodBias = -0.5 * log2(2.0 * PI * PI * sphere.center_radius.w * sphere.center_radius.w);
 
     // Set the new length and the current primitive
     ray.rayLength = t;
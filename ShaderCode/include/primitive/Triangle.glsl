@@ -58,6 +58,12 @@ bool intersectTriangle(inout  Ray ray, in Primitive primitive) {
 
     // Calculate the surface position
     ray.surface = u * triangle.surface[1].xy + v * triangle.surface[2].xy + (1 - u - v) * triangle.surface[0].xy;
+    // Texture LOD: ratio of the uv area to the world space area of the triangle
+    const vec2 uvEdge1 = triangle.surface[1].xy - triangle.surface[0].xy;
+    const vec2 uvEdge2 = triangle.surface[2].xy - triangle.surface[0].xy;
+    const float uvArea = abs(uvEdge1.x * uvEdge2.y - uvEdge1.y * uvEdge2.x);
+    const float worldArea = length(cross(edge1, edge2));
+    ray.uvLodBias = (uvArea > 0.0 && worldArea > 0.0) ? 0.5 * log2(uvArea / worldArea) : UV_LOD_UNKNOWN;
 
     // Set the new length and the current primitive
     ray.rayLength = t;
@@ -7,53 +7,62 @@ layout(binding = 29, std430) buffer BrdfShaders {
     BrdfShader brdfShaders[];
 };
 
-Ray shadeIndirectLight(in Ray ray, in vec3 diffuseColor, inout vec3 throughput);
 Light getRandomLight();
-vec3 lookup_brdf_values(float theta_in, float phi_in, float theta_out, float phi_out, int baseOffset);
+vec3 lookupBrdf(int brdfId, vec3 normal, vec3 wi, vec3 wo);
 
 vec3 shadeBRDFShaderGI(inout Ray ray, inout vec3 throughput) {
     BrdfShader shader = brdfShaders[ray.primitive.shaderIndex];
     vec3 scale = shader.scaleIndex.xyz;
     int brdfId = int(shader.scaleIndex.w);
 
-    // Calculate theta_in (angle between view direction and normal)
-    float theta_in = acos(dot(-ray.normal, ray.direction));
-    float phi_in = 0;
-
-    // Derive local coordinate system
-    vec3 x = cross(-ray.direction, ray.normal);
-    vec3 y = cross(ray.normal, x);
+    const vec3 normal = ray.normal;
+    const vec3 wi = -ray.direction;
 
     vec3 illuminationColor = vec3(0);
     Illumination illum = illuminate(ray, getRandomLight());
 
     // Diffuse term
-    float cosine = dot(-illum.direction, ray.normal);
+    float cosine = dot(-illum.direction, normal);
     if (cosine > 0) {
-        vec3 color = vec3(0);
-
-        // Avoid numeric instability
-        if (cosine < 1) {
-            float theta_out = acos(cosine);
-
-            // Project outgoing vector into local coordinate system
-            vec3 c = cross(-illum.direction, ray.normal);
-            float phi_out = 2 * atan(dot(c, y), dot(c, x));
-
-            color = lookup_brdf_values(theta_in, phi_in, theta_out, phi_out, brdfId);
-        } else {
-            color = lookup_brdf_values(theta_in, phi_in, 0, 0, brdfId);
-        }
+        vec3 color = lookupBrdf(brdfId, normal, wi, -illum.direction);
 
         // Calculate colors
         vec3 diffuseColor = scale * color * cosine * lightCount;
         illuminationColor += diffuseColor * illum.color;
+    }
+
+    if (dot(normal, wi) <= 0) {
+        ray.remainingBounces = 0;
+        return illuminationColor;
+    }
 
-        ray = shadeIndirectLight(ray, scale, throughput);
-    } else {
+    const vec3 hitpoint = ray.origin + (ray.rayLength - LGT_EPS) * ray.direction;
+    if (hasEnvironmentDistribution()) {
+        // Next event estimation towards the environment, weighted against sampling the lobe
+        vec3 lightDirection;
+        float lightPdf;
+        const vec3 lightRadiance = sampleEnvironmentRadiance(hitpoint, normal, lightDirection, lightPdf);
+        if (lightRadiance != vec3(0)) {
+            const float weight = powerHeuristic(lightPdf, brdfSamplingPdf(brdfId, normal, wi, lightDirection));
+            g_environmentLight += throughput * scale * lookupBrdf(brdfId, normal, wi, lightDirection) * dot(normal, lightDirection) * lightRadiance * weight;
+        }
+    }
+
+    // Indirect light, importance sample the measured lobe
+    float pdf;
+    const vec3 wo = sampleBrdfDirection(brdfId, normal, wi, pdf);
+    const float cosOut = dot(normal, wo);
+    if (pdf <= 0 || cosOut <= 0) {
         ray.remainingBounces = 0;
+        return illuminationColor;
     }
 
+    Ray indirectRay = createSecondaryRay(ray, hitpoint, wo, ray.remainingBounces - 1);
+    indirectRay.coneSpread += DIFFUSE_CONE_SPREAD;
+    indirectRay.bsdfPdf = pdf;
+    throughput *= scale * lookupBrdf(brdfId, normal, wi, wo) * cosOut / pdf;
+    ray = indirectRay;
+
     return illuminationColor;
 }
 
@@ -63,14 +72,6 @@ vec3 shadeBRDFShader(inout Ray ray, inout vec3 throughput) {
     int brdfId = int(shader.scaleIndex.w);
     ray.remainingBounces = 0;
 
-    // Calculate theta_in (angle between view direction and normal)
-    float theta_in = acos(dot(-ray.normal, ray.direction));
-    float phi_in = 0;
-
-    // Derive local coordinate system
-    vec3 x = cross(-ray.direction, ray.normal);
-    vec3 y = cross(ray.normal, x);
-
     vec3 illuminationColor = vec3(0);
     // Accumulate the light over all light sources
     for (int i = 0; i < lightCount; i++) {
@@ -79,20 +80,7 @@ vec3 shadeBRDFShader(inout Ray ray, inout vec3 throughput) {
         // Diffuse term
         float cosine = dot(-illum.direction, ray.normal);
         if (cosine > 0) {
-            vec3 color = vec3(0);
-
-            // Avoid numeric instability
-            if (cosine < 1) {
-                float theta_out = acos(cosine);
-
-                // Project outgoing vector into local coordinate system
-                vec3 c = cross(-illum.direction, ray.normal);
-                float phi_out = 2 * atan(dot(c, y), dot(c, x));
-
-                color = lookup_brdf_values(theta_in, phi_in, theta_out, phi_out, brdfId);
-            } else {
-                color = lookup_brdf_values(theta_in, phi_in, 0, 0, brdfId);
-            }
+            vec3 color = lookupBrdf(brdfId, ray.normal, -ray.direction, -illum.direction);
 
             // Calculate colors
             vec3 diffuseColor = scale * color * cosine;
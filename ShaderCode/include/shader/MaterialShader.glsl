@@ -36,11 +36,11 @@ vec3 shadeMaterialShaderGI(inout Ray ray, inout vec3 throughput) {
     // Calculate alpha early for Russian roulette
     float alpha = opacity;
     if (alphaMap != -1)
-        alpha *= sampleTex(alphaMap, ray.surface).r;
+        alpha *= sampleTex(alphaMap, ray).r;
 
     // Calculate effective reflectance
     if (reflectionMap != -1)
-        reflectance *= sampleTex(reflectionMap, ray.surface).r;
+        reflectance *= sampleTex(reflectionMap, ray).r;
 
     // Weights for Russian roulette path selection
     float transparentWeight = 1.0 - alpha;
@@ -54,7 +54,10 @@ vec3 shadeMaterialShaderGI(inout Ray ray, inout vec3 throughput) {
     if (random < transparentWeight) {
         // Pass through (alpha transparency) - no direct contribution
         vec3 origin = ray.origin + (ray.rayLength + EPSILON) * ray.direction;
-        ray = createRay(origin, ray.direction, ray.remainingBounces - 1);
+        const float bsdfPdf = ray.bsdfPdf;
+        ray = createSecondaryRay(ray, origin, ray.direction, ray.remainingBounces - 1);
+        // The direction is unchanged, so is the pdf it was sampled with (environment MIS)
+        ray.bsdfPdf = bsdfPdf;
         // throughput stays the same (we're just passing through)
         return vec3(0);
     }
@@ -64,8 +67,7 @@ vec3 shadeMaterialShaderGI(inout Ray ray, inout vec3 throughput) {
     // (Normal Map) Calculate the new normal vector
     vec3 normal = ray.normal;
     if (normalMap != -1) {
-        const vec3 normalColor = sampleTex(normalMap, ray.surface).rgb;
-        const vec3 textureNormal = vec3(2 * normalColor.r, 2 * normalColor.g, 2 * normalColor.b) - vec3(1);
+        const vec3 textureNormal = sampleNormalMap(normalMap, ray);
         normal = normalize(tangentToWorldSpace(normal, ray.tangent, ray.bitangent, normalize(textureNormal)) * normalCoefficient + (1 - normalCoefficient) * normal);
     }
 
@@ -78,12 +80,12 @@ vec3 shadeMaterialShaderGI(inout Ray ray, inout vec3 throughput) {
     // Get diffuse color from texture
     vec3 diffuseColor = vec3(1.0);
     if (diffuseMap != -1)
-        diffuseColor = sampleTex(diffuseMap, ray.surface).rgb;
+        diffuseColor = sampleTex(diffuseMap, ray).rgb;
 
     // Get specular color from texture
     vec3 specularColor = vec3(1.0);
     if (specularMap != -1)
-        specularColor = sampleTex(specularMap, ray.surface).rgb;
+        specularColor = sampleTex(specularMap, ray).rgb;
 
     vec3 fragmentColor = vec3(0);
 
@@ -104,7 +106,7 @@ vec3 shadeMaterialShaderGI(inout Ray ray, inout vec3 throughput) {
     if (random < transparentWeight + reflectWeight) {
         // Reflection path
         vec3 origin = ray.origin + (ray.rayLength - EPSILON) * ray.direction;
-        ray = createRay(origin, reflection, ray.remainingBounces - 1);
+        ray = createSecondaryRay(ray, origin, reflection, ray.remainingBounces - 1);
         // Scale throughput by reflectance
         throughput *= reflectance;
     } else {
@@ -131,11 +133,11 @@ vec3 shadeMaterialShader(inout Ray ray, inout vec3 throughput) {
     // Calculate alpha early for Russian roulette
     float alpha = opacity;
     if (alphaMap != -1)
-        alpha *= sampleTex(alphaMap, ray.surface).r;
+        alpha *= sampleTex(alphaMap, ray).r;
 
     // Calculate effective reflectance
     if (reflectionMap != -1)
-        reflectance *= sampleTex(reflectionMap, ray.surface).r;
+        reflectance *= sampleTex(reflectionMap, ray).r;
 
     // Weights for Russian roulette path selection
     float transparentWeight = 1.0 - alpha;
@@ -149,7 +151,10 @@ vec3 shadeMaterialShader(inout Ray ray, inout vec3 throughput) {
     if (random < transparentWeight) {
         // Pass through (alpha transparency) - no direct contribution
         vec3 origin = ray.origin + (ray.rayLength + EPSILON) * ray.direction;
-        ray = createRay(origin, ray.direction, ray.remainingBounces - 1);
+        const float bsdfPdf = ray.bsdfPdf;
+        ray = createSecondaryRay(ray, origin, ray.direction, ray.remainingBounces - 1);
+        // The direction is unchanged, so is the pdf it was sampled with (environment MIS)
+        ray.bsdfPdf = bsdfPdf;
         // throughput stays the same (we're just passing through)
         return vec3(0);
     }
@@ -159,8 +164,7 @@ vec3 shadeMaterialShader(inout Ray ray, inout vec3 throughput) {
     // (Normal Map) Calculate the new normal vector
     vec3 normal = ray.normal;
     if (normalMap != -1) {
-        const vec3 normalColor = sampleTex(normalMap, ray.surface).rgb;
-        const vec3 textureNormal = vec3(2 * normalColor.r, 2 * normalColor.g, 2 * normalColor.b) - vec3(1);
+        const vec3 textureNormal = sampleNormalMap(normalMap, ray);
         normal = normalize(tangentToWorldSpace(normal, ray.tangent, ray.bitangent, normalize(textureNormal)) * normalCoefficient + (1 - normalCoefficient) * normal);
     }
 
@@ -173,12 +177,12 @@ vec3 shadeMaterialShader(inout Ray ray, inout vec3 throughput) {
     // Get diffuse color from texture
     vec3 diffuseColor = vec3(1.0);
     if (diffuseMap != -1)
-        diffuseColor = sampleTex(diffuseMap, ray.surface).rgb;
+        diffuseColor = sampleTex(diffuseMap, ray).rgb;
 
     // Get specular color from texture
     vec3 specularColor = vec3(1.0);
     if (specularMap != -1)
-        specularColor = sampleTex(specularMap, ray.surface).rgb;
+        specularColor = sampleTex(specularMap, ray).rgb;
 
     vec3 fragmentColor = vec3(0);
 
@@ -201,7 +205,7 @@ vec3 shadeMaterialShader(inout Ray ray, inout vec3 throughput) {
     if (random < transparentWeight + reflectWeight) {
         // Reflection path
         vec3 origin = ray.origin + (ray.rayLength - EPSILON) * ray.direction;
-        ray = createRay(origin, reflection, ray.remainingBounces - 1);
+        ray = createSecondaryRay(ray, origin, reflection, ray.remainingBounces - 1);
         // Scale throughput by reflectance
         throughput *= reflectance;
     } else {
@@ -22,7 +22,7 @@ vec3 shadeMirrorShader(inout Ray ray, inout vec3 throughput) {
     const vec3 direction = reflect(ray.direction, normal) + normalize(vec3(rand() - 0.5, rand() - 0.5, rand() - 0.5)) * roughness;
 
     // Create a new reflection ray
-    ray = createRay(origin, direction, ray.remainingBounces - 1);
+    ray = createSecondaryRay(ray, origin, direction, ray.remainingBounces - 1);
 
     throughput *= through;
     return vec3(0);
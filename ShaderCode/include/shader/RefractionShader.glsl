@@ -51,6 +51,6 @@ vec3 shadeRefractionShader(inout Ray ray, inout vec3 throughput) {
     }
 
     // Send out a new refracted ray into the scene
-    ray = createRay(origin, direction, ray.remainingBounces);
+    ray = createSecondaryRay(ray, origin, direction, ray.remainingBounces);
     return vec3(0);
 }
\ No newline at end of file
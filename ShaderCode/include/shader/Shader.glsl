@@ -21,7 +21,7 @@ layout(binding = 20, std430) buffer Shaders {
 };
 
 vec3 getGlassTransmission(in Ray ray) {
-    if (ray.primitive.shaderType == 2) {
+    if (HAS_SHADER_TYPE(2) && ray.primitive.shaderType == 2) {
         // RefractionShader
         const RefractionShader shader = refractionShaders[ray.primitive.shaderIndex];
         const vec3 glassColor = shader.color_absorption.xyz;
@@ -30,13 +30,13 @@ vec3 getGlassTransmission(in Ray ray) {
         // Apply Beer's law based on distance through glass
         vec3 absorption = (vec3(1) - glassColor) * absorptionCoeff * ray.rayLength;
         return glassColor * exp(-absorption);
-    } else if (ray.primitive.shaderType == 9) {
+    } else if (HAS_SHADER_TYPE(9) && ray.primitive.shaderType == 9) {
         // MaterialShader
         const MaterialShader shader = materialShaders[ray.primitive.shaderIndex];
         float opacity = shader.alphaMap_opacity.y;
         const int alphaMap = int(shader.alphaMap_opacity.x);
         if (alphaMap != -1)
-            opacity *= sampleTex(alphaMap, ray.surface).r;
+            opacity *= sampleTex(alphaMap, ray).r;
         return vec3(1.0 - opacity);
     } else {
         // Opaque
@@ -66,7 +66,14 @@ Ray shadeIndirectLight(in Ray ray, in vec3 diffuseColor, inout vec3 throughput)
     const vec3 sampleWorld = normalize(sampleLocal.x * bitangent + sampleLocal.y * normal + sampleLocal.z * tangent);
 
     const vec3 hitpoint = ray.origin + (ray.rayLength - LGT_EPS) * ray.direction;
-    Ray indirectRay = createRay(hitpoint, sampleWorld, ray.remainingBounces - 1);
+    Ray indirectRay = createSecondaryRay(ray, hitpoint, sampleWorld, ray.remainingBounces - 1);
+    indirectRay.coneSpread += DIFFUSE_CONE_SPREAD;
+    // Uniform hemisphere sampling, the bounce below implies a BRDF of diffuseColor / (2 pi)
+    indirectRay.bsdfPdf = 1.0 / (2.0 * PI);
+
+    if (hasEnvironmentDistribution()) {
+        g_environmentLight += throughput * diffuseColor * indirectRay.bsdfPdf * sampleEnvironmentLight(hitpoint, normal, indirectRay.bsdfPdf);
+    }
 
     throughput *= diffuseColor * r1;
 
@@ -75,17 +82,17 @@ Ray shadeIndirectLight(in Ray ray, in vec3 diffuseColor, inout vec3 throughput)
 
 vec3 shade(inout Ray ray, inout vec3 throughput) {
     switch (ray.primitive.shaderType) {
-        case 1: return shadeFlatShader(ray, throughput);
-        case 2: return shadeRefractionShader(ray, throughput);
-        case 3: return shadeMirrorShader(ray, throughput);
-        case 4: return shadeSimpleShadowShader(ray, throughput);
-        case 5: return shadeLambertShader(ray, throughput);
-        case 6: return shadePhongShader(ray, throughput);
-        case 7: return shadeCookTorranceShader(ray, throughput);
-        case 8: return shadeBRDFShader(ray, throughput);
-        case 9: return shadeMaterialShader(ray, throughput);
-        case 10: return shadeSimpleTextureShader(ray, throughput);
-        case 11: return shadeEmissiveShader(ray, throughput);
+        case 1: if (HAS_SHADER_TYPE(1)) return shadeFlatShader(ray, throughput); break;
+        case 2: if (HAS_SHADER_TYPE(2)) return shadeRefractionShader(ray, throughput); break;
+        case 3: if (HAS_SHADER_TYPE(3)) return shadeMirrorShader(ray, throughput); break;
+        case 4: if (HAS_SHADER_TYPE(4)) return shadeSimpleShadowShader(ray, throughput); break;
+        case 5: if (HAS_SHADER_TYPE(5)) return shadeLambertShader(ray, throughput); break;
+        case 6: if (HAS_SHADER_TYPE(6)) return shadePhongShader(ray, throughput); break;
+        case 7: if (HAS_SHADER_TYPE(7)) return shadeCookTorranceShader(ray, throughput); break;
+        case 8: if (HAS_SHADER_TYPE(8)) return shadeBRDFShader(ray, throughput); break;
+        case 9: if (HAS_SHADER_TYPE(9)) return shadeMaterialShader(ray, throughput); break;
+        case 10: if (HAS_SHADER_TYPE(10)) return shadeSimpleTextureShader(ray, throughput); break;
+        case 11: if (HAS_SHADER_TYPE(11)) return shadeEmissiveShader(ray, throughput); break;
     }
     ray.remainingBounces = 0;
     return vec3(0);
@@ -93,17 +100,17 @@ vec3 shade(inout Ray ray, inout vec3 throughput) {
 
 vec3 shadeGI(inout Ray ray, inout vec3 throughput) {
     switch (ray.primitive.shaderType) {
-        case 1: return shadeFlatShader(ray, throughput);
-        case 2: return shadeRefractionShader(ray, throughput);
-        case 3: return shadeMirrorShader(ray, throughput);
-        case 4: return shadeSimpleShadowShaderGI(ray, throughput);
-        case 5: return shadeLambertShaderGI(ray, throughput);
-        case 6: return shadePhongShaderGI(ray, throughput);
-        case 7: return shadeCookTorranceShaderGI(ray, throughput);
-        case 8: return shadeBRDFShaderGI(ray, throughput);
-        case 9: return shadeMaterialShaderGI(ray, throughput);
-        case 10: return shadeSimpleTextureShader(ray, throughput);
-        case 11: return shadeEmissiveShader(ray, throughput);
+        case 1: if (HAS_SHADER_TYPE(1)) return shadeFlatShader(ray, throughput); break;
+        case 2: if (HAS_SHADER_TYPE(2)) return shadeRefractionShader(ray, throughput); break;
+        case 3: if (HAS_SHADER_TYPE(3)) return shadeMirrorShader(ray, throughput); break;
+        case 4: if (HAS_SHADER_TYPE(4)) return shadeSimpleShadowShaderGI(ray, throughput); break;
+        case 5: if (HAS_SHADER_TYPE(5)) return shadeLambertShaderGI(ray, throughput); break;
+        case 6: if (HAS_SHADER_TYPE(6)) return shadePhongShaderGI(ray, throughput); break;
+        case 7: if (HAS_SHADER_TYPE(7)) return shadeCookTorranceShaderGI(ray, throughput); break;
+        case 8: if (HAS_SHADER_TYPE(8)) return shadeBRDFShaderGI(ray, throughput); break;
+        case 9: if (HAS_SHADER_TYPE(9)) return shadeMaterialShaderGI(ray, throughput); break;
+        case 10: if (HAS_SHADER_TYPE(10)) return shadeSimpleTextureShader(ray, throughput); break;
+        case 11: if (HAS_SHADER_TYPE(11)) return shadeEmissiveShader(ray, throughput); break;
     }
     ray.remainingBounces = 0;
     return vec3(0);
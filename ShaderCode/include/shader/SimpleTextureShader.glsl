@@ -13,5 +13,5 @@ vec3 shadeSimpleTextureShader(inout Ray ray, in vec3 throughput) {
     int texture = int(shader.color_texture.w);
     ray.remainingBounces = 0;
     
-    return throughput * objectColor * sampleTex(texture, ray.surface).rgb;
+    return throughput * objectColor * sampleTex(texture, ray).rgb;
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include "scene/SceneLoader.h"
 #include "scene/Camera.h"
 #include "vulkan/Renderer.h"
+#include "vulkan/ComputePipeline.h"
+#include "vulkan/ShadingStats.h"
+#include "vulkan/PersistentThreads.h"
 #include "common/Window.h"
 #include "imgui.h"
 
@@ -31,6 +34,9 @@ void RenderImGuiSettings() {
     // Stats display (FPS, Samples first)
     ImGui::Text("FPS: %.1f", s_DeltaTime > 0 ? 1.0 / s_DeltaTime : 0.0);
     ImGui::Text("Samples: %u", uniformBufferData.u_SampleIndex);
+    if (Params::s_ShadingStats) {
+        ImGui::Text("Active Lanes: %.0f%%", ShadingStats::GetActiveLaneRatio() * 100.0);
+    }
 
     ImGui::Separator();
 
@@ -88,6 +94,26 @@ void RenderImGuiSettings() {
         uniformBufferData.u_SampleIndex = 0;
     }
 
+    // All are specialization constants of the raytracing pipeline
+    bool pipelineChanged = false;
+    if (ComputePipeline::IsSortedShadingSupported()) {
+        pipelineChanged |= ImGui::Checkbox("Sorted Shading", &Params::s_SortedShading);
+    }
+    if (ShadingStats::IsSupported()) {
+        pipelineChanged |= ImGui::Checkbox("Shading Stats", &Params::s_ShadingStats);
+    }
+    if (PersistentThreads::IsSupported()) {
+        pipelineChanged |= ImGui::Checkbox("Persistent Threads", &Params::s_PersistentThreads);
+    }
+    if (pipelineChanged) {
+        ComputePipeline::RecreatePipeline();
+    }
+    ImGui::Checkbox("Scene Variant", &Params::s_SceneVariants);
+    if (Params::s_SceneVariants && ComputePipeline::IsSceneVariantPending()) {
+        ImGui::SameLine();
+        ImGui::Text("(building)");
+    }
+
     ImGui::Separator();
 
     ImGui::Text("Camera Settings");
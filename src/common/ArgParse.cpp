@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <algorithm>
 #include "Params.h"
 #include "Log.h"
 
@@ -130,6 +131,48 @@ void ArgParse::SetUpArgFunctions() {
     AddArgFunction({"-b", "--bounces"}, [](ArgFuncInput input) {
         Params::s_Bounces = NextArg<uint32_t>(input);
     }, "<bounces> set the number of ray bounces");
+    AddArgFunction("--export-binary", [](ArgFuncInput input) {
+        Params::s_ExportBinaryScene = NextArg<std::string>(input);
+        Params::s_InteractiveMode = false;
+    }, "<filename> convert the input scene to a binary .trs scene and exit");
+    AddArgFunction("--export-no-kdtree", [](ArgFuncInput input) { Params::s_ExportKDTree = false; }, "Do not store the KD-tree in exported binary scenes");
+    AddArgFunction("--no-kdtree-cache", [](ArgFuncInput input) { Params::s_KDTreeCache = false; }, "Always rebuild the KD-tree instead of reusing KDTreeCache/");
+    AddArgFunction("--no-mipmaps", [](ArgFuncInput input) { Params::s_TextureMipmaps = false; }, "Only upload mip level 0 of every texture");
+    AddArgFunction("--no-texture-compression", [](ArgFuncInput input) { Params::s_TextureCompression = false; }, "Keep textures uncompressed instead of using BC formats from TextureCache/");
+    AddArgFunction("--no-env-sampling", [](ArgFuncInput input) { Params::s_EnvironmentSampling = false; }, "Only hit the environment map with escaping rays instead of sampling it from diffuse surfaces");
+    AddArgFunction("--benchmark-load", [](ArgFuncInput input) {
+        Params::s_BenchmarkLoadRuns = NextArg<uint32_t>(input);
+        Params::s_InteractiveMode = false;
+    }, "<runs> load the input scene <runs> times, report the load times and exit");
+    AddArgFunction("--frames-in-flight", [](ArgFuncInput input) {
+        const uint32_t frames = NextArg<uint32_t>(input);
+        Params::s_FramesInFlight = std::clamp<uint32_t>(frames, 1, Params::MAX_FRAMES_IN_FLIGHT);
+        if (Params::s_FramesInFlight != frames) {
+            RT_WARN("--frames-in-flight {0} is out of range, using {1}", frames, Params::s_FramesInFlight);
+        }
+    }, "<frames> number of frames the CPU may prepare while the GPU renders (1-3, default 2)");
+    AddArgFunction("--samples-per-submit", [](ArgFuncInput input) {
+        Params::s_SamplesPerSubmit = std::max<uint32_t>(NextArg<uint32_t>(input), 1);
+    }, "<samples> samples per pixel one headless dispatch accumulates (default 16), lower it if the driver times out");
+    AddArgFunction("--wavefront", [](ArgFuncInput input) { Params::s_Wavefront = true; }, "Trace paths with the wavefront kernels instead of the single raytracing kernel");
+    AddArgFunction("--benchmark-render", [](ArgFuncInput input) {
+        Params::s_BenchmarkRenderRuns = NextArg<uint32_t>(input);
+        Params::s_InteractiveMode = false;
+    }, "<runs> render the input scene <runs> times with the single kernel and the wavefront kernels, report the render times and exit");
+    AddArgFunction("--sorted-shading", [](ArgFuncInput input) { Params::s_SortedShading = true; }, "Sort the hits of every workgroup by shader type before shading them");
+    AddArgFunction("--shading-stats", [](ArgFuncInput input) { Params::s_ShadingStats = true; }, "Measure the active lane ratio of the shading (divergence between shader types)");
+    AddArgFunction("--persistent-threads", [](ArgFuncInput input) { Params::s_PersistentThreads = true; }, "Launch a fixed number of workgroups that take pixels from a shared counter until the dispatch is done");
+    AddArgFunction("--workgroup-size", [](ArgFuncInput input) {
+        const std::string size = NextArg<std::string>(input);
+        const size_t separator = size.find('x');
+        RT_ASSERT(separator != std::string::npos, "--workgroup-size expects <width>x<height>");
+        Params::s_WorkgroupWidth = to_uint32(size.substr(0, separator));
+        Params::s_WorkgroupHeight = to_uint32(size.substr(separator + 1));
+    }, "<width>x<height> workgroup shape of the raytracing kernel (default 16x16 or the --autotune result)");
+    AddArgFunction("--morton-order", [](ArgFuncInput input) { Params::s_MortonOrder = true; }, "Map the invocations of a workgroup to its pixels along a Morton curve");
+    AddArgFunction("--max-stack", [](ArgFuncInput input) { Params::s_MaxStack = NextArg<uint32_t>(input); }, "<entries> kd-tree traversal stack size of the kernels (at least 32, default 128)");
+    AddArgFunction("--autotune", [](ArgFuncInput input) { Params::s_AutoTune = true; }, "Benchmark raytracing kernel configurations with the loaded scene and remember the fastest for this device");
+    AddArgFunction("--no-scene-variants", [](ArgFuncInput input) { Params::s_SceneVariants = false; }, "Always trace with the raytracing kernel that supports every primitive, shader and light type");
     AddArgFunction("--non-interactive", [](ArgFuncInput input) { Params::s_InteractiveMode = false; }, "Run tracey_rt in non-interactive mode explicitly");
     AddArgFunction("--version", PrintVersion, "Display the version");
 }
@@ -0,0 +1,53 @@
+#include "AtomicFile.h"
+#include "common/Log.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#include <process.h>
+#define GETPID _getpid
+#else
+#include <unistd.h>
+#define GETPID getpid
+#endif
+
+std::string GetTemporaryFilename(const std::string& filename) {
+    // Batch jobs on the same scene and worker threads of one process may write the same file at once
+    static std::atomic<uint32_t> s_TempCounter = 0;
+    return filename + "." + std::to_string(GETPID()) + "." + std::to_string(s_TempCounter++) + ".tmp";
+}
+
+bool WriteFileAtomically(const std::string& filename, const std::function<void(std::ostream&)>& writeContents) {
+    try {
+        std::filesystem::create_directories(std::filesystem::path(filename).parent_path());
+    } catch (const std::filesystem::filesystem_error& e) {
+        RT_WARN("Cannot create the directory of {0}: {1}", filename, e.what());
+        return false;
+    }
+
+    const std::string tempFilename = GetTemporaryFilename(filename);
+    std::error_code error;
+    {
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            RT_WARN("Cannot write {0}", filename);
+            return false;
+        }
+        writeContents(file);
+        if (!file.good()) {
+            RT_WARN("Failed to write {0}", filename);
+            file.close();
+            std::filesystem::remove(tempFilename, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tempFilename, filename, error);
+    if (error) {
+        RT_WARN("Failed to store {0}: {1}", filename, error.message());
+        std::filesystem::remove(tempFilename, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Writes a file through a temporary file next to it that is renamed into place, so other processes
+// only ever see the old or the complete new file. The temporary name is unique per process and call.
+// Creates the parent directory, logs a warning and returns false on failure
+bool WriteFileAtomically(const std::string& filename, const std::function<void(std::ostream&)>& writeContents);
+// Temporary name next to filename that no other process or call uses, for files written by other
+// means (e.g. an external compiler) and renamed into place afterwards
+std::string GetTemporaryFilename(const std::string& filename);
+
+#endif
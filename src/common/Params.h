@@ -10,6 +10,9 @@ struct Params {
     static uint32_t GetSampleCount() { return s_Samples; }
     static std::string GetResultImageName() { return s_ResultImageName; }
     static std::string GetInputSceneFilename() { return s_InputScene; }
+    static std::string GetExportBinaryFilename() { return s_ExportBinaryScene; }
+    static uint32_t GetFramesInFlight() { return s_FramesInFlight; }
+    static uint32_t GetSamplesPerSubmit() { return s_SamplesPerSubmit; }
 
     inline static uint32_t s_Width = 1920;
     inline static uint32_t s_Height = 1080;
@@ -19,8 +22,35 @@ struct Params {
     inline static uint32_t s_Bounces = 4;
     inline static std::string s_ResultImageName = "result.png";
     inline static std::string s_InputScene = "";
+    inline static std::string s_ExportBinaryScene = "";
+    inline static bool s_ExportKDTree = true;
+    inline static bool s_KDTreeCache = true;
+    inline static bool s_TextureMipmaps = true;
+    inline static bool s_TextureCompression = true;
+    inline static bool s_EnvironmentSampling = true;
+    inline static uint32_t s_BenchmarkLoadRuns = 0;
+    inline static uint32_t s_FramesInFlight = 2;
+    inline static uint32_t s_SamplesPerSubmit = 16;
+    inline static bool s_Wavefront = false;
+    inline static uint32_t s_BenchmarkRenderRuns = 0;
+    inline static bool s_SortedShading = false;
+    inline static bool s_ShadingStats = false;
+    inline static bool s_PersistentThreads = false;
+    // Raytracing kernel overrides, 0 keeps the tuned or default value (see src/vulkan/KernelTuner.h)
+    inline static uint32_t s_WorkgroupWidth = 0;
+    inline static uint32_t s_WorkgroupHeight = 0;
+    inline static bool s_MortonOrder = false;
+    inline static uint32_t s_MaxStack = 0;
+    inline static bool s_AutoTune = false;
+    inline static bool s_SceneVariants = true;
 
     constexpr static bool ENABLE_SHADER_HOT_RELOAD = true;
+    constexpr static const char* KDTREE_CACHE_DIRECTORY = "KDTreeCache";
+    constexpr static const char* TEXTURE_CACHE_DIRECTORY = "TextureCache";
+    constexpr static const char* KERNEL_TUNING_CACHE_DIRECTORY = "KernelTuningCache";
+    constexpr static const char* PIPELINE_CACHE_DIRECTORY = "PipelineCache";
+    // The swapchain has at least this many images, ImGui keeps one vertex buffer per image
+    constexpr static uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    threadCount = std::max(1u, threadCount);
+    m_Workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        m_Workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+    for (std::thread& worker : m_Workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this]() { return m_Stop || !m_Tasks.empty(); });
+            if (m_Stop && m_Tasks.empty()) {
+                return;
+            }
+            task = std::move(m_Tasks.front());
+            m_Tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func) {
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || m_Workers.size() == 1) {
+        for (uint32_t i = 0; i < count; i++) func(i);
+        return;
+    }
+
+    // Workers pull indices from a shared counter and the calling thread helps out as well.
+    // The caller only waits for the indices to finish (not for the helper tasks to start),
+    // so ParallelFor may be nested inside tasks of the same pool without deadlocking.
+    struct State {
+        std::function<void(uint32_t)> func;
+        uint32_t count;
+        std::atomic<uint32_t> next { 0 };
+        std::atomic<uint32_t> done { 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    state->func = func;
+    state->count = count;
+
+    auto worker = [state]() {
+        for (uint32_t i = state->next++; i < state->count; i = state->next++) {
+            state->func(i);
+            if (++state->done == state->count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    const uint32_t helpers = std::min<uint32_t>(count, GetThreadCount()) - 1;
+    for (uint32_t i = 0; i < helpers; i++) {
+        Enqueue(worker);
+    }
+    worker();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->done == state->count; });
+}
+
+ThreadPool& ThreadPool::Get() {
+    static ThreadPool s_Pool;
+    return s_Pool;
+}
@@ -2,9 +2,13 @@
 #include "vulkan/ShaderCompiler.h"
 #include "vulkan/Texture.h"
 #include "vulkan/ImGuiLayer.h"
+#include "vulkan/OffscreenResources.h"
+#include "vulkan/ShadingStats.h"
+#include "vulkan/KernelTuner.h"
 #include "scene/Camera.h"
 #include "scene/Scene.h"
 #include "scene/SceneLoader.h"
+#include "scene/BinaryScene.h"
 #include "primitives/Sphere.h"
 #include "primitives/Mesh.h"
 #include "primitives/Triangle.h"
@@ -17,6 +21,7 @@
 #include "common/Params.h"
 #include "common/ProgressBar.h"
 #include "common/ArgParse.h"
+#include "common/ThreadPool.h"
 #include "UserInterface.h"
 #include <GLFW/glfw3.h>
 
@@ -35,7 +40,7 @@ void InitWindow() {
     s_PreviousTime = std::chrono::steady_clock::now();
     s_Window = Window::Create(WindowParams{ "Vulkan Raytracer", 1280, 720, false });
     Window::OnDropFileCallback = [](const std::string& filepath) {
-        if (ends_with(filepath, ".json")) {
+        if (ends_with(filepath, ".json") || BinaryScene::IsBinarySceneFile(filepath)) {
             RT_INFO("Loading scene from file: {}", filepath);
             SceneLoader::LoadScene(*s_Scene, filepath);
         }
@@ -72,43 +77,26 @@ void InitVulkan() {
 }
 
 void MainLoop() {
-    uint32_t frameCount = 0;
-    auto timer = std::chrono::steady_clock::now();
     bool is_rendering = true;
 
     while (is_rendering) {
-        // ImGui frame (only in interactive mode)
-        if (Params::IsInteractiveMode()) {
-            ImGuiLayer::BeginFrame();
-            RenderImGuiSettings();
-            ImGuiLayer::EndFrame();
-        }
+        ImGuiLayer::BeginFrame();
+        RenderImGuiSettings();
+        ImGuiLayer::EndFrame();
 
         s_Scene->UpdateGPUBuffers();
         Renderer::Draw();
-        frameCount++;
 
         if (Params::ENABLE_SHADER_HOT_RELOAD) {
             ShaderCompiler::CompileAllShaders();
         }
-        if (Params::IsInteractiveMode()) {
-            SceneLoader::HotReloadSceneIfNeeded(*s_Scene);
-        }
+        SceneLoader::HotReloadSceneIfNeeded(*s_Scene);
 
         auto currentTime = std::chrono::steady_clock::now();
 		auto elapsed = currentTime.time_since_epoch() - s_PreviousTime.time_since_epoch();
 
 		s_DeltaTime = elapsed.count() / 1000000000.0;
         s_PreviousTime = currentTime;
-
-        // Update progress bar (headless mode only)
-        if (std::chrono::duration_cast<std::chrono::seconds>(currentTime - timer).count() >= 1.0) {
-            if (!Params::IsInteractiveMode()) {
-                ProgressBar::Update(frameCount, uniformBufferData.u_SampleIndex);
-            }
-            frameCount = 0;
-            timer = currentTime;
-        }
         CameraUpdate(*s_Scene, s_DeltaTime);
 
         // Ctrl+S to save (keyboard shortcut)
@@ -116,26 +104,130 @@ void MainLoop() {
             Renderer::SaveCurrentFrameToDisk(Params::GetResultImageName());
         }
 
-        if (Params::IsInteractiveMode()) {
-            is_rendering = !glfwWindowShouldClose(Window::GetGLFWwindow());
-            glfwPollEvents();
-            glfwSwapInterval(0);
-            Input::Tick();
-        } else {
-            is_rendering = uniformBufferData.u_SampleIndex < Params::GetSampleCount();
+        is_rendering = !glfwWindowShouldClose(Window::GetGLFWwindow());
+        glfwPollEvents();
+        glfwSwapInterval(0);
+        Input::Tick();
+    }
+}
+
+// Queues all samples in batches of Params::GetSamplesPerSubmit() per dispatch. The scene and the
+// uniform buffer are uploaded once, the CPU only waits for the GPU to report progress
+void RenderHeadless() {
+    s_Scene->UpdateGPUBuffers();
+    const uint32_t sampleCount = Params::GetSampleCount();
+
+    auto timer = std::chrono::steady_clock::now();
+    uint64_t reportedSamples = 0;
+    uint32_t submittedSamples = 0;
+    auto reportProgress = [&]() {
+        const uint64_t completedSamples = Renderer::GetCompletedHeadlessSamples();
+        ProgressBar::Update(static_cast<uint32_t>(completedSamples - reportedSamples), static_cast<uint32_t>(completedSamples));
+        reportedSamples = completedSamples;
+    };
+
+    while (submittedSamples < sampleCount) {
+        const uint32_t batch = std::min(Params::GetSamplesPerSubmit(), sampleCount - submittedSamples);
+        Renderer::SubmitHeadlessSamples(submittedSamples, batch);
+        submittedSamples += batch;
+
+        auto currentTime = std::chrono::steady_clock::now();
+        if (std::chrono::duration_cast<std::chrono::seconds>(currentTime - timer).count() >= 1.0) {
+            reportProgress();
+            timer = currentTime;
         }
     }
 
-    if (!Params::IsInteractiveMode()) {
-        ProgressBar::Update(frameCount, uniformBufferData.u_SampleIndex);
-        Renderer::SaveCurrentFrameToDisk(Params::GetResultImageName());
+    Renderer::WaitForHeadlessSamples();
+    uniformBufferData.u_SampleIndex = sampleCount;
+    reportProgress();
+    if (Params::s_ShadingStats) {
+        RT_INFO("Shading active lane ratio: {0:.1f}%", ShadingStats::GetAverageActiveLaneRatio() * 100.0);
     }
+    Renderer::SaveCurrentFrameToDisk(Params::GetResultImageName());
 }
 
 void Cleanup() {
     Renderer::Cleanup();
 }
 
+int ExportBinaryScene() {
+    // Run the regular conversion once so every GPU buffer holds its final layout
+    s_Scene->UpdateGPUBuffers();
+    bool success = BinaryScene::Export(Params::GetExportBinaryFilename(), Params::s_ExportKDTree);
+    Cleanup();
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int BenchmarkSceneLoad() {
+    if (Params::GetInputSceneFilename() == "") {
+        RT_ERROR("--benchmark-load needs an input scene");
+        Cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // The initial load in InitScene warmed up the KD-tree and texture caches
+    std::vector<double> times;
+    for (uint32_t run = 0; run < Params::s_BenchmarkLoadRuns; run++) {
+        Texture::ResetLoadStats();
+        auto start = std::chrono::steady_clock::now();
+        SceneLoader::LoadScene(*s_Scene, Params::GetInputSceneFilename());
+        s_Scene->UpdateGPUBuffers();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        const TextureLoadStats stats = Texture::GetLoadStats();
+        RT_INFO("Load run {0}: {1:.2f} ms, {2} textures decoded in {3:.2f} ms of worker time, {4:.2f} ms joining and uploading",
+            run + 1, times.back(), stats.decodedCount, stats.decodeMilliseconds, stats.waitMilliseconds);
+    }
+
+    if (!times.empty()) {
+        std::sort(times.begin(), times.end());
+        double sum = 0.0;
+        for (double time : times) sum += time;
+        RT_INFO("Scene load {0}: min {1:.2f} ms, median {2:.2f} ms, mean {3:.2f} ms over {4} runs ({5} threads)",
+            Params::GetInputSceneFilename(), times.front(), times[times.size() / 2], sum / times.size(), times.size(), ThreadPool::Get().GetThreadCount());
+    }
+    Cleanup();
+    return EXIT_SUCCESS;
+}
+
+int BenchmarkRender() {
+    s_Scene->UpdateGPUBuffers();
+    const uint32_t sampleCount = Params::GetSampleCount();
+    auto render = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t submittedSamples = 0; submittedSamples < sampleCount; submittedSamples += Params::GetSamplesPerSubmit()) {
+            Renderer::SubmitHeadlessSamples(submittedSamples, std::min(Params::GetSamplesPerSubmit(), sampleCount - submittedSamples));
+        }
+        Renderer::WaitForHeadlessSamples();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // Every run renders the same samples again, u_SampleIndex stays 0
+    for (bool wavefront : { false, true }) {
+        Params::s_Wavefront = wavefront;
+        const char* mode = wavefront ? "wavefront" : "megakernel";
+        // Untimed warm-up, lets the GPU clocks and the tile sizes settle
+        render();
+
+        std::vector<double> times;
+        for (uint32_t run = 0; run < Params::s_BenchmarkRenderRuns; run++) {
+            times.push_back(render());
+            RT_INFO("Render run {0} ({1}): {2:.2f} ms", run + 1, mode, times.back());
+        }
+
+        std::sort(times.begin(), times.end());
+        double sum = 0.0;
+        for (double time : times) sum += time;
+        const double megaSamples = double(OffscreenResources::GetWidth()) * OffscreenResources::GetHeight() * sampleCount / 1e6;
+        RT_INFO("Render {0} ({1}, {2} spp): min {3:.2f} ms, median {4:.2f} ms, mean {5:.2f} ms over {6} runs, {7:.1f} Msamples/s",
+            Params::GetInputSceneFilename(), mode, sampleCount, times.front(), times[times.size() / 2], sum / times.size(), times.size(), megaSamples / (times.front() / 1000.0));
+    }
+    Renderer::SaveCurrentFrameToDisk(Params::GetResultImageName());
+    Cleanup();
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv) {
     Log::Init();
     ArgParse::ParseInput(argc, argv);
@@ -144,7 +236,24 @@ int main(int argc, char** argv) {
     }
     InitVulkan();
     InitScene();
-    MainLoop();
+    if (Params::GetExportBinaryFilename() != "") {
+        return ExportBinaryScene();
+    }
+    if (Params::s_BenchmarkLoadRuns > 0) {
+        return BenchmarkSceneLoad();
+    }
+    if (Params::s_AutoTune) {
+        s_Scene->UpdateGPUBuffers();
+        KernelTuner::AutoTune();
+    }
+    if (Params::s_BenchmarkRenderRuns > 0) {
+        return BenchmarkRender();
+    }
+    if (Params::IsInteractiveMode()) {
+        MainLoop();
+    } else {
+        RenderHeadless();
+    }
     Cleanup();
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,349 @@
+#include "BinaryScene.h"
+#include "Scene.h"
+#include "SceneLoader.h"
+#include "common/Log.h"
+#include "common/Params.h"
+#include "scene/Camera.h"
+#include "vulkan/Buffer.h"
+#include "vulkan/Texture.h"
+#include "vulkan/EnvironmentMap.h"
+
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern UBO uniformBufferData;
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        m_File = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0) return;
+        m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_Mapping) return;
+        m_Data = static_cast<const byte*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_Data) m_Size = static_cast<size_t>(size.QuadPart);
+#else
+        m_File = open(filename.c_str(), O_RDONLY);
+        if (m_File < 0) return;
+        struct stat st;
+        if (fstat(m_File, &st) != 0 || st.st_size == 0) return;
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, m_File, 0);
+        if (data == MAP_FAILED) return;
+        // The whole file is consumed front to back right after mapping
+        madvise(data, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+        m_Data = static_cast<const byte*>(data);
+        m_Size = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_Data) UnmapViewOfFile(m_Data);
+        if (m_Mapping) CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+#else
+        if (m_Data) munmap(const_cast<byte*>(m_Data), m_Size);
+        if (m_File >= 0) close(m_File);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const byte* GetData() const { return m_Data; }
+    size_t GetSize() const { return m_Size; }
+    bool IsValid() const { return m_Data != nullptr; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+    const byte* m_Data = nullptr;
+    size_t m_Size = 0;
+};
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static std::shared_ptr<Buffer> FindBuffer(uint32_t binding) {
+    for (auto& buffer : Buffer::GetAllBuffers()) {
+        if (buffer->GetBindingPoint() == binding) {
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+static bool IsKDTreeBinding(uint32_t binding) {
+    return binding == BINARY_SCENE_KDTREE_BINDING || binding == BINARY_SCENE_KDTREE_INDICES_BINDING;
+}
+
+static std::vector<byte> SerializeTextures() {
+    const auto& textures = Texture::GetAllTextures();
+    std::vector<byte> payload(sizeof(uint32_t) * 4, 0);
+    const uint32_t count = static_cast<uint32_t>(textures.size());
+    std::memcpy(payload.data(), &count, sizeof(count));
+
+    for (const Texture* texture : textures) {
+        BinarySceneTextureRecord record = {};
+        if (texture && !texture->GetTexels().empty()) {
+            record.width = texture->GetWidth();
+            record.height = texture->GetHeight();
+            record.format = texture->GetFormat();
+            record.usage = static_cast<uint32_t>(texture->GetUsage());
+            record.size = texture->GetTexels().size();
+        }
+        const size_t offset = payload.size();
+        payload.resize(AlignUp(offset + sizeof(record) + record.size, BINARY_SCENE_ALIGNMENT), 0);
+        std::memcpy(payload.data() + offset, &record, sizeof(record));
+        if (record.size > 0) {
+            std::memcpy(payload.data() + offset + sizeof(record), texture->GetTexels().data(), record.size);
+        }
+    }
+    return payload;
+}
+
+// Recreates the textures in TextureID order so the IDs baked into the shader buffers stay valid
+// Walks the texture records of a texture section, validateOnly only checks the layout
+static bool LoadTextures(const byte* data, size_t size, bool validateOnly) {
+    if (size < sizeof(uint32_t) * 4) {
+        return false;
+    }
+    uint32_t count;
+    std::memcpy(&count, data, sizeof(count));
+
+    size_t offset = sizeof(uint32_t) * 4;
+    for (uint32_t i = 0; i < count; i++) {
+        BinarySceneTextureRecord record;
+        if (offset + sizeof(record) > size) return false;
+        std::memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.size > size - offset) return false;
+
+        if (validateOnly) {
+            // Only the layout is checked, skip the texels
+        } else if (record.width == 0 || record.height == 0) {
+            // Keep the slot occupied, nothing references it
+            const byte black[4] = { 0, 0, 0, 0 };
+            new Texture(1, 1, VK_FORMAT_R8G8B8A8_UNORM, black, sizeof(black));
+        } else {
+            new Texture(record.width, record.height, static_cast<VkFormat>(record.format), data + offset, record.size, static_cast<TextureUsage>(record.usage));
+        }
+        offset = AlignUp(offset + record.size, BINARY_SCENE_ALIGNMENT);
+    }
+    return true;
+}
+
+bool BinaryScene::IsBinarySceneFile(const std::string& filename) {
+    return filename.size() >= 4 &&
+        (filename.substr(filename.size() - 4) == ".trs" || filename.substr(filename.size() - 4) == ".TRS");
+}
+
+bool BinaryScene::Export(const std::string& filename, bool includeKDTree) {
+    auto buffers = Buffer::GetAllBuffers();
+    std::sort(buffers.begin(), buffers.end(), [](const auto& a, const auto& b) {
+        return a->GetBindingPoint() < b->GetBindingPoint();
+    });
+
+    std::vector<std::shared_ptr<Buffer>> exported;
+    for (auto& buffer : buffers) {
+        if (buffer->GetUsedSize() == 0) continue;
+        if (!includeKDTree && IsKDTreeBinding(buffer->GetBindingPoint())) continue;
+        // Rebuilt by Texture / EnvironmentMap when the texture section is loaded
+        if (buffer->GetBindingPoint() == TEXTURE_TABLE_BINDING || buffer->GetBindingPoint() == ENVIRONMENT_DISTRIBUTION_BINDING) continue;
+        exported.push_back(buffer);
+    }
+
+    std::vector<byte> texturePayload;
+    if (!Texture::GetAllTextures().empty()) {
+        texturePayload = SerializeTextures();
+    }
+    const size_t sectionCount = exported.size() + (texturePayload.empty() ? 0 : 1);
+
+    BinarySceneHeader header = {};
+    std::memcpy(header.magic, BINARY_SCENE_MAGIC, sizeof(header.magic));
+    header.version = BINARY_SCENE_VERSION;
+    header.sectionCount = static_cast<uint32_t>(sectionCount);
+    header.flags = includeKDTree ? BINARY_SCENE_FLAG_HAS_KDTREE : BINARY_SCENE_FLAG_NONE;
+
+    std::vector<BinarySceneSection> sections(sectionCount);
+    uint64_t offset = AlignUp(sizeof(BinarySceneHeader) + sizeof(BinarySceneSection) * sections.size(), BINARY_SCENE_ALIGNMENT);
+    for (size_t i = 0; i < sections.size(); i++) {
+        sections[i].binding = i < exported.size() ? exported[i]->GetBindingPoint() : BINARY_SCENE_TEXTURE_BINDING;
+        sections[i].offset = offset;
+        sections[i].size = i < exported.size() ? exported[i]->GetUsedSize() : texturePayload.size();
+        offset = AlignUp(offset + sections[i].size, BINARY_SCENE_ALIGNMENT);
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        RT_ERROR("Cannot open {0} for writing", filename);
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(sections.data()), sizeof(BinarySceneSection) * sections.size());
+
+    std::vector<byte> payload;
+    for (size_t i = 0; i < sections.size(); i++) {
+        // Pad up to the aligned section start
+        std::vector<char> padding(sections[i].offset - static_cast<uint64_t>(file.tellp()), 0);
+        file.write(padding.data(), padding.size());
+
+        if (i < exported.size()) {
+            payload.resize(sections[i].size);
+            exported[i]->ReadData(payload.data(), payload.size());
+            file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        } else {
+            file.write(reinterpret_cast<const char*>(texturePayload.data()), texturePayload.size());
+        }
+    }
+
+    if (!file.good()) {
+        RT_ERROR("Failed to write binary scene {0}", filename);
+        return false;
+    }
+
+    RT_INFO("Exported binary scene {0}: {1} sections, {2} bytes", filename, sections.size(), static_cast<uint64_t>(file.tellp()));
+    return true;
+}
+
+// The uniform buffer is rewritten every frame from uniformBufferData, so its section
+// only carries the scene settings (camera, environment map, GI) instead of being uploaded
+static void ApplyUniformSection(const byte* data, size_t size) {
+    if (size < sizeof(UBO)) {
+        RT_WARN("Binary scene uniform section is too small ({0} bytes), ignoring", size);
+        return;
+    }
+
+    UBO stored;
+    std::memcpy(&stored, data, sizeof(UBO));
+
+    if (SceneLoader::s_LoadCameraSettings) {
+        SetCameraPosition(Vec3(stored.u_CameraPosition));
+        SetCameraOrientation(Vec3(stored.u_CameraForward), Vec3(stored.u_CameraUp));
+        uniformBufferData.u_FocusDistance = stored.u_FocusDistance;
+    }
+    uniformBufferData.u_EnableGI = stored.u_EnableGI;
+    Params::s_EnableGI = stored.u_EnableGI != 0;
+    uniformBufferData.u_environmentMapIndex = stored.u_environmentMapIndex;
+}
+
+bool BinaryScene::Load(class Scene& scene, const std::string& filename) {
+    auto start = std::chrono::steady_clock::now();
+
+    MappedFile file(filename);
+    if (!file.IsValid()) {
+        RT_ERROR("Cannot map binary scene {0}", filename);
+        return false;
+    }
+
+    const byte* data = file.GetData();
+    if (file.GetSize() < sizeof(BinarySceneHeader)) {
+        RT_ERROR("{0} is too small to be a binary scene", filename);
+        return false;
+    }
+
+    BinarySceneHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, BINARY_SCENE_MAGIC, sizeof(header.magic)) != 0) {
+        RT_ERROR("{0} is not a binary scene (bad magic)", filename);
+        return false;
+    }
+    if (header.version != BINARY_SCENE_VERSION) {
+        RT_ERROR("{0} has unsupported binary scene version {1} (expected {2})", filename, header.version, BINARY_SCENE_VERSION);
+        return false;
+    }
+
+    const uint64_t tableEnd = sizeof(BinarySceneHeader) + uint64_t(sizeof(BinarySceneSection)) * header.sectionCount;
+    if (tableEnd > file.GetSize()) {
+        RT_ERROR("{0} is truncated (section table)", filename);
+        return false;
+    }
+
+    std::vector<BinarySceneSection> sections(header.sectionCount);
+    std::memcpy(sections.data(), data + sizeof(BinarySceneHeader), sizeof(BinarySceneSection) * sections.size());
+
+    // Validate everything before touching any GPU buffer. SceneLoader::LoadScene already cleared the
+    // previous scene, a rejected file leaves an empty scene instead of half written buffers
+    for (const auto& section : sections) {
+        if (section.offset < tableEnd || section.size > file.GetSize() || section.offset > file.GetSize() - section.size) {
+            RT_ERROR("{0} is truncated (section for binding {1})", filename, section.binding);
+            return false;
+        }
+        if (section.binding == BINARY_SCENE_TEXTURE_BINDING) {
+            if (!LoadTextures(data + section.offset, section.size, true)) {
+                RT_ERROR("{0}: texture section is malformed", filename);
+                return false;
+            }
+            continue;
+        }
+        if (section.binding == TEXTURE_TABLE_BINDING) {
+            continue;
+        }
+        // Buffers grow on demand, so any section size fits
+        if (!FindBuffer(section.binding)) {
+            RT_ERROR("{0} references unknown binding {1}", filename, section.binding);
+            return false;
+        }
+    }
+
+    // SceneLoader::LoadScene destroyed the textures of the previous scene, so texture IDs restart at 0
+    // and match the IDs stored in the shader buffers
+    bool hasKDTree = false;
+    for (const auto& section : sections) {
+        if (section.binding == 0) {
+            ApplyUniformSection(data + section.offset, section.size);
+            continue;
+        }
+        if (section.binding == TEXTURE_TABLE_BINDING) {
+            continue;
+        }
+        if (section.binding == BINARY_SCENE_TEXTURE_BINDING) {
+            if (!LoadTextures(data + section.offset, section.size, false)) {
+                // The scene stays dirty, the next Scene::UpdateGPUBuffers overwrites the partial upload
+                RT_ERROR("{0}: texture section is malformed", filename);
+                return false;
+            }
+            continue;
+        }
+        hasKDTree |= IsKDTreeBinding(section.binding);
+        FindBuffer(section.binding)->UploadData(const_cast<byte*>(data + section.offset), section.size);
+    }
+
+    if (!hasKDTree) {
+        // Same layout UploadKDTreeToGPU writes for an empty tree
+        byte emptyTree[sizeof(Vec4) * 2 + sizeof(uint32_t) * 4] = {};
+        byte emptyIndices[sizeof(uint32_t) * 4] = {};
+        FindBuffer(BINARY_SCENE_KDTREE_BINDING)->UploadData(emptyTree, sizeof(emptyTree));
+        FindBuffer(BINARY_SCENE_KDTREE_INDICES_BINDING)->UploadData(emptyIndices, sizeof(emptyIndices));
+    }
+
+    // GPU buffers are already final, skip the conversion in Scene::UpdateGPUBuffers. The object
+    // types are not known without it, the scene keeps the generic raytracing kernel
+    scene.SetBufferDirty(false);
+    scene.SetFeatures(SceneFeatures());
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    RT_INFO("Loaded binary scene {0}: {1} sections, {2} bytes in {3:.2f} ms", filename, sections.size(), file.GetSize(), elapsed);
+    return true;
+}
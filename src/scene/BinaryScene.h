@@ -0,0 +1,69 @@
+#ifndef BINARY_SCENE_H
+#define BINARY_SCENE_H
+
+#include <string>
+#include <cstdint>
+
+// Binary scene container (.trs)
+// The file stores the exact byte images of the GPU buffers produced by
+// Scene::ConvertSceneToGPUData / UploadKDTreeToGPU (plus texture and BRDF payloads),
+// so loading is a memory map followed by one copy per SSBO.
+// Textures are images rather than buffers and get their own section (BINARY_SCENE_TEXTURE_BINDING)
+// holding a BinarySceneTextureRecord plus texels per TextureID.
+//
+// Layout:
+//   BinarySceneHeader
+//   BinarySceneSection[sectionCount]
+//   section payloads (each aligned to BINARY_SCENE_ALIGNMENT)
+#define BINARY_SCENE_MAGIC "TRS1"
+#define BINARY_SCENE_VERSION 4
+#define BINARY_SCENE_ALIGNMENT 16
+
+// Binding numbers of the acceleration structure buffers (see Scene::CreateGPUBuffers)
+#define BINARY_SCENE_KDTREE_BINDING 1
+#define BINARY_SCENE_KDTREE_INDICES_BINDING 2
+// Texture payloads, stored under the binding of the sampler array
+#define BINARY_SCENE_TEXTURE_BINDING 52
+
+enum BinarySceneFlags : uint32_t {
+    BINARY_SCENE_FLAG_NONE = 0,
+    BINARY_SCENE_FLAG_HAS_KDTREE = 1 << 0,
+};
+
+struct BinarySceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint32_t flags;
+};
+
+struct BinarySceneSection {
+    uint32_t binding;   // descriptor binding of the target buffer
+    uint32_t _pad;
+    uint64_t offset;    // byte offset from the start of the file
+    uint64_t size;      // payload size in bytes
+};
+
+// Texture section layout: uint32 count, uint32 padding[3], then per texture
+// a record followed by its texels (padded to BINARY_SCENE_ALIGNMENT)
+struct BinarySceneTextureRecord {
+    uint32_t width;     // 0 for an empty slot
+    uint32_t height;
+    uint32_t format;    // VkFormat
+    uint32_t usage;     // TextureUsage
+    uint64_t size;      // texel bytes following the record
+    uint64_t _pad2;
+};
+
+class BinaryScene {
+public:
+    // Writes all GPU buffers that currently hold data to filename.
+    static bool Export(const std::string& filename, bool includeKDTree = true);
+    // Maps filename and writes every section straight into its SSBO. Expects the scene and its
+    // textures to be cleared already (SceneLoader::LoadScene), returns false for malformed files.
+    static bool Load(class Scene& scene, const std::string& filename);
+
+    static bool IsBinarySceneFile(const std::string& filename);
+};
+
+#endif
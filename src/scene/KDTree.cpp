@@ -1,7 +1,30 @@
 #include "scene/KDTree.h"
 #include "common/Log.h"
+#include "common/AtomicFile.h"
 #include <algorithm>
 #include <limits>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+
+#define KDTREE_CACHE_MAGIC "KDTC"
+#define KDTREE_CACHE_VERSION 1
+
+// Cache file layout: KDTreeCacheHeader, GPUKDNode[nodeCount], int[indexCount]
+struct KDTreeCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    int32_t maxDepth;
+    int32_t minPrimitives;
+    uint32_t primitiveCount;
+    uint32_t nodeCount;
+    uint32_t indexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t _pad;
+};
 
 void KDTree::BuildTree(const std::vector<std::shared_ptr<Primitive>>& primitives, int maxDepth, int minPrimitives) {
     this->maximumDepth = maxDepth;
@@ -116,3 +139,140 @@ int KDTree::FlattenTree(Node* node) {
 
     return nodeIndex;
 }
+
+// FNV-1a, 64 bit
+static void HashBytes(uint64_t& hash, const void* data, size_t size) {
+    const byte* bytes = static_cast<const byte*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+uint64_t KDTree::ComputeCacheKey(const std::vector<std::shared_ptr<Primitive>>& primitives, int maxDepth, int minPrimitives) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint32_t version = KDTREE_CACHE_VERSION;
+    const uint32_t count = static_cast<uint32_t>(primitives.size());
+    HashBytes(hash, &version, sizeof(version));
+    HashBytes(hash, &maxDepth, sizeof(maxDepth));
+    HashBytes(hash, &minPrimitives, sizeof(minPrimitives));
+    HashBytes(hash, &count, sizeof(count));
+    for (const auto& primitive : primitives) {
+        const uint32_t type = static_cast<uint32_t>(primitive->type);
+        float bounds[6];
+        for (int d = 0; d < 3; ++d) {
+            bounds[d] = primitive->minimumBounds(d);
+            bounds[d + 3] = primitive->maximumBounds(d);
+        }
+        HashBytes(hash, &type, sizeof(type));
+        HashBytes(hash, &primitive->globalIndex, sizeof(primitive->globalIndex));
+        HashBytes(hash, bounds, sizeof(bounds));
+    }
+    return hash;
+}
+
+void KDTree::BuildTreeCached(const std::vector<std::shared_ptr<Primitive>>& primitives, const std::string& cacheDirectory, int maxDepth, int minPrimitives) {
+    auto start = std::chrono::steady_clock::now();
+    const uint64_t key = ComputeCacheKey(primitives, maxDepth, minPrimitives);
+    const uint32_t primitiveCount = static_cast<uint32_t>(primitives.size());
+
+    char keyString[17];
+    snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(key));
+    const std::string filename = (std::filesystem::path(cacheDirectory) / (std::string(keyString) + ".kdtree")).string();
+
+    if (LoadFromCache(filename, key, primitiveCount)) {
+        this->maximumDepth = maxDepth;
+        this->minimumNumberOfPrimitives = minPrimitives;
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        RT_INFO("KD-tree loaded from cache {0}: {1} nodes, {2} primitive references in {3:.2f} ms", filename, m_Nodes.size(), m_PrimitiveIndices.size(), elapsed);
+        return;
+    }
+
+    BuildTree(primitives, maxDepth, minPrimitives);
+    SaveToCache(filename, key, primitiveCount);
+}
+
+bool KDTree::LoadFromCache(const std::string& filename, uint64_t key, uint32_t primitiveCount) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    KDTreeCacheHeader header;
+    if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        RT_WARN("KD-tree cache {0} is truncated, rebuilding", filename);
+        return false;
+    }
+    if (std::memcmp(header.magic, KDTREE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != KDTREE_CACHE_VERSION) {
+        RT_WARN("KD-tree cache {0} has an unknown format, rebuilding", filename);
+        return false;
+    }
+    if (header.key != key || header.primitiveCount != primitiveCount) {
+        RT_WARN("KD-tree cache {0} does not match the scene, rebuilding", filename);
+        return false;
+    }
+    if (fileSize != sizeof(header) + uint64_t(header.nodeCount) * sizeof(GPUKDNode) + uint64_t(header.indexCount) * sizeof(int)) {
+        RT_WARN("KD-tree cache {0} has an unexpected size, rebuilding", filename);
+        return false;
+    }
+
+    std::vector<GPUKDNode> nodes(header.nodeCount);
+    std::vector<int> indices(header.indexCount);
+    file.read(reinterpret_cast<char*>(nodes.data()), sizeof(GPUKDNode) * nodes.size());
+    file.read(reinterpret_cast<char*>(indices.data()), sizeof(int) * indices.size());
+    if (!file) {
+        RT_WARN("KD-tree cache {0} could not be read, rebuilding", filename);
+        return false;
+    }
+
+    // Never hand the GPU a tree that could index out of bounds or loop forever. FlattenTree places
+    // the children after their parent, so child indices only ever grow along a path
+    const int nodeCount = static_cast<int>(nodes.size());
+    const int indexCount = static_cast<int>(indices.size());
+    for (int i = 0; i < nodeCount; i++) {
+        const GPUKDNode& node = nodes[i];
+        bool valid = (node.childLeft == -1)
+            ? (node.childRight == -1 && node.primStart >= 0 && node.primCount >= 0 && node.primStart <= indexCount - node.primCount)
+            : (node.childLeft > i && node.childLeft < nodeCount && node.childRight > i && node.childRight < nodeCount && node.dimension >= 0 && node.dimension < 3);
+        if (!valid) {
+            RT_WARN("KD-tree cache {0} contains invalid nodes, rebuilding", filename);
+            return false;
+        }
+    }
+    for (int index : indices) {
+        if (index < 0 || index >= static_cast<int>(primitiveCount)) {
+            RT_WARN("KD-tree cache {0} contains invalid primitive indices, rebuilding", filename);
+            return false;
+        }
+    }
+
+    m_Nodes = std::move(nodes);
+    m_PrimitiveIndices = std::move(indices);
+    absoluteMinimum = Vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    absoluteMaximum = Vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    return true;
+}
+
+bool KDTree::SaveToCache(const std::string& filename, uint64_t key, uint32_t primitiveCount) const {
+    KDTreeCacheHeader header = {};
+    std::memcpy(header.magic, KDTREE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = KDTREE_CACHE_VERSION;
+    header.key = key;
+    header.maxDepth = maximumDepth;
+    header.minPrimitives = minimumNumberOfPrimitives;
+    header.primitiveCount = primitiveCount;
+    header.nodeCount = static_cast<uint32_t>(m_Nodes.size());
+    header.indexCount = static_cast<uint32_t>(m_PrimitiveIndices.size());
+    for (int d = 0; d < 3; ++d) {
+        header.boundsMin[d] = absoluteMinimum[d];
+        header.boundsMax[d] = absoluteMaximum[d];
+    }
+
+    return WriteFileAtomically(filename, [&](std::ostream& file) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(m_Nodes.data()), sizeof(GPUKDNode) * m_Nodes.size());
+        file.write(reinterpret_cast<const char*>(m_PrimitiveIndices.data()), sizeof(int) * m_PrimitiveIndices.size());
+    });
+}
@@ -5,6 +5,7 @@
 #include "primitives/Primitive.h"
 #include <vector>
 #include <memory>
+#include <string>
 
 // GPU-friendly node structure
 // If childLeft == -1, this is a leaf node and primStart/primCount are valid
@@ -27,6 +28,15 @@ public:
     // Build the tree from primitives
     void BuildTree(const std::vector<std::shared_ptr<Primitive>>& primitives, int maxDepth = 20, int minPrimitives = 2);
 
+    // Like BuildTree, but reuses the flattened tree from cacheDirectory if one was stored for
+    // identical primitive bounds and build parameters (and stores it there otherwise)
+    void BuildTreeCached(const std::vector<std::shared_ptr<Primitive>>& primitives, const std::string& cacheDirectory, int maxDepth = 20, int minPrimitives = 2);
+
+    // Hash of everything the flattened tree depends on: primitive order, types, bounds and build parameters
+    static uint64_t ComputeCacheKey(const std::vector<std::shared_ptr<Primitive>>& primitives, int maxDepth, int minPrimitives);
+    bool LoadFromCache(const std::string& filename, uint64_t key, uint32_t primitiveCount);
+    bool SaveToCache(const std::string& filename, uint64_t key, uint32_t primitiveCount) const;
+
     // Get flattened data for GPU upload
     const std::vector<GPUKDNode>& GetNodes() const { return m_Nodes; }
     const std::vector<int>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
@@ -2,6 +2,7 @@
 #include "common/Log.h"
 #include "common/Window.h"
 #include "common/Params.h"
+#include "vulkan/Renderer.h"
 #include "primitives/Mesh.h"
 #include "primitives/Triangle.h"
 #include <algorithm>
@@ -11,7 +12,7 @@
 UBO uniformBufferData;
 
 void Scene::CreateGPUBuffers() {
-    uniformBuffer = UniformBuffer::Create(0, sizeof(uniformBufferData));
+    uniformBuffer = UniformBuffer::Create(0, sizeof(uniformBufferData), Renderer::GetFrameCopies());
     kdTreeSSBO = SSBO::Create(1);
     kdTreeIndicesSSBO = SSBO::Create(2);
     meshTrianglesSSBO = SSBO::Create(3);
@@ -93,6 +94,8 @@ void Scene::ConvertSceneToGPUData() {
 
     GPUPrimitive* primDst = reinterpret_cast<GPUPrimitive*>(
         reinterpret_cast<byte*>(primitiveDataGPU) + 4);
+    // Mesh triangles are intersected by the mesh and shaded with its shader, they add no types
+    m_Features = SceneFeatures{ 0, 0, 0 };
 
     for (size_t i = 0; i < m_Primitives.size(); ++i) {
         RT_ASSERT(m_Primitives[i]->type != PrimitiveType::None, "Primitive type is None");
@@ -101,6 +104,8 @@ void Scene::ConvertSceneToGPUData() {
         primDst[i].primitiveIndex = m_Primitives[i]->index;
         primDst[i].shaderType = static_cast<uint32_t>(m_Primitives[i]->shader->type);
         primDst[i].shaderIndex = m_Primitives[i]->shader->index;
+        m_Features.primitiveTypes |= 1u << primDst[i].primitiveType;
+        m_Features.shaderTypes |= 1u << primDst[i].shaderType;
     }
 
     primitiveSSBO->UnmapData();
@@ -123,6 +128,7 @@ void Scene::ConvertSceneToGPUData() {
         RT_ASSERT(m_Lights[i]->type != LightType::None, "Light type is None");
         lightDst[i].lightType = static_cast<uint32_t>(m_Lights[i]->type);
         lightDst[i].lightIndex = m_Lights[i]->index;
+        m_Features.lightTypes |= 1u << lightDst[i].lightType;
     }
 
     lightSSBO->UnmapData();
@@ -215,8 +221,8 @@ void Scene::UpdateGPUBuffers() {
     uniformBufferData.u_resolution = glm::vec2(Params::GetWidth(), Params::GetHeight());
     uniformBufferData.u_aspectRatio = uniformBufferData.u_resolution.y / uniformBufferData.u_resolution.x;
     uniformBufferData.u_Seed = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-    uniformBuffer->UploadData(&uniformBufferData, sizeof(uniformBufferData));
-    uniformBufferData.u_SampleIndex++;
+    // u_SampleIndex advances once the renderer finished a pass over all tiles
+    uniformBuffer->UploadFrame(&uniformBufferData, sizeof(uniformBufferData));
 
     if (IsBufferDirty()) {
         UploadMeshTrianglesToGPU();
@@ -225,10 +231,15 @@ void Scene::UpdateGPUBuffers() {
         UploadKDTreeToGPU();
         SetBufferDirty(false);
     }
+    ComputePipeline::SetSceneFeatures(m_Features);
 }
 
 void Scene::BuildKDTree() {
-    m_KDTree.BuildTree(m_Primitives);
+    if (Params::s_KDTreeCache) {
+        m_KDTree.BuildTreeCached(m_Primitives, Params::KDTREE_CACHE_DIRECTORY);
+    } else {
+        m_KDTree.BuildTree(m_Primitives);
+    }
 }
 
 void Scene::ClearScene() {
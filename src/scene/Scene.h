@@ -7,6 +7,7 @@
 #include "lights/Light.h"
 #include "vulkan/Buffer.h"
 #include "vulkan/Texture.h"
+#include "vulkan/ComputePipeline.h"
 #include "scene/KDTree.h"
 #include <cstring>
 
@@ -76,6 +77,9 @@ public:
     void UpdateGPUBuffers();
     bool IsBufferDirty() const { return m_IsBufferDirty; }
     void SetBufferDirty(bool dirty) { m_IsBufferDirty = dirty; }
+    // Object types the primitives and lights use, written by ConvertSceneToGPUData
+    const SceneFeatures& GetFeatures() const { return m_Features; }
+    void SetFeatures(const SceneFeatures& features) { m_Features = features; }
 
     void AddPrimitive(const std::shared_ptr<Primitive>& primitive) {
         m_Primitives.push_back(primitive);
@@ -132,6 +136,7 @@ private:
     std::vector<std::shared_ptr<Light>> m_Lights;
 
     KDTree m_KDTree;
+    SceneFeatures m_Features;
 
     bool m_IsBufferDirty = true;
 };
@@ -1,11 +1,14 @@
 #include "SceneLoader.h"
 #include "Scene.h"
+#include "BinaryScene.h"
 #include "common/Log.h"
 #include "common/Params.h"
 #include "scene/Camera.h"
 
 #include "vulkan/Texture.h"
+#include "vulkan/GpuAllocator.h"
 #include "vulkan/Brdf.h"
+#include "vulkan/EnvironmentMap.h"
 #include "vulkan/OffscreenResources.h"
 #include "primitives/Sphere.h"
 #include "primitives/Triangle.h"
@@ -74,7 +77,7 @@ bool LoadSettings(class Scene& scene, const json& settings) {
         uniformBufferData.u_EnableGI = gi ? 1 : 0; // Sync with ImGui
     }
     if (settings.contains("env_map")) {
-        uniformBufferData.u_environmentMapIndex = (new Texture(settings["env_map"]))->GetId();
+        uniformBufferData.u_environmentMapIndex = (new Texture(settings["env_map"], TextureUsage::Environment))->GetId();
     }
 
     return true;
@@ -148,7 +151,7 @@ bool LoadShader(class Scene& scene, const json& shader) {
 
         // Alpha map and opacity
         if (shader.contains("alphaMap")) {
-            matShader->setAlphaMap((new Texture(shader["alphaMap"]))->GetId());
+            matShader->setAlphaMap((new Texture(shader["alphaMap"], TextureUsage::Mask))->GetId());
         }
         if (shader.contains("opacity")) {
             matShader->setOpacity(GetJsonFloat(shader["opacity"]));
@@ -156,7 +159,7 @@ bool LoadShader(class Scene& scene, const json& shader) {
 
         // Normal map and coefficient
         if (shader.contains("normalMap")) {
-            matShader->setNormalMap((new Texture(shader["normalMap"]))->GetId());
+            matShader->setNormalMap((new Texture(shader["normalMap"], TextureUsage::Normal))->GetId());
         }
         if (shader.contains("normalCoefficient")) {
             matShader->setNormalCoefficient(GetJsonFloat(shader["normalCoefficient"]));
@@ -164,7 +167,7 @@ bool LoadShader(class Scene& scene, const json& shader) {
 
         // Diffuse map and coefficient
         if (shader.contains("diffuseMap")) {
-            matShader->setDiffuseMap((new Texture(shader["diffuseMap"]))->GetId());
+            matShader->setDiffuseMap((new Texture(shader["diffuseMap"], TextureUsage::Color))->GetId());
         }
         if (shader.contains("diffuseCoefficient")) {
             matShader->setDiffuseCoefficient(GetJsonFloat(shader["diffuseCoefficient"]));
@@ -172,7 +175,7 @@ bool LoadShader(class Scene& scene, const json& shader) {
 
         // Specular map, coefficient, and exponent
         if (shader.contains("specularMap")) {
-            matShader->setSpecularMap((new Texture(shader["specularMap"]))->GetId());
+            matShader->setSpecularMap((new Texture(shader["specularMap"], TextureUsage::Color))->GetId());
         }
         if (shader.contains("specularCoefficient")) {
             matShader->setSpecularCoefficient(GetJsonFloat(shader["specularCoefficient"]));
@@ -183,7 +186,7 @@ bool LoadShader(class Scene& scene, const json& shader) {
 
         // Reflection map and reflectance
         if (shader.contains("reflectionMap")) {
-            matShader->setReflectionMap((new Texture(shader["reflectionMap"]))->GetId());
+            matShader->setReflectionMap((new Texture(shader["reflectionMap"], TextureUsage::Mask))->GetId());
         }
         if (shader.contains("reflectance")) {
             matShader->setReflectance(GetJsonFloat(shader["reflectance"]));
@@ -357,40 +360,54 @@ bool SceneLoader::LoadScene(class Scene& scene, const std::string& filename) {
     scene.ClearScene();
     OffscreenResources::Clear();
     s_Shaders.clear();
+    // The textures and BRDFs belong to the scene, a reload must not keep the old ones alive
+    Texture::DestroyAllTextures();
+    Brdf::DestroyAllBrdfs();
+    uniformBufferData.u_environmentMapIndex = NULL_TEXTURE;
+
+    // Upload all textures of the scene in one submit
+    Texture::BeginUploadBatch();
+    bool loaded = true;
+    if (BinaryScene::IsBinarySceneFile(filename)) {
+        loaded = BinaryScene::Load(scene, filename);
+    } else {
+        std::ifstream f(filename);
+        json data = json::parse(f);
 
-    std::ifstream f(filename);
-    json data = json::parse(f);
-
-    try {
-        if (data.contains("settings")) {
-            LOAD_ASSERT(data["settings"].is_object(), "'settings' must be an object");
-            LOAD_ASSERT(LoadSettings(scene, data["settings"]), "Failed to load settings");
-        }
+        try {
+            if (data.contains("settings")) {
+                LOAD_ASSERT(data["settings"].is_object(), "'settings' must be an object");
+                LOAD_ASSERT(LoadSettings(scene, data["settings"]), "Failed to load settings");
+            }
 
-        if (data.contains("shaders")) {
-            LOAD_ASSERT(data["shaders"].is_array(), "'shaders' must be an array");
-            for (const auto& shader : data["shaders"]) {
-                LOAD_ASSERT(LoadShader(scene, shader), "Failed to load a shader");
+            if (data.contains("shaders")) {
+                LOAD_ASSERT(data["shaders"].is_array(), "'shaders' must be an array");
+                for (const auto& shader : data["shaders"]) {
+                    LOAD_ASSERT(LoadShader(scene, shader), "Failed to load a shader");
+                }
             }
-        }
 
-        if (data.contains("lights")) {
-            LOAD_ASSERT(data["lights"].is_array(), "'lights' must be an array");
-            for (const auto& light : data["lights"]) {
-                LOAD_ASSERT(LoadLight(scene, light), "Failed to load a light");
+            if (data.contains("lights")) {
+                LOAD_ASSERT(data["lights"].is_array(), "'lights' must be an array");
+                for (const auto& light : data["lights"]) {
+                    LOAD_ASSERT(LoadLight(scene, light), "Failed to load a light");
+                }
             }
-        }
 
-        if (data.contains("primitives")) {
-            LOAD_ASSERT(data["primitives"].is_array(), "'primitives' must be an array");
-            for (const auto& primitiveData : data["primitives"]) {
-                LOAD_ASSERT(LoadPrimitive(scene, primitiveData), "Failed to load a primitive");
+            if (data.contains("primitives")) {
+                LOAD_ASSERT(data["primitives"].is_array(), "'primitives' must be an array");
+                for (const auto& primitiveData : data["primitives"]) {
+                    LOAD_ASSERT(LoadPrimitive(scene, primitiveData), "Failed to load a primitive");
+                }
             }
+        } catch (std::runtime_error exception) {
+            RT_ERROR("Error during scene loading from JSON: {}", exception.what());
         }
-    } catch (std::runtime_error exception) {
-        RT_ERROR("Error during scene loading from JSON: {}", exception.what());
     }
-    
-    
-    return true;
+    Texture::EndUploadBatch();
+    EnvironmentMap::Build(uniformBufferData.u_environmentMapIndex);
+
+    Texture::LogMemoryUsage();
+    GpuAllocator::LogUsage();
+    return loaded;
 }
\ No newline at end of file
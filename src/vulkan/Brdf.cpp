@@ -2,8 +2,13 @@
 #include "Buffer.h"
 #include "VulkanContext.h"
 #include "common/Log.h"
+#include "common/ThreadPool.h"
 #include <stdexcept>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
 
 #define BRDF_SAMPLING_RES_THETA_H 90
 #define BRDF_SAMPLING_RES_THETA_D 90
@@ -11,13 +16,124 @@
 
 #define BRDF_TOTAL_SAMPLES (BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_D * BRDF_SAMPLING_RES_PHI_D / 2)
 #define BRDF_DATA_SIZE (BRDF_TOTAL_SAMPLES * 3)
-#define SSBO_BRDF_DATA_SIZE (256 * 1024 * 1024)  // 256 MB - enough for ~14 BRDFs
+// Samples are stored as half floats, two per uint
+#define BRDF_PACKED_SIZE (BRDF_DATA_SIZE / 2)
+#define BRDF_SLOT_BYTES (BRDF_PACKED_SIZE * sizeof(uint32_t))
+
+// MERL channel scales, applied before the conversion so large values stay inside the half range
+#define BRDF_RED_SCALE (1.0 / 1500.0)
+#define BRDF_GREEN_SCALE (1.15 / 1500.0)
+#define BRDF_BLUE_SCALE (1.66 / 1500.0)
+#define BRDF_HALF_MAX 65504.0f
+#define BRDF_HALF_MIN_NORMAL 6.103515625e-5f   // 2^-14
+
+// Sampling table, must match ShaderCode/include/Brdf.glsl. For each cos(theta_in) bin a marginal CDF
+// over cos(theta_out) followed by one CDF over phi_out in [0, pi] per cos(theta_out) bin
+#define BRDF_SAMPLING_THETA_IN 32
+#define BRDF_SAMPLING_THETA_OUT 32
+#define BRDF_SAMPLING_PHI_OUT 32
+#define BRDF_SAMPLING_SLICE_SIZE ((BRDF_SAMPLING_THETA_OUT + 1) + BRDF_SAMPLING_THETA_OUT * (BRDF_SAMPLING_PHI_OUT + 1))
+#define BRDF_SAMPLING_TABLE_SIZE (BRDF_SAMPLING_THETA_IN * BRDF_SAMPLING_SLICE_SIZE)
+#define BRDF_SAMPLING_SLOT_BYTES (BRDF_SAMPLING_TABLE_SIZE * sizeof(float))
+// Sub-samples per table bin along cos(theta_out) and phi_out
+#define BRDF_SAMPLING_SUBSAMPLES 4
+// Share of the average bin weight added to every bin, keeps the pdf positive wherever the BRDF might be
+#define BRDF_SAMPLING_FLOOR 0.02
 
 static std::vector<Brdf*> s_AllBrdfs;
-static std::shared_ptr<SSBO> s_BrdfDataSSBO;  // Binding 4: BRDF sample data
+static std::shared_ptr<SSBO> s_BrdfDataSSBO;      // Binding 53: BRDF sample data, grows on demand
+static std::shared_ptr<SSBO> s_BrdfSamplingSSBO;  // Binding 55: importance sampling tables
 
 void Brdf::CreateGPUBuffers() {
-    s_BrdfDataSSBO = SSBO::Create(53, SSBO_BRDF_DATA_SIZE);
+    s_BrdfDataSSBO = SSBO::Create(BRDF_DATA_BINDING, BRDF_SLOT_BYTES);
+    s_BrdfSamplingSSBO = SSBO::Create(BRDF_SAMPLING_BINDING, BRDF_SAMPLING_SLOT_BYTES);
+}
+
+// Same indexing as lookupBrdf in Brdf.glsl, wi and wo are in the local frame around the normal (0, 0, 1)
+static size_t GetSampleIndex(const Vec3& wi, const Vec3& wo) {
+    const Vec3 normal(0.0f, 0.0f, 1.0f);
+    const Vec3 half = glm::normalize(wi + wo);
+    const float cosThetaHalf = std::clamp(glm::dot(normal, half), -1.0f, 1.0f);
+    const float thetaHalf = std::acos(cosThetaHalf);
+    const float thetaDiff = std::acos(std::clamp(glm::dot(wi, half), -1.0f, 1.0f));
+
+    // Basis of the half vector frame, x points away from the normal in the plane of normal and half vector
+    Vec3 x = half * cosThetaHalf - normal;
+    x = (glm::length(x) > 1e-6f) ? glm::normalize(x) : Vec3(1.0f, 0.0f, 0.0f);
+    const Vec3 y = glm::cross(half, x);
+    float phiDiff = std::atan2(glm::dot(wi, y), glm::dot(wi, x));
+
+    int thetaHalfIndex = 0;
+    if (thetaHalf > 0.0f) {
+        thetaHalfIndex = std::clamp(int(std::sqrt(thetaHalf / (PI / 2.0f) * BRDF_SAMPLING_RES_THETA_H * BRDF_SAMPLING_RES_THETA_H)), 0, BRDF_SAMPLING_RES_THETA_H - 1);
+    }
+    const int thetaDiffIndex = std::clamp(int(thetaDiff / (PI * 0.5f) * BRDF_SAMPLING_RES_THETA_D), 0, BRDF_SAMPLING_RES_THETA_D - 1);
+    if (phiDiff < 0.0f) {
+        phiDiff += PI;
+    }
+    const int phiDiffIndex = std::clamp(int(phiDiff / PI * BRDF_SAMPLING_RES_PHI_D / 2), 0, BRDF_SAMPLING_RES_PHI_D / 2 - 1);
+    return phiDiffIndex + thetaDiffIndex * BRDF_SAMPLING_RES_PHI_D / 2 + thetaHalfIndex * BRDF_SAMPLING_RES_PHI_D / 2 * BRDF_SAMPLING_RES_THETA_D;
+}
+
+// Tabulates luminance * cos(theta_out) per bin and turns every slice into CDFs
+static std::vector<float> BuildSamplingTable(const std::vector<float>& samples) {
+    std::vector<float> table(BRDF_SAMPLING_TABLE_SIZE);
+    ThreadPool::Get().ParallelFor(BRDF_SAMPLING_THETA_IN, [&](uint32_t thetaIn) {
+        const float cosThetaIn = (thetaIn + 0.5f) / BRDF_SAMPLING_THETA_IN;
+        const Vec3 wi(std::sqrt(1.0f - cosThetaIn * cosThetaIn), 0.0f, cosThetaIn);
+
+        std::vector<double> weights(BRDF_SAMPLING_THETA_OUT * BRDF_SAMPLING_PHI_OUT, 0.0);
+        double total = 0.0;
+        for (uint32_t thetaOut = 0; thetaOut < BRDF_SAMPLING_THETA_OUT; thetaOut++) {
+            for (uint32_t phiOut = 0; phiOut < BRDF_SAMPLING_PHI_OUT; phiOut++) {
+                double weight = 0.0;
+                for (uint32_t s = 0; s < BRDF_SAMPLING_SUBSAMPLES * BRDF_SAMPLING_SUBSAMPLES; s++) {
+                    const float cosThetaOut = (thetaOut + (s / BRDF_SAMPLING_SUBSAMPLES + 0.5f) / BRDF_SAMPLING_SUBSAMPLES) / BRDF_SAMPLING_THETA_OUT;
+                    const float phi = PI * (phiOut + (s % BRDF_SAMPLING_SUBSAMPLES + 0.5f) / BRDF_SAMPLING_SUBSAMPLES) / BRDF_SAMPLING_PHI_OUT;
+                    const float sinThetaOut = std::sqrt(1.0f - cosThetaOut * cosThetaOut);
+                    const size_t index = GetSampleIndex(wi, Vec3(sinThetaOut * std::cos(phi), sinThetaOut * std::sin(phi), cosThetaOut));
+                    const double luminance = 0.2126 * samples[index] + 0.7152 * samples[index + BRDF_TOTAL_SAMPLES] + 0.0722 * samples[index + 2 * BRDF_TOTAL_SAMPLES];
+                    weight += luminance * cosThetaOut;
+                }
+                weights[thetaOut * BRDF_SAMPLING_PHI_OUT + phiOut] = weight;
+                total += weight;
+            }
+        }
+
+        const double floor = (total > 0.0) ? BRDF_SAMPLING_FLOOR * total / weights.size() : 1.0;
+        float* slice = table.data() + size_t(thetaIn) * BRDF_SAMPLING_SLICE_SIZE;
+        std::vector<double> rowSums(BRDF_SAMPLING_THETA_OUT, 0.0);
+        double sliceSum = 0.0;
+        for (uint32_t thetaOut = 0; thetaOut < BRDF_SAMPLING_THETA_OUT; thetaOut++) {
+            float* conditional = slice + (BRDF_SAMPLING_THETA_OUT + 1) + thetaOut * (BRDF_SAMPLING_PHI_OUT + 1);
+            double accumulated = 0.0;
+            for (uint32_t phiOut = 0; phiOut < BRDF_SAMPLING_PHI_OUT; phiOut++) {
+                conditional[phiOut] = static_cast<float>(accumulated);
+                accumulated += weights[thetaOut * BRDF_SAMPLING_PHI_OUT + phiOut] + floor;
+            }
+            for (uint32_t phiOut = 0; phiOut < BRDF_SAMPLING_PHI_OUT; phiOut++) {
+                conditional[phiOut] = static_cast<float>(conditional[phiOut] / accumulated);
+            }
+            conditional[BRDF_SAMPLING_PHI_OUT] = 1.0f;
+            rowSums[thetaOut] = accumulated;
+            sliceSum += accumulated;
+        }
+        double accumulated = 0.0;
+        for (uint32_t thetaOut = 0; thetaOut < BRDF_SAMPLING_THETA_OUT; thetaOut++) {
+            slice[thetaOut] = static_cast<float>(accumulated / sliceSum);
+            accumulated += rowSums[thetaOut];
+        }
+        slice[BRDF_SAMPLING_THETA_OUT] = 1.0f;
+    });
+    return table;
+}
+
+void Brdf::DestroyAllBrdfs() {
+    std::vector<Brdf*> brdfs = s_AllBrdfs;
+    for (Brdf* brdf : brdfs) {
+        delete brdf;
+    }
+    s_AllBrdfs.clear();
 }
 
 uint32_t Brdf::GetDataOffset(BrdfID brdfId) {
@@ -25,12 +141,18 @@ uint32_t Brdf::GetDataOffset(BrdfID brdfId) {
         return 0;
     }
     // All BRDFs have the same size, so offset = id * size
-    return static_cast<uint32_t>(brdfId) * BRDF_DATA_SIZE;
+    return static_cast<uint32_t>(brdfId) * BRDF_PACKED_SIZE;
 }
 
 Brdf::Brdf(const std::string& filepath) {
-    id = s_AllBrdfs.size();
-    s_AllBrdfs.push_back(this);
+    // Reuse the first freed slot
+    auto freeSlot = std::find(s_AllBrdfs.begin(), s_AllBrdfs.end(), nullptr);
+    id = static_cast<BrdfID>(freeSlot - s_AllBrdfs.begin());
+    if (freeSlot == s_AllBrdfs.end()) {
+        s_AllBrdfs.push_back(this);
+    } else {
+        *freeSlot = this;
+    }
 
     FILE* f = fopen(filepath.c_str(), "rb");
     if (!f) {
@@ -60,47 +182,57 @@ Brdf::Brdf(const std::string& filepath) {
         throw std::runtime_error("Failed to read BRDF data: " + filepath);
     }
 
-    // Convert double to float
-    data.resize(3 * n);
-    for (size_t i = 0; i < tempData.size(); ++i) {
-        data[i] = static_cast<float>(tempData[i]);
+    // Scale every channel and convert to half floats. Negative samples mark directions
+    // below the horizon in MERL files and are clamped to 0
+    const double channelScales[3] = { BRDF_RED_SCALE, BRDF_GREEN_SCALE, BRDF_BLUE_SCALE };
+    std::vector<float> samples(tempData.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = std::min(static_cast<float>(std::max(tempData[i], 0.0) * channelScales[i / BRDF_TOTAL_SAMPLES]), BRDF_HALF_MAX);
+    }
+
+    // Normal halves keep the relative error below 2^-11. Samples the channel scale pushes below
+    // BRDF_HALF_MIN_NORMAL become subnormal, their error is only bounded absolutely (2^-25)
+    data.resize(BRDF_PACKED_SIZE);
+    float maxRelativeError = 0.0f;
+    float maxSubnormalError = 0.0f;
+    size_t subnormalCount = 0;
+    for (size_t i = 0; i < data.size(); ++i) {
+        uint16_t halves[2];
+        for (size_t j = 0; j < 2; ++j) {
+            const float value = samples[2 * i + j];
+            halves[j] = glm::packHalf1x16(value);
+            const float error = std::abs(glm::unpackHalf1x16(halves[j]) - value);
+            if (value >= BRDF_HALF_MIN_NORMAL) {
+                maxRelativeError = std::max(maxRelativeError, error / value);
+            } else if (value > 0.0f) {
+                maxSubnormalError = std::max(maxSubnormalError, error);
+                subnormalCount++;
+            }
+        }
+        data[i] = uint32_t(halves[0]) | (uint32_t(halves[1]) << 16);
     }
+    samplingTable = BuildSamplingTable(samples);
 
-    RT_INFO("Loaded BRDF. ID: {} Samples: {} Data Total: {} bytes", id, BRDF_TOTAL_SAMPLES, sizeof(float) * data.size());
-    Brdf::UploadToGPU();
+    RT_INFO("Loaded BRDF. ID: {} Samples: {} Data Total: {} bytes (max relative error {:.2e}, {} subnormal values with max absolute error {:.2e})",
+        id, BRDF_TOTAL_SAMPLES, sizeof(uint32_t) * data.size(), maxRelativeError, subnormalCount, maxSubnormalError);
+    UploadToGPU();
 }
 
 Brdf::~Brdf() {
     s_AllBrdfs[GetId()] = nullptr;
-    data.clear();
-    Brdf::UploadToGPU();
-}
-
-void Brdf::UploadToGPU() {
-    if (VulkanContext::GetDevice() == VK_NULL_HANDLE) {
-        return;
+    while (!s_AllBrdfs.empty() && s_AllBrdfs.back() == nullptr) {
+        s_AllBrdfs.pop_back();
     }
+}
 
-    if (s_AllBrdfs.empty()) {
+void Brdf::UploadToGPU() const {
+    if (VulkanContext::GetDevice() == VK_NULL_HANDLE || !s_BrdfDataSSBO) {
         return;
     }
 
-    // All BRDFs have the same size - allocate for all of them
-    size_t totalDataFloats = s_AllBrdfs.size() * BRDF_DATA_SIZE;
-
-    RT_INFO("Uploading {} BRDFs, total {} floats", s_AllBrdfs.size(), totalDataFloats);
+    const size_t offset = static_cast<size_t>(id) * BRDF_SLOT_BYTES;
+    s_BrdfDataSSBO->UploadRegion(data.data(), offset, BRDF_SLOT_BYTES);
 
-    void* dataGPU = s_BrdfDataSSBO->MapData(sizeof(float) * totalDataFloats);
-    byte* dst = static_cast<byte*>(dataGPU);
-
-    // Upload each BRDF at its ID * BRDF_DATA_SIZE offset
-    for (size_t i = 0; i < s_AllBrdfs.size(); i++) {
-        const Brdf* brdf = s_AllBrdfs[i];
-        if (brdf && brdf->GetDataSize() == BRDF_DATA_SIZE) {
-            std::memcpy(dst, brdf->GetData(), BRDF_DATA_SIZE * sizeof(float));
-        }
-        // Always advance by BRDF_DATA_SIZE to maintain consistent offsets
-        dst += BRDF_DATA_SIZE * sizeof(float);
-    }
-    s_BrdfDataSSBO->UnmapData();
+    const size_t samplingOffset = static_cast<size_t>(id) * BRDF_SAMPLING_SLOT_BYTES;
+    s_BrdfSamplingSSBO->UploadRegion(samplingTable.data(), samplingOffset, BRDF_SAMPLING_SLOT_BYTES);
 }
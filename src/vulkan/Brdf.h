@@ -9,24 +9,31 @@ using BrdfID = int32_t;
 
 static constexpr BrdfID NULL_BRDF = -1;
 
+#define BRDF_DATA_BINDING 53
+#define BRDF_SAMPLING_BINDING 55
+
 class Brdf {
 public:
     Brdf(const std::string& filepath);
     ~Brdf();
 
     BrdfID GetId() const { return id; }
-    const float* GetData() const { return data.data(); }
+    // Channel scaled samples as pairs of half floats (see ShaderCode/include/Brdf.glsl)
+    const uint32_t* GetData() const { return data.data(); }
     size_t GetDataSize() const { return data.size(); }
 
-    // Get the data offset for a BRDF ID (resolves ID to GPU buffer offset)
+    // Get the data offset for a BRDF ID (resolves ID to GPU buffer offset, in uints)
     static uint32_t GetDataOffset(BrdfID brdfId);
 
     static void CreateGPUBuffers();
+    static void DestroyAllBrdfs();
 
 private:
-    static void UploadToGPU();
+    // Writes the slot of this BRDF, the other slots are left untouched
+    void UploadToGPU() const;
 
-    std::vector<float> data;
+    std::vector<uint32_t> data;
+    std::vector<float> samplingTable;   // CDFs over outgoing directions per incoming angle
     BrdfID id;
 };
 
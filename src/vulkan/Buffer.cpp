@@ -1,26 +1,120 @@
 #include "Buffer.h"
+#include "StagingRing.h"
+#include "Renderer.h"
 #include "VulkanContext.h"
 #include "common/Log.h"
 #include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstring>
 
 void Buffer::UploadData(void* InDataPointer, size_t InSize) {
     if (InSize == 0 || InDataPointer == nullptr)
         return;
-    
-    void* data;
-    vkMapMemory(VulkanContext::GetDevice(), m_DeviceMemory, 0, InSize, 0, &data);
-    std::memcpy(data, InDataPointer, InSize);
-    vkUnmapMemory(VulkanContext::GetDevice(), m_DeviceMemory);
+    EnsureCapacity(InSize, false);
+
+    if (m_DeviceLocal) {
+        StagingRing::Upload(m_Buffer, 0, InDataPointer, InSize);
+    } else {
+        std::memcpy(m_Allocation.mapped, InDataPointer, InSize);
+    }
+    m_UsedSize = InSize;
+}
+
+void Buffer::UploadRegion(const void* InDataPointer, size_t InOffset, size_t InSize) {
+    if (InSize == 0 || InDataPointer == nullptr)
+        return;
+    EnsureCapacity(InOffset + InSize, true);
+
+    if (m_DeviceLocal) {
+        StagingRing::Upload(m_Buffer, InOffset, InDataPointer, InSize);
+    } else {
+        std::memcpy(static_cast<byte*>(m_Allocation.mapped) + InOffset, InDataPointer, InSize);
+    }
+    m_UsedSize = std::max(m_UsedSize, InOffset + InSize);
 }
 
 void* Buffer::MapData(size_t InSize) {
-    void* data;
-    vkMapMemory(VulkanContext::GetDevice(), m_DeviceMemory, 0, InSize, 0, &data);
-    return data;
+    EnsureCapacity(InSize, false);
+    m_UsedSize = InSize;
+    if (m_DeviceLocal) {
+        // Written on the CPU and staged on UnmapData
+        m_MappedShadow.resize(InSize);
+        return m_MappedShadow.data();
+    }
+    return m_Allocation.mapped;
 }
 
 void Buffer::UnmapData() {
-    vkUnmapMemory(VulkanContext::GetDevice(), m_DeviceMemory);
+    if (m_DeviceLocal) {
+        StagingRing::Upload(m_Buffer, 0, m_MappedShadow.data(), m_MappedShadow.size());
+        m_MappedShadow.clear();
+        m_MappedShadow.shrink_to_fit();
+    }
+    // Host visible buffers stay mapped
+}
+
+void Buffer::ReadData(void* OutDataPointer, size_t InSize) {
+    if (InSize == 0 || OutDataPointer == nullptr)
+        return;
+
+    if (!m_DeviceLocal) {
+        std::memcpy(OutDataPointer, static_cast<const byte*>(m_Allocation.mapped) + GetDynamicOffset(), InSize);
+        return;
+    }
+
+    // Read back through a temporary host visible buffer, queued behind all staged uploads
+    StagingRing::Flush();
+    VkBuffer readback;
+    VkDeviceMemory readbackMemory;
+    Buffer::Create(InSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readback, readbackMemory);
+
+    VkCommandBuffer cmd = VulkanContext::BeginSingleTimeCommands();
+    VkBufferCopy region = {};
+    region.size = InSize;
+    vkCmdCopyBuffer(cmd, m_Buffer, readback, 1, &region);
+    VulkanContext::EndSingleTimeCommands(cmd);
+
+    void* data;
+    vkMapMemory(VulkanContext::GetDevice(), readbackMemory, 0, InSize, 0, &data);
+    std::memcpy(OutDataPointer, data, InSize);
+    vkUnmapMemory(VulkanContext::GetDevice(), readbackMemory);
+    vkDestroyBuffer(VulkanContext::GetDevice(), readback, nullptr);
+    vkFreeMemory(VulkanContext::GetDevice(), readbackMemory, nullptr);
+}
+
+void Buffer::Resize(VkDeviceSize InSize, bool InKeepContents) {
+    if (InSize == m_Size)
+        return;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+    CreateBuffer(InSize, buffer, allocation);
+
+    if (m_DeviceLocal) {
+        // Pending staged copies still target the old buffer, they have to be submitted before it is destroyed
+        StagingRing::Flush();
+    }
+
+    const size_t keptSize = InKeepContents ? std::min<size_t>(m_UsedSize, InSize) : 0;
+    if (keptSize > 0 && m_DeviceLocal) {
+        VkCommandBuffer cmd = VulkanContext::BeginSingleTimeCommands();
+        VkBufferCopy region = {};
+        region.size = keptSize;
+        vkCmdCopyBuffer(cmd, m_Buffer, buffer, 1, &region);
+        VulkanContext::EndSingleTimeCommands(cmd);
+    } else if (keptSize > 0) {
+        std::memcpy(allocation.mapped, m_Allocation.mapped, keptSize);
+    }
+
+    // The old buffer may still be read by a submitted frame
+    VulkanContext::DeviceWaitIdle();
+    Destroy();
+
+    m_Buffer = buffer;
+    m_Allocation = allocation;
+    m_Size = InSize;
+    m_UsedSize = keptSize;
+    m_BufferInfo.buffer = m_Buffer;
 }
 
 void Buffer::Destroy() {
@@ -29,13 +123,37 @@ void Buffer::Destroy() {
             vkDestroyBuffer(VulkanContext::GetDevice(), m_Buffer, nullptr);
             m_Buffer = VK_NULL_HANDLE;
         }
-        if (m_DeviceMemory != VK_NULL_HANDLE) {
-            vkFreeMemory(VulkanContext::GetDevice(), m_DeviceMemory, nullptr);
-            m_DeviceMemory = VK_NULL_HANDLE;
-        }
+        GpuAllocator::Free(m_Allocation);
     }
 }
 
+void Buffer::EnsureCapacity(VkDeviceSize InSize, bool InKeepContents) {
+    if (InSize <= m_Size)
+        return;
+
+    // Double the capacity so n appends only reallocate log(n) times
+    const VkDeviceSize capacity = std::max(InSize, 2 * m_Size);
+    RT_INFO("Growing buffer {0} from {1} to {2} bytes", m_Binding, m_Size, capacity);
+    Resize(capacity, InKeepContents);
+    Renderer::OnBuffersResized();
+}
+
+void Buffer::CreateBuffer(VkDeviceSize size, VkBuffer& buffer, GpuAllocation& allocation) const {
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = m_UsageFlags;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(VulkanContext::GetDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        RT_ERROR("failed to create buffer!"); exit(1);
+    }
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(VulkanContext::GetDevice(), buffer, &memReqs);
+    allocation = GpuAllocator::Allocate(memReqs, GetMemoryProperties(), GpuResourceKind::Buffer);
+    vkBindBufferMemory(VulkanContext::GetDevice(), buffer, allocation.memory, allocation.offset);
+}
+
 void Buffer::Create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
     VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     bufferInfo.size = size;
@@ -67,10 +185,32 @@ void Buffer::DestroyAllBuffers() {
     g_Buffers.clear();
 }
 
-std::shared_ptr<SSBO> SSBO::Create(uint32_t binding, VkDeviceSize size) {
-    return Buffer::Create<SSBO>(binding, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+std::shared_ptr<SSBO> SSBO::Create(uint32_t binding, VkDeviceSize size, VkBufferUsageFlags extraUsage) {
+    // Read mostly scene data, written through the staging ring
+    return Buffer::Create<SSBO>(binding, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | extraUsage, true);
+}
+
+std::shared_ptr<SSBO> SSBO::CreateHostVisible(uint32_t binding, VkDeviceSize size) {
+    return Buffer::Create<SSBO>(binding, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+}
+
+std::shared_ptr<UniformBuffer> UniformBuffer::Create(uint32_t binding, VkDeviceSize size, uint32_t frameCount) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+    const VkDeviceSize stride = (size + alignment - 1) / alignment * alignment;
+
+    // Rewritten every frame, stays host visible
+    auto buffer = Buffer::Create<UniformBuffer>(binding, stride * frameCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, false);
+    buffer->m_FrameStride = stride;
+    buffer->m_FrameCount = frameCount;
+    buffer->m_BufferInfo.range = size;
+    return buffer;
 }
 
-std::shared_ptr<UniformBuffer> UniformBuffer::Create(uint32_t binding, VkDeviceSize size) {
-    return Buffer::Create<UniformBuffer>(binding, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+void UniformBuffer::UploadFrame(const void* InDataPointer, size_t InSize) {
+    RT_ASSERT(InSize <= m_BufferInfo.range, "Uniform data exceeds the size of one frame");
+    m_Frame = (m_Frame + 1) % m_FrameCount;
+    std::memcpy(static_cast<byte*>(m_Allocation.mapped) + GetDynamicOffset(), InDataPointer, InSize);
+    m_UsedSize = InSize;
 }
\ No newline at end of file
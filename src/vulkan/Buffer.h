@@ -6,16 +6,29 @@
 #include <vector>
 #include "common/Types.h"
 #include "VulkanContext.h"
+#include "GpuAllocator.h"
 
-#define SSBO_DEFAULT_SIZE (16 * 1024 * 1024) // 16 MB
+// Initial capacity, SSBOs grow on demand (see Buffer::EnsureCapacity)
+#define SSBO_DEFAULT_SIZE (64 * 1024) // 64 KB
 
 class Buffer {
 public:
+    // Writes grow the buffer as needed, see EnsureCapacity
     void UploadData(void* InDataPointer, size_t InSize);
+    // Writes InSize bytes at InOffset and leaves the rest of the buffer untouched
+    void UploadRegion(const void* InDataPointer, size_t InOffset, size_t InSize);
+    // Device local buffers hand out a CPU copy that UnmapData stages to the GPU
     void* MapData(size_t InSize);
     void UnmapData();
+    void ReadData(void* OutDataPointer, size_t InSize);
+    // Reallocates the buffer with InSize bytes and optionally keeps the used bytes. The VkBuffer changes,
+    // so the descriptor set has to be rewritten afterwards (Renderer::OnBuffersResized)
+    void Resize(VkDeviceSize InSize, bool InKeepContents = true);
+    // Grows the buffer to at least InSize bytes (doubling the capacity) and rewrites the descriptors
+    void EnsureCapacity(VkDeviceSize InSize, bool InKeepContents);
     void Destroy();
 
+    // Standalone buffer with its own memory, used for transient staging and readback buffers
     static void Create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
     static void DestroyAllBuffers();
     static std::vector<std::shared_ptr<Buffer>> GetAllBuffers() { return g_Buffers; }
@@ -23,17 +36,32 @@ public:
     uint32_t GetBindingPoint() const { return m_Binding; }
     VkDescriptorBufferInfo* GetBufferInfo() { return &m_BufferInfo; }
     VkBuffer GetBuffer() const { return m_Buffer; }
+    VkDeviceSize GetSize() const { return m_Size; }
+    // Size of the most recent full write (UploadData/MapData), i.e. the bytes the shaders actually read
+    size_t GetUsedSize() const { return m_UsedSize; }
+    bool IsDeviceLocal() const { return m_DeviceLocal; }
+    // Offset passed to vkCmdBindDescriptorSets for dynamic descriptors, see UniformBuffer
+    virtual uint32_t GetDynamicOffset() const { return 0; }
     virtual VkDescriptorType GetDescriptorType() const = 0;
 
 protected:
+    VkMemoryPropertyFlags GetMemoryProperties() const {
+        return m_DeviceLocal ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    // Creates a VkBuffer of size bytes bound to memory of the GpuAllocator
+    void CreateBuffer(VkDeviceSize size, VkBuffer& buffer, GpuAllocation& allocation) const;
+
     template <typename T>
-    static std::shared_ptr<T> Create(uint32_t binding, VkDeviceSize size, VkBufferUsageFlags usageFlags) {
+    static std::shared_ptr<T> Create(uint32_t binding, VkDeviceSize size, VkBufferUsageFlags usageFlags, bool deviceLocal) {
         auto buffer = std::make_shared<T>();
         g_Buffers.push_back(buffer);
 
         buffer->m_Binding = binding;
+        buffer->m_Size = size;
+        buffer->m_UsageFlags = usageFlags;
+        buffer->m_DeviceLocal = deviceLocal;
 
-        Buffer::Create(size, usageFlags, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer->m_Buffer, buffer->m_DeviceMemory);
+        buffer->CreateBuffer(size, buffer->m_Buffer, buffer->m_Allocation);
 
         buffer->m_BufferInfo.buffer = buffer->m_Buffer;
         buffer->m_BufferInfo.offset = 0;
@@ -43,23 +71,44 @@ protected:
     }
 
     VkBuffer m_Buffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_DeviceMemory = VK_NULL_HANDLE;
+    GpuAllocation m_Allocation;     // host visible allocations stay mapped
     VkDescriptorBufferInfo m_BufferInfo = {};
     uint32_t m_Binding = 0;
+    VkDeviceSize m_Size = 0;
+    size_t m_UsedSize = 0;
+    VkBufferUsageFlags m_UsageFlags = 0;
+    // Device local buffers are written through the StagingRing instead of being mapped
+    bool m_DeviceLocal = false;
+    std::vector<byte> m_MappedShadow;   // CPU copy handed out by MapData of device local buffers
 
     inline static std::vector<std::shared_ptr<Buffer>> g_Buffers;
 };
 
 class SSBO : public Buffer {
 public:
-    static std::shared_ptr<SSBO> Create(uint32_t binding, VkDeviceSize size = SSBO_DEFAULT_SIZE);
+    // extraUsage adds usages beyond storage and transfer, e.g. indirect dispatch arguments
+    static std::shared_ptr<SSBO> Create(uint32_t binding, VkDeviceSize size = SSBO_DEFAULT_SIZE, VkBufferUsageFlags extraUsage = 0);
+    // Small buffers the GPU writes and the CPU reads back every frame stay host visible
+    static std::shared_ptr<SSBO> CreateHostVisible(uint32_t binding, VkDeviceSize size);
     virtual VkDescriptorType GetDescriptorType() const override { return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; }
 };
 
+// Ring of frameCount copies of the uniform data in one persistently mapped buffer. Every frame
+// writes the next copy and binds it through a dynamic offset, so the CPU never overwrites a
+// copy that a frame still in flight reads (see Renderer::GetFrameCopies)
 class UniformBuffer : public Buffer {
 public:
-    static std::shared_ptr<UniformBuffer> Create(uint32_t binding, VkDeviceSize size = sizeof(float) * 16);
-    virtual VkDescriptorType GetDescriptorType() const override { return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; }
+    static std::shared_ptr<UniformBuffer> Create(uint32_t binding, VkDeviceSize size = sizeof(float) * 16, uint32_t frameCount = 1);
+    // Advances to the next copy and writes InSize bytes to it
+    void UploadFrame(const void* InDataPointer, size_t InSize);
+
+    virtual uint32_t GetDynamicOffset() const override { return static_cast<uint32_t>(m_Frame * m_FrameStride); }
+    virtual VkDescriptorType GetDescriptorType() const override { return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; }
+
+private:
+    VkDeviceSize m_FrameStride = 0;     // copy size rounded up to minUniformBufferOffsetAlignment
+    uint32_t m_FrameCount = 1;
+    uint32_t m_Frame = 0;
 };
 
 #endif
\ No newline at end of file
@@ -2,17 +2,117 @@
 #include "VulkanContext.h"
 #include "OffscreenResources.h"
 #include "vulkan/Buffer.h"
+#include "vulkan/Texture.h"
 #include "vulkan/ShaderCompiler.h"
+#include "vulkan/KernelTuner.h"
+#include "vulkan/PipelineCache.h"
 #include "common/Log.h"
+#include "common/Params.h"
+#include "common/ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+
+// constant_id 0: slots of the sorted shading queues, 1: shading stats on/off, 2: persistent threads on/off,
+// 3/4: workgroup size, 5: Morton pixel order, 6-8: scene object types, 10: kd-tree stack size (ShaderCode/include/Constants.glsl)
+struct RaytracerSpecialization {
+    uint32_t sortedShadingSlots;
+    VkBool32 shadingStats;
+    VkBool32 persistentThreads;
+    uint32_t workgroupWidth;
+    uint32_t workgroupHeight;
+    VkBool32 mortonOrder;
+    uint32_t primitiveTypes;
+    uint32_t shaderTypes;
+    uint32_t lightTypes;
+    int32_t maxStack;
+};
+
+// Everything a pipeline build needs, gathered on the main thread so background builds never read
+// Params, the KernelConfig or the SPIR-V file while the main thread changes them
+struct PipelineBuild {
+    VkDevice device;
+    VkPipelineCache cache;
+    VkPipelineLayout layout;
+    VkShaderModule module;     // destroyed by BuildPipeline
+    RaytracerSpecialization specialization;
+};
+
+static PipelineBuild PreparePipelineBuild(VkPipelineLayout layout, const SceneFeatures& features) {
+    const KernelConfig& config = KernelTuner::GetConfig();
+    PipelineBuild build = {};
+    build.device = VulkanContext::GetDevice();
+    build.cache = PipelineCache::Get();
+    build.layout = layout;
+    build.module = CreateShaderModule(ShaderBinary("ShaderCache/Raytracer.comp.glsl.spv"));
+    build.specialization = {
+        Params::s_SortedShading ? config.GetInvocations() : 1u,
+        Params::s_ShadingStats ? VK_TRUE : VK_FALSE,
+        Params::s_PersistentThreads ? VK_TRUE : VK_FALSE,
+        config.workgroupWidth,
+        config.workgroupHeight,
+        config.mortonOrder ? VK_TRUE : VK_FALSE,
+        features.primitiveTypes,
+        features.shaderTypes,
+        features.lightTypes,
+        int32_t(config.maxStack)
+    };
+    return build;
+}
+
+// Only uses build, safe to run on a ThreadPool worker
+static VkPipeline BuildPipeline(const PipelineBuild& build) {
+    VkPipelineShaderStageCreateInfo stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stage.module = build.module;
+    stage.pName = "main";
+
+    VkSpecializationMapEntry specializationEntries[] = {
+        { 0, offsetof(RaytracerSpecialization, sortedShadingSlots), sizeof(uint32_t) },
+        { 1, offsetof(RaytracerSpecialization, shadingStats), sizeof(VkBool32) },
+        { 2, offsetof(RaytracerSpecialization, persistentThreads), sizeof(VkBool32) },
+        { 3, offsetof(RaytracerSpecialization, workgroupWidth), sizeof(uint32_t) },
+        { 4, offsetof(RaytracerSpecialization, workgroupHeight), sizeof(uint32_t) },
+        { 5, offsetof(RaytracerSpecialization, mortonOrder), sizeof(VkBool32) },
+        { 6, offsetof(RaytracerSpecialization, primitiveTypes), sizeof(uint32_t) },
+        { 7, offsetof(RaytracerSpecialization, shaderTypes), sizeof(uint32_t) },
+        { 8, offsetof(RaytracerSpecialization, lightTypes), sizeof(uint32_t) },
+        { 10, offsetof(RaytracerSpecialization, maxStack), sizeof(int32_t) },
+    };
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = (uint32_t)std::size(specializationEntries);
+    specialization.pMapEntries = specializationEntries;
+    specialization.dataSize = sizeof(build.specialization);
+    specialization.pData = &build.specialization;
+    stage.pSpecializationInfo = &specialization;
+
+    VkComputePipelineCreateInfo pipelineInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    pipelineInfo.stage = stage;
+    pipelineInfo.layout = build.layout;
+
+    VkPipeline result = VK_NULL_HANDLE;
+    vkCreateComputePipelines(build.device, build.cache, 1, &pipelineInfo, nullptr, &result);
+    vkDestroyShaderModule(build.device, build.module, nullptr);
+    return result;
+}
 
 void ComputePipeline::Init() {
+    if (Params::s_SortedShading && !IsSortedShadingSupported()) {
+        RT_WARN("Device has less than {0} bytes of workgroup memory, --sorted-shading is disabled",
+            SORTED_SHADING_SHARED_MEMORY(KernelTuner::GetConfig().GetInvocations()));
+        Params::s_SortedShading = false;
+    }
+
     CreateDescriptorPool();
     CreateDescriptorSetLayout();
     UpdateDescriptorSets();
-    CreatePipeline();
+    CreatePipelineLayout();
+    pipeline = CreatePipeline(SceneFeatures());
 }
 
 void ComputePipeline::Cleanup() {
+    DestroySceneVariants();
     vkDestroyPipeline(VulkanContext::GetDevice(), pipeline, nullptr);
     vkDestroyPipelineLayout(VulkanContext::GetDevice(), pipelineLayout, nullptr);
     vkDestroyDescriptorPool(VulkanContext::GetDevice(), descriptorPool, nullptr);
@@ -20,21 +120,78 @@ void ComputePipeline::Cleanup() {
 }
 
 void ComputePipeline::RecreatePipeline() {
+    // The layout only depends on the descriptor set layout and the push constants, it is kept
     VulkanContext::DeviceWaitIdle();
+    DestroySceneVariants();
     vkDestroyPipeline(VulkanContext::GetDevice(), pipeline, nullptr);
-    vkDestroyPipelineLayout(VulkanContext::GetDevice(), pipelineLayout, nullptr);
-    CreatePipeline();
+    pipeline = CreatePipeline(SceneFeatures());
+    // The device is idle anyway, measurements like KernelTuner::AutoTune see the variant right away
+    UpdateSceneVariant(true);
+}
+
+void ComputePipeline::SetSceneFeatures(const SceneFeatures& features) {
+    sceneFeatures = features;
+}
+
+VkPipeline ComputePipeline::GetPipeline() {
+    if (!Params::s_SceneVariants) {
+        return pipeline;
+    }
+    // Nothing is shown while the variant builds, so headless renders do not start with the generic pipeline
+    UpdateSceneVariant(!Params::IsInteractiveMode());
+    VkPipeline variant = FindSceneVariant(sceneFeatures);
+    return variant != VK_NULL_HANDLE ? variant : pipeline;
+}
+
+void ComputePipeline::UpdateSceneVariant(bool wait) {
+    if (pendingVariant.valid() && (wait || pendingVariant.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        sceneVariants.push_back({ pendingFeatures, pendingVariant.get() });
+    }
+    if (!Params::s_SceneVariants || sceneFeatures.IsGeneric() || pendingVariant.valid() || FindSceneVariant(sceneFeatures) != VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (wait) {
+        sceneVariants.push_back({ sceneFeatures, CreatePipeline(sceneFeatures) });
+        return;
+    }
+    // The worker gets a copy of everything it needs, the UI may change Params before RecreatePipeline joins it
+    pendingFeatures = sceneFeatures;
+    pendingVariant = ThreadPool::Get().Enqueue([build = PreparePipelineBuild(pipelineLayout, sceneFeatures)]() {
+        return BuildPipeline(build);
+    });
+}
+
+VkPipeline ComputePipeline::FindSceneVariant(const SceneFeatures& features) {
+    for (const auto& variant : sceneVariants) {
+        if (variant.first == features) {
+            return variant.second;
+        }
+    }
+    return VK_NULL_HANDLE;
+}
+
+void ComputePipeline::DestroySceneVariants() {
+    if (pendingVariant.valid()) {
+        sceneVariants.push_back({ pendingFeatures, pendingVariant.get() });
+    }
+    for (const auto& variant : sceneVariants) {
+        vkDestroyPipeline(VulkanContext::GetDevice(), variant.second, nullptr);
+    }
+    sceneVariants.clear();
 }
 
 void ComputePipeline::CreateDescriptorPool() {
     VkDescriptorPoolSize sizes[] = { 
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 }, 
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 }, 
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10 } 
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURES }
     };
     VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
     info.maxSets = 10;
-    info.poolSizeCount = 3;
+    info.poolSizeCount = 5;
     info.pPoolSizes = sizes;
     vkCreateDescriptorPool(VulkanContext::GetDevice(), &info, nullptr, &descriptorPool);
 }
@@ -49,6 +206,13 @@ void ComputePipeline::CreateDescriptorSetLayout() {
     imageBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     bindings.push_back(imageBinding);
 
+    VkDescriptorSetLayoutBinding textureBinding{};
+    textureBinding.binding = TEXTURE_SAMPLER_BINDING;
+    textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureBinding.descriptorCount = MAX_TEXTURES;
+    textureBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings.push_back(textureBinding);
+
     auto buffers = Buffer::GetAllBuffers();
     for (const auto& buff : buffers) {
         VkDescriptorSetLayoutBinding b = {};
@@ -97,6 +261,60 @@ void ComputePipeline::UpdateDescriptorSets() {
         writes.push_back(bw);
     }
     vkUpdateDescriptorSets(VulkanContext::GetDevice(), (uint32_t)writes.size(), writes.data(), 0, nullptr);
+
+    UpdateTextureDescriptors();
+}
+
+void ComputePipeline::UpdateTextureDescriptors() {
+    std::vector<VkDescriptorImageInfo> textureInfos = Texture::GetDescriptorImageInfos();
+
+    VkWriteDescriptorSet textureWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    textureWrite.dstSet = descriptorSet;
+    textureWrite.dstBinding = TEXTURE_SAMPLER_BINDING;
+    textureWrite.dstArrayElement = 0;
+    textureWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureWrite.descriptorCount = (uint32_t)textureInfos.size();
+    textureWrite.pImageInfo = textureInfos.data();
+    vkUpdateDescriptorSets(VulkanContext::GetDevice(), 1, &textureWrite, 0, nullptr);
+}
+
+void ComputePipeline::UpdateTextureDescriptors(const std::vector<uint32_t>& slots) {
+    std::vector<VkDescriptorImageInfo> textureInfos(slots.size());
+    std::vector<VkWriteDescriptorSet> writes(slots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        textureInfos[i] = Texture::GetDescriptorImageInfo(slots[i]);
+        writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = TEXTURE_SAMPLER_BINDING;
+        writes[i].dstArrayElement = slots[i];
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[i].descriptorCount = 1;
+        writes[i].pImageInfo = &textureInfos[i];
+    }
+    vkUpdateDescriptorSets(VulkanContext::GetDevice(), (uint32_t)writes.size(), writes.data(), 0, nullptr);
+}
+
+std::vector<uint32_t> ComputePipeline::GetDynamicOffsets() {
+    std::vector<std::pair<uint32_t, uint32_t>> dynamicBuffers;
+    for (const auto& buff : Buffer::GetAllBuffers()) {
+        if (buff->GetDescriptorType() == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+            dynamicBuffers.push_back({ buff->GetBindingPoint(), buff->GetDynamicOffset() });
+        }
+    }
+    // Vulkan expects the offsets in binding order
+    std::sort(dynamicBuffers.begin(), dynamicBuffers.end());
+
+    std::vector<uint32_t> offsets;
+    for (const auto& dynamicBuffer : dynamicBuffers) {
+        offsets.push_back(dynamicBuffer.second);
+    }
+    return offsets;
+}
+
+bool ComputePipeline::IsSortedShadingSupported() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    return properties.limits.maxComputeSharedMemorySize >= SORTED_SHADING_SHARED_MEMORY(KernelTuner::GetConfig().GetInvocations());
 }
 
 VkShaderModule CreateShaderModule(const ShaderBinary& bin) {
@@ -108,25 +326,20 @@ VkShaderModule CreateShaderModule(const ShaderBinary& bin) {
     return mod;
 }
 
-void ComputePipeline::CreatePipeline() {
-    ShaderBinary compBin("ShaderCache/Raytracer.comp.glsl.spv");
-    VkShaderModule compShader = CreateShaderModule(compBin);
-
-    VkPipelineShaderStageCreateInfo stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-    stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    stage.module = compShader;
-    stage.pName = "main";
+void ComputePipeline::CreatePipelineLayout() {
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = sizeof(ComputePushConstants);
 
     VkPipelineLayoutCreateInfo layoutInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
     layoutInfo.setLayoutCount = 1;
     layoutInfo.pSetLayouts = &descriptorSetLayout;
-    
-    vkCreatePipelineLayout(VulkanContext::GetDevice(), &layoutInfo, nullptr, &pipelineLayout);
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
 
-    VkComputePipelineCreateInfo pipelineInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-    pipelineInfo.stage = stage;
-    pipelineInfo.layout = pipelineLayout;
+    vkCreatePipelineLayout(VulkanContext::GetDevice(), &layoutInfo, nullptr, &pipelineLayout);
+}
 
-    vkCreateComputePipelines(VulkanContext::GetDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
-    vkDestroyShaderModule(VulkanContext::GetDevice(), compShader, nullptr);
+VkPipeline ComputePipeline::CreatePipeline(const SceneFeatures& features) {
+    return BuildPipeline(PreparePipelineBuild(pipelineLayout, features));
 }
@@ -2,28 +2,90 @@
 #define COMPUTE_PIPELINE_H
 
 #include <vulkan/vulkan.h>
+#include <vector>
+#include <cstdint>
+#include <future>
+#include <utility>
+
+// Must match the push_constant block in ShaderCode/Raytracer.comp.glsl
+struct ComputePushConstants {
+    uint32_t sampleOffset = 0;  // first sample of the dispatch, relative to u_SampleIndex
+    uint32_t sampleCount = 1;   // samples accumulated per pixel by one dispatch
+    uint32_t tileOffsetX = 0;   // first pixel of the dispatched tile
+    uint32_t tileOffsetY = 0;
+    uint32_t slot = 0;          // submission slot of ShadingStats and PersistentThreads
+    uint32_t tileRows = 0;      // rows of the dispatched tile
+};
+
+// Shared memory of the sorted shading queues in Raytracer.comp.glsl: 9 vec4 of path state and
+// one sort index per slot (one slot per workgroup invocation), plus 12 bin counters and the hit counter
+#define SORTED_SHADING_SHARED_MEMORY(invocations) ((9 * 16 + 4) * (invocations) + 13 * 4)
+
+// Object types a scene uses, bit n of a mask stands for type n of PrimitiveType, ShaderType and LightType.
+// Must match the SCENE_*_TYPES specialization constants in ShaderCode/include/Constants.glsl
+struct SceneFeatures {
+    uint32_t primitiveTypes = 0xFFFFFFFF;
+    uint32_t shaderTypes = 0xFFFFFFFF;
+    uint32_t lightTypes = 0xFFFFFFFF;
+
+    bool IsGeneric() const { return *this == SceneFeatures(); }
+    bool operator==(const SceneFeatures& other) const {
+        return primitiveTypes == other.primitiveTypes && shaderTypes == other.shaderTypes && lightTypes == other.lightTypes;
+    }
+};
+
+struct ShaderBinary;
+VkShaderModule CreateShaderModule(const ShaderBinary& bin);
 
 class ComputePipeline {
 public:
     static void Init();
     static void Cleanup();
     static void UpdateDescriptorSets();
+    static void UpdateTextureDescriptors();
+    // Only rewrites the sampler array elements of the given slots
+    static void UpdateTextureDescriptors(const std::vector<uint32_t>& slots);
+    // Rebuilds the pipeline from the current SPIR-V and specialization constants (shader reloads,
+    // kernel settings), not needed when the window or the render resolution changes. Drops the
+    // cached scene variants and builds the one of the current scene right away
     static void RecreatePipeline();
+    // Set by Scene::UpdateGPUBuffers. The first GetPipeline afterwards builds the variant without the
+    // unused object types, in interactive mode on the ThreadPool while the generic pipeline keeps
+    // rendering. Variants stay cached until the next RecreatePipeline
+    static void SetSceneFeatures(const SceneFeatures& features);
+    static bool IsSceneVariantPending() { return pendingVariant.valid(); }
+    // Current offsets of all dynamic uniform buffers, in the order vkCmdBindDescriptorSets expects
+    static std::vector<uint32_t> GetDynamicOffsets();
 
-    static VkPipeline GetPipeline() { return pipeline; }
+    // The variant of the current scene if it is built and Params::s_SceneVariants is on, else the generic pipeline
+    static VkPipeline GetPipeline();
     static VkPipelineLayout GetLayout() { return pipelineLayout; }
     static VkDescriptorSet GetDescriptorSet() { return descriptorSet; }
+    static VkDescriptorSetLayout GetDescriptorSetLayout() { return descriptorSetLayout; }
+    // Params::s_SortedShading needs SORTED_SHADING_SHARED_MEMORY bytes of workgroup memory for the
+    // workgroup size of KernelTuner::GetConfig()
+    static bool IsSortedShadingSupported();
 
 private:
     static void CreateDescriptorPool();
     static void CreateDescriptorSetLayout();
-    static void CreatePipeline();
+    static void CreatePipelineLayout();
+    static VkPipeline CreatePipeline(const SceneFeatures& features);
+    // Takes a finished background build and starts the one of the current scene if it is missing,
+    // wait builds it on the calling thread instead
+    static void UpdateSceneVariant(bool wait);
+    static VkPipeline FindSceneVariant(const SceneFeatures& features);
+    static void DestroySceneVariants();
 
     inline static VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
     inline static VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     inline static VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
     inline static VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
-    inline static VkPipeline pipeline = VK_NULL_HANDLE;
+    inline static VkPipeline pipeline = VK_NULL_HANDLE;   // all object types
+    inline static SceneFeatures sceneFeatures;
+    inline static std::vector<std::pair<SceneFeatures, VkPipeline>> sceneVariants;
+    inline static SceneFeatures pendingFeatures;
+    inline static std::future<VkPipeline> pendingVariant;
 };
 
 #endif
@@ -0,0 +1,134 @@
+#include "EnvironmentMap.h"
+#include "Buffer.h"
+#include "common/Log.h"
+#include "common/Params.h"
+#include "common/ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static std::shared_ptr<SSBO> s_EnvironmentSSBO;
+
+void EnvironmentMap::CreateGPUBuffers() {
+    s_EnvironmentSSBO = SSBO::Create(ENVIRONMENT_DISTRIBUTION_BINDING);
+    Build(NULL_TEXTURE);
+}
+
+static float SRGBChannelToLinear(float value) {
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Linear luminance of texel (x, y), negative if the format is not supported
+static float GetTexelLuminance(const Texture& texture, uint32_t x, uint32_t y) {
+    const size_t index = size_t(y) * texture.GetWidth() + x;
+    Vec3 color;
+    switch (texture.GetFormat()) {
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            color = Vec3(reinterpret_cast<const Vec4*>(texture.GetTexels().data())[index]);
+            break;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB: {
+            const byte* texel = texture.GetTexels().data() + index * 4;
+            color = Vec3(texel[0], texel[1], texel[2]) / 255.0f;
+            if (texture.GetFormat() == VK_FORMAT_R8G8B8A8_SRGB) {
+                color = Vec3(SRGBChannelToLinear(color.r), SRGBChannelToLinear(color.g), SRGBChannelToLinear(color.b));
+            }
+            break;
+        }
+        default:
+            return -1.0f;
+    }
+    // NaNs and negative values from broken HDR files must not end up in the CDF
+    const float luminance = 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+    return std::isfinite(luminance) ? std::max(luminance, 0.0f) : 0.0f;
+}
+
+// Fills cdf with the marginal and conditional CDFs of texture downsampled to width x height,
+// returns the average weight or 0 if there is nothing to sample
+static double BuildDistribution(const Texture& texture, uint32_t width, uint32_t height, std::vector<float>& cdf) {
+    const uint32_t textureWidth = static_cast<uint32_t>(texture.GetWidth());
+    const uint32_t textureHeight = static_cast<uint32_t>(texture.GetHeight());
+
+    // Box filter the luminance into the distribution grid, one row per task
+    std::vector<double> weights(size_t(width) * height);
+    std::vector<double> rowSums(height, 0.0);
+    ThreadPool::Get().ParallelFor(height, [&](uint32_t row) {
+        const uint32_t y0 = row * textureHeight / height;
+        const uint32_t y1 = std::max(y0 + 1, (row + 1) * textureHeight / height);
+        // Solid angle of a texel shrinks towards the poles
+        const double sinTheta = std::sin(PI * (row + 0.5) / height);
+        for (uint32_t column = 0; column < width; column++) {
+            const uint32_t x0 = column * textureWidth / width;
+            const uint32_t x1 = std::max(x0 + 1, (column + 1) * textureWidth / width);
+            double sum = 0.0;
+            for (uint32_t y = y0; y < y1; y++) {
+                for (uint32_t x = x0; x < x1; x++) {
+                    sum += GetTexelLuminance(texture, x, y);
+                }
+            }
+            const double weight = sum / (double(x1 - x0) * (y1 - y0)) * sinTheta;
+            weights[size_t(row) * width + column] = weight;
+            rowSums[row] += weight;
+        }
+    });
+
+    double total = 0.0;
+    for (double rowSum : rowSums) {
+        total += rowSum;
+    }
+    if (!(total > 0.0)) {
+        return 0.0;
+    }
+
+    cdf.assign((height + 1) + size_t(height) * (width + 1), 0.0f);
+    double accumulated = 0.0;
+    for (uint32_t row = 0; row < height; row++) {
+        accumulated += rowSums[row];
+        cdf[row + 1] = static_cast<float>(accumulated / total);
+
+        float* conditional = cdf.data() + (height + 1) + size_t(row) * (width + 1);
+        double rowAccumulated = 0.0;
+        for (uint32_t column = 0; column < width; column++) {
+            rowAccumulated += weights[size_t(row) * width + column];
+            // Rows without any light are never picked by the marginal, keep them uniform anyway
+            conditional[column + 1] = rowSums[row] > 0.0 ? static_cast<float>(rowAccumulated / rowSums[row]) : float(column + 1) / width;
+        }
+        conditional[width] = 1.0f;
+    }
+    cdf[height] = 1.0f;
+    return total / (double(width) * height);
+}
+
+void EnvironmentMap::Build(TextureID textureId) {
+    if (!s_EnvironmentSSBO) {
+        return;
+    }
+
+    EnvironmentDistributionHeader header = { 0, 0, NULL_TEXTURE, 0.0f };
+    std::vector<float> cdf;
+
+    const auto& textures = Texture::GetAllTextures();
+    const Texture* texture = (textureId >= 0 && textureId < static_cast<TextureID>(textures.size())) ? textures[textureId] : nullptr;
+    if (texture && Params::s_EnvironmentSampling) {
+        if (texture->GetTexels().empty()) {
+            RT_WARN("Environment map {0} has no CPU texels, it is not importance sampled", textureId);
+        } else {
+            const uint32_t width = std::min<uint32_t>(texture->GetWidth(), ENVIRONMENT_DISTRIBUTION_MAX_WIDTH);
+            const uint32_t height = std::min<uint32_t>(texture->GetHeight(), ENVIRONMENT_DISTRIBUTION_MAX_HEIGHT);
+            const double integral = (GetTexelLuminance(*texture, 0, 0) < 0.0f) ? 0.0 : BuildDistribution(*texture, width, height, cdf);
+            if (integral > 0.0) {
+                header = { width, height, textureId, static_cast<float>(integral) };
+                RT_INFO("Built environment distribution for texture {0}: {1}x{2}", textureId, width, height);
+            } else {
+                RT_WARN("Environment map {0} is black or has an unsupported format, it is not importance sampled", textureId);
+            }
+        }
+    }
+
+    byte* dst = static_cast<byte*>(s_EnvironmentSSBO->MapData(sizeof(header) + sizeof(float) * cdf.size()));
+    std::memcpy(dst, &header, sizeof(header));
+    if (!cdf.empty()) {
+        std::memcpy(dst + sizeof(header), cdf.data(), sizeof(float) * cdf.size());
+    }
+    s_EnvironmentSSBO->UnmapData();
+}
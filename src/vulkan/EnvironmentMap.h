@@ -0,0 +1,28 @@
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+#include "Texture.h"
+
+// Importance sampling distribution of the environment map (ShaderCode/include/Environment.glsl)
+// Piecewise constant over the equirectangular texture, proportional to luminance * sin(theta).
+// Layout: EnvironmentDistributionHeader, the marginal CDF over the rows (height + 1 floats),
+// then one conditional CDF per row (width + 1 floats each)
+#define ENVIRONMENT_DISTRIBUTION_BINDING 54
+#define ENVIRONMENT_DISTRIBUTION_MAX_WIDTH 1024
+#define ENVIRONMENT_DISTRIBUTION_MAX_HEIGHT 512
+
+struct EnvironmentDistributionHeader {
+    uint32_t width;     // 0 when the environment is not importance sampled
+    uint32_t height;
+    TextureID texture;  // environment map the distribution was built from
+    float integral;     // average of luminance * sin(theta) over the texture
+};
+
+class EnvironmentMap {
+public:
+    static void CreateGPUBuffers();
+    // Rebuilds the distribution from the texels of texture, NULL_TEXTURE disables environment sampling
+    static void Build(TextureID texture);
+};
+
+#endif
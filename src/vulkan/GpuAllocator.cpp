@@ -0,0 +1,167 @@
+#include "GpuAllocator.h"
+#include "VulkanContext.h"
+#include "common/Log.h"
+#include "common/Types.h"
+#include <algorithm>
+#include <iterator>
+
+uint32_t GpuAllocator::CreateBlock(VkDeviceSize size, uint32_t memoryType, VkMemoryPropertyFlags properties, GpuResourceKind kind, bool dedicated) {
+    Block block;
+    block.size = size;
+    block.memoryType = memoryType;
+    block.kind = kind;
+    block.dedicated = dedicated;
+    block.freeRanges[0] = size;
+
+    VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    if (vkAllocateMemory(VulkanContext::GetDevice(), &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+        RT_ERROR("failed to allocate {0} bytes of GPU memory (committed: {1} bytes)", size, GetCommittedSize()); exit(1);
+    }
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(VulkanContext::GetDevice(), block.memory, 0, size, 0, &block.mapped);
+    }
+
+    // Reuse the slot of a released block so GpuAllocation::block stays valid for live allocations
+    for (uint32_t i = 0; i < s_Blocks.size(); i++) {
+        if (s_Blocks[i].memory == VK_NULL_HANDLE) {
+            s_Blocks[i] = std::move(block);
+            return i;
+        }
+    }
+    s_Blocks.push_back(std::move(block));
+    return static_cast<uint32_t>(s_Blocks.size() - 1);
+}
+
+bool GpuAllocator::AllocateFromBlock(uint32_t blockIndex, const VkMemoryRequirements& requirements, GpuAllocation& allocation) {
+    Block& block = s_Blocks[blockIndex];
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        const VkDeviceSize rangeBegin = it->first;
+        const VkDeviceSize rangeEnd = it->first + it->second;
+        const VkDeviceSize offset = (rangeBegin + alignment - 1) / alignment * alignment;
+        if (offset + requirements.size > rangeEnd) {
+            continue;
+        }
+
+        // Split the free range around the allocation
+        block.freeRanges.erase(it);
+        if (offset > rangeBegin) {
+            block.freeRanges[rangeBegin] = offset - rangeBegin;
+        }
+        if (offset + requirements.size < rangeEnd) {
+            block.freeRanges[offset + requirements.size] = rangeEnd - (offset + requirements.size);
+        }
+
+        // The alignment padding belongs to the free list, so only the requested bytes are used
+        block.used += requirements.size;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size = requirements.size;
+        allocation.mapped = block.mapped ? static_cast<byte*>(block.mapped) + offset : nullptr;
+        allocation.block = blockIndex;
+        return true;
+    }
+    return false;
+}
+
+GpuAllocation GpuAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, GpuResourceKind kind) {
+    const uint32_t memoryType = VulkanContext::FindMemoryType(requirements.memoryTypeBits, properties);
+    GpuAllocation allocation;
+
+    if (requirements.size > GPU_ALLOCATOR_DEDICATED_THRESHOLD) {
+        const uint32_t blockIndex = CreateBlock(requirements.size, memoryType, properties, kind, true);
+        AllocateFromBlock(blockIndex, requirements, allocation);
+        return allocation;
+    }
+
+    for (uint32_t i = 0; i < s_Blocks.size(); i++) {
+        const Block& block = s_Blocks[i];
+        if (block.memory == VK_NULL_HANDLE || block.dedicated || block.memoryType != memoryType || block.kind != kind) {
+            continue;
+        }
+        if (AllocateFromBlock(i, requirements, allocation)) {
+            return allocation;
+        }
+    }
+
+    const uint32_t blockIndex = CreateBlock(GPU_ALLOCATOR_BLOCK_SIZE, memoryType, properties, kind, false);
+    AllocateFromBlock(blockIndex, requirements, allocation);
+    return allocation;
+}
+
+void GpuAllocator::Free(GpuAllocation& allocation) {
+    if (allocation.block == UINT32_MAX) {
+        return;
+    }
+    Block& block = s_Blocks[allocation.block];
+    block.used -= allocation.size;
+
+    // Insert the range and merge it with its free neighbours
+    VkDeviceSize begin = allocation.offset;
+    VkDeviceSize end = allocation.offset + allocation.size;
+    auto next = block.freeRanges.lower_bound(begin);
+    if (next != block.freeRanges.end() && next->first == end) {
+        end += next->second;
+        next = block.freeRanges.erase(next);
+    }
+    if (next != block.freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second >= begin) {
+            begin = previous->first;
+            block.freeRanges.erase(previous);
+        }
+    }
+    block.freeRanges[begin] = end - begin;
+
+    // Empty blocks go back to the driver, the next allocation creates a fresh one if needed
+    if (block.used == 0) {
+        ReleaseBlock(allocation.block);
+    }
+    allocation = GpuAllocation();
+}
+
+void GpuAllocator::ReleaseBlock(uint32_t blockIndex) {
+    Block& block = s_Blocks[blockIndex];
+    if (block.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    if (block.mapped) {
+        vkUnmapMemory(VulkanContext::GetDevice(), block.memory);
+    }
+    vkFreeMemory(VulkanContext::GetDevice(), block.memory, nullptr);
+    block = Block();
+}
+
+void GpuAllocator::Cleanup() {
+    for (uint32_t i = 0; i < s_Blocks.size(); i++) {
+        ReleaseBlock(i);
+    }
+    s_Blocks.clear();
+}
+
+VkDeviceSize GpuAllocator::GetCommittedSize() {
+    VkDeviceSize committed = 0;
+    for (const Block& block : s_Blocks) {
+        committed += block.size;
+    }
+    return committed;
+}
+
+VkDeviceSize GpuAllocator::GetUsedSize() {
+    VkDeviceSize used = 0;
+    for (const Block& block : s_Blocks) {
+        used += block.used;
+    }
+    return used;
+}
+
+void GpuAllocator::LogUsage() {
+    uint32_t blockCount = 0;
+    for (const Block& block : s_Blocks) {
+        blockCount += block.memory != VK_NULL_HANDLE ? 1 : 0;
+    }
+    RT_INFO("GPU memory: {0:.2f} MB committed in {1} blocks, {2:.2f} MB used",
+        GetCommittedSize() / (1024.0 * 1024.0), blockCount, GetUsedSize() / (1024.0 * 1024.0));
+}
@@ -0,0 +1,58 @@
+#ifndef GPU_ALLOCATOR_H
+#define GPU_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <map>
+#include <vector>
+
+#define GPU_ALLOCATOR_BLOCK_SIZE (64 * 1024 * 1024) // 64 MB
+// Requests above this size get a block of their own
+#define GPU_ALLOCATOR_DEDICATED_THRESHOLD (GPU_ALLOCATOR_BLOCK_SIZE / 2)
+
+// Buffers and optimally tiled images never share a block, so bufferImageGranularity does not matter
+enum class GpuResourceKind : uint32_t {
+    Buffer = 0,
+    Image = 1,
+};
+
+struct GpuAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;     // host visible blocks stay mapped for their whole lifetime
+    uint32_t block = UINT32_MAX;
+};
+
+// Sub-allocates buffers and images from a few large VkDeviceMemory blocks per memory type
+// (first fit over a free list, neighbouring free ranges are merged again on Free)
+class GpuAllocator {
+public:
+    static GpuAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, GpuResourceKind kind);
+    static void Free(GpuAllocation& allocation);
+    static void Cleanup();
+
+    // Bytes of VkDeviceMemory allocated from the driver vs. bytes handed out to resources
+    static VkDeviceSize GetCommittedSize();
+    static VkDeviceSize GetUsedSize();
+    static void LogUsage();
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;     // VK_NULL_HANDLE for released blocks
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        uint32_t memoryType = 0;
+        GpuResourceKind kind = GpuResourceKind::Buffer;
+        bool dedicated = false;
+        void* mapped = nullptr;
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;   // offset -> size
+    };
+
+    static uint32_t CreateBlock(VkDeviceSize size, uint32_t memoryType, VkMemoryPropertyFlags properties, GpuResourceKind kind, bool dedicated);
+    static bool AllocateFromBlock(uint32_t blockIndex, const VkMemoryRequirements& requirements, GpuAllocation& allocation);
+    static void ReleaseBlock(uint32_t blockIndex);
+
+    inline static std::vector<Block> s_Blocks;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "ImGuiLayer.h"
 #include "VulkanContext.h"
 #include "Swapchain.h"
+#include "PipelineCache.h"
 #include "common/Window.h"
 #include "common/Log.h"
 
@@ -50,6 +51,7 @@ void ImGuiLayer::Init() {
     initInfo.QueueFamily = VulkanContext::GetQueueFamilyIndex();
     initInfo.Queue = VulkanContext::GetGraphicsQueue();
     initInfo.DescriptorPool = descriptorPool;
+    initInfo.PipelineCache = PipelineCache::Get();
     initInfo.MinImageCount = Swapchain::GetImageCount();
     initInfo.ImageCount = Swapchain::GetImageCount();
     initInfo.PipelineInfoMain.RenderPass = renderPass;
@@ -0,0 +1,167 @@
+#include "KernelTuner.h"
+#include "VulkanContext.h"
+#include "ComputePipeline.h"
+#include "Renderer.h"
+#include "TileScheduler.h"
+#include "common/Log.h"
+#include "common/Params.h"
+#include "common/AtomicFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+// Single sample frames per candidate after an untimed warm-up, the fastest one counts
+static constexpr uint32_t AUTOTUNE_RUNS = 3;
+
+static bool IsPowerOfTwo(uint32_t value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+std::string KernelConfig::ToString() const {
+    return std::to_string(workgroupWidth) + "x" + std::to_string(workgroupHeight) + (mortonOrder ? " morton" : "") +
+        ", stack " + std::to_string(maxStack);
+}
+
+void KernelTuner::Init() {
+    KernelConfig config;
+    if (LoadFromCache(config)) {
+        RT_INFO("Using the tuned raytracing kernel {0}", config.ToString());
+    }
+
+    if (Params::s_WorkgroupWidth > 0) {
+        config.workgroupWidth = Params::s_WorkgroupWidth;
+        config.workgroupHeight = Params::s_WorkgroupHeight;
+        config.mortonOrder = false;
+    }
+    if (Params::s_MortonOrder) {
+        config.mortonOrder = true;
+    }
+    if (Params::s_MaxStack > 0) {
+        config.maxStack = Params::s_MaxStack;
+    }
+
+    if (!IsValid(config)) {
+        RT_WARN("Raytracing kernel {0} is not supported by this device, using {1}", config.ToString(), KernelConfig().ToString());
+        config = KernelConfig();
+    }
+    s_Config = config;
+}
+
+bool KernelTuner::IsValid(const KernelConfig& config) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    const VkPhysicalDeviceLimits& limits = properties.limits;
+
+    if (config.workgroupWidth == 0 || config.workgroupHeight == 0 || config.maxStack < KERNEL_MIN_STACK) {
+        return false;
+    }
+    if (config.workgroupWidth > limits.maxComputeWorkGroupSize[0] || config.workgroupHeight > limits.maxComputeWorkGroupSize[1] ||
+        config.GetInvocations() > limits.maxComputeWorkGroupInvocations) {
+        return false;
+    }
+    // Tiles have to cover whole workgroups, otherwise the dispatches of a pass overlap
+    if (TILE_ROW_ALIGNMENT % config.workgroupHeight != 0) {
+        return false;
+    }
+    if (Params::s_SortedShading && limits.maxComputeSharedMemorySize < SORTED_SHADING_SHARED_MEMORY(config.GetInvocations())) {
+        return false;
+    }
+    // The Morton curve alternates x and y bits, starting with x
+    if (config.mortonOrder) {
+        const bool shape = config.workgroupWidth == config.workgroupHeight || config.workgroupWidth == 2 * config.workgroupHeight;
+        return shape && IsPowerOfTwo(config.workgroupWidth) && IsPowerOfTwo(config.workgroupHeight);
+    }
+    return true;
+}
+
+void KernelTuner::AutoTune() {
+    // The candidates only change the single raytracing kernel
+    const bool wavefront = Params::s_Wavefront;
+    Params::s_Wavefront = false;
+
+    const KernelConfig shapes[] = {
+        { 16, 16, false }, { 16, 8, false }, { 8, 8, false }, { 8, 4, false }, { 32, 1, false },
+        { 16, 16, true }, { 8, 8, true }, { 8, 4, true },
+    };
+    const uint32_t stacks[] = { KERNEL_MIN_STACK, 64, KERNEL_DEFAULT_STACK };
+
+    KernelConfig best = s_Config;
+    double bestTime = Measure(best);
+    RT_INFO("Autotune {0}: {1:.2f} ms", best.ToString(), bestTime);
+    auto tryCandidate = [&](const KernelConfig& candidate) {
+        if (!IsValid(candidate)) {
+            return;
+        }
+        const double time = Measure(candidate);
+        RT_INFO("Autotune {0}: {1:.2f} ms", candidate.ToString(), time);
+        if (time < bestTime) {
+            best = candidate;
+            bestTime = time;
+        }
+    };
+
+    // The workgroup shape first, then the stack depth for the winning shape
+    for (KernelConfig shape : shapes) {
+        shape.maxStack = best.maxStack;
+        tryCandidate(shape);
+    }
+    const KernelConfig bestShape = best;
+    for (uint32_t stack : stacks) {
+        KernelConfig candidate = bestShape;
+        candidate.maxStack = stack;
+        if (stack != bestShape.maxStack) {
+            tryCandidate(candidate);
+        }
+    }
+
+    RT_INFO("Autotune picked the raytracing kernel {0} ({1:.2f} ms)", best.ToString(), bestTime);
+    s_Config = best;
+    ComputePipeline::RecreatePipeline();
+    SaveToCache(best);
+    Params::s_Wavefront = wavefront;
+}
+
+double KernelTuner::Measure(const KernelConfig& config) {
+    s_Config = config;
+    ComputePipeline::RecreatePipeline();
+
+    Renderer::MeasureTracing();
+    double best = 0.0;
+    for (uint32_t run = 0; run < AUTOTUNE_RUNS; run++) {
+        const double time = Renderer::MeasureTracing();
+        best = (run == 0) ? time : std::min(best, time);
+    }
+    return best;
+}
+
+std::string KernelTuner::GetCacheFilename() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    char name[64];
+    snprintf(name, sizeof(name), "%08x_%08x_%08x.txt", properties.vendorID, properties.deviceID, properties.driverVersion);
+    return std::string(Params::KERNEL_TUNING_CACHE_DIRECTORY) + "/" + name;
+}
+
+bool KernelTuner::LoadFromCache(KernelConfig& config) {
+    std::ifstream file(GetCacheFilename());
+    if (!file.is_open()) {
+        return false;
+    }
+
+    KernelConfig cached;
+    uint32_t mortonOrder = 0;
+    file >> cached.workgroupWidth >> cached.workgroupHeight >> mortonOrder >> cached.maxStack;
+    cached.mortonOrder = mortonOrder != 0;
+    if (!file || !IsValid(cached)) {
+        RT_WARN("Kernel tuning cache {0} is invalid, ignoring it", GetCacheFilename());
+        return false;
+    }
+    config = cached;
+    return true;
+}
+
+void KernelTuner::SaveToCache(const KernelConfig& config) {
+    WriteFileAtomically(GetCacheFilename(), [&](std::ostream& file) {
+        file << config.workgroupWidth << " " << config.workgroupHeight << " " << (config.mortonOrder ? 1 : 0) << " " << config.maxStack << "\n";
+    });
+}
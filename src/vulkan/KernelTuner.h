@@ -0,0 +1,48 @@
+#ifndef KERNEL_TUNER_H
+#define KERNEL_TUNER_H
+
+#include <cstdint>
+#include <string>
+
+// Traversal stack entries the kd-tree needs at least: depth first traversal keeps at most one
+// entry per level, KDTree::BuildTree stops at 20 levels
+#define KERNEL_MIN_STACK 32
+#define KERNEL_DEFAULT_STACK 128
+
+// Specialization constants of Raytracer.comp.glsl that only change its speed
+struct KernelConfig {
+    uint32_t workgroupWidth = 16;
+    uint32_t workgroupHeight = 16;
+    // Invocations walk the pixels of their workgroup along a Morton curve instead of row by row,
+    // the block has to be square or twice as wide as high
+    bool mortonOrder = false;
+    uint32_t maxStack = KERNEL_DEFAULT_STACK;   // kd-tree traversal stack entries (MAX_STACK)
+
+    uint32_t GetInvocations() const { return workgroupWidth * workgroupHeight; }
+    std::string ToString() const;
+};
+
+// Picks the KernelConfig of the device: the command line (--workgroup-size, --morton-order,
+// --max-stack) wins over the result of the last --autotune on this device, which wins over the
+// defaults. Autotune results are cached per device and driver in Params::KERNEL_TUNING_CACHE_DIRECTORY
+class KernelTuner {
+public:
+    // Has to run before ComputePipeline::Init
+    static void Init();
+    // Renders the loaded scene with every candidate, keeps and caches the fastest configuration
+    static void AutoTune();
+
+    static const KernelConfig& GetConfig() { return s_Config; }
+    static bool IsValid(const KernelConfig& config);
+
+private:
+    static std::string GetCacheFilename();
+    static bool LoadFromCache(KernelConfig& config);
+    static void SaveToCache(const KernelConfig& config);
+    // Best of a few single sample frames in milliseconds, the pipeline is rebuilt for config first
+    static double Measure(const KernelConfig& config);
+
+    inline static KernelConfig s_Config;
+};
+
+#endif
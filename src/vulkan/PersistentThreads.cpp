@@ -0,0 +1,48 @@
+#include "PersistentThreads.h"
+#include "VulkanContext.h"
+#include "Buffer.h"
+#include "KernelTuner.h"
+#include "common/Log.h"
+#include "common/Params.h"
+#include <algorithm>
+
+void PersistentThreads::Init(uint32_t slotCount) {
+    // The megakernel always declares the binding, so the buffer exists even with persistent threads off
+    s_CounterSSBO = SSBO::Create(PERSISTENT_THREADS_BINDING, sizeof(uint32_t) * slotCount);
+
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(VulkanContext::GetPhysicalDevice(), &properties);
+
+    const VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
+    s_Supported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) && (subgroupProperties.supportedOperations & required) == required;
+    if (Params::s_PersistentThreads && !s_Supported) {
+        RT_WARN("Device lacks the subgroup operations for --persistent-threads, persistent threads are disabled");
+        Params::s_PersistentThreads = false;
+    }
+}
+
+void PersistentThreads::Cleanup() {
+    // Destroyed with all other buffers by Buffer::DestroyAllBuffers
+    s_CounterSSBO.reset();
+}
+
+void PersistentThreads::Reset(VkCommandBuffer cmd, uint32_t slot) {
+    if (!Params::s_PersistentThreads) {
+        return;
+    }
+    vkCmdFillBuffer(cmd, s_CounterSSBO->GetBuffer(), slot * sizeof(uint32_t), sizeof(uint32_t), 0);
+
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+uint32_t PersistentThreads::GetWorkgroupCount(uint32_t width, uint32_t rowCount) {
+    // More workgroups than workgroup sized blocks of pixels would only find the counter exhausted
+    const KernelConfig& config = KernelTuner::GetConfig();
+    const uint32_t blocks = ((width + config.workgroupWidth - 1) / config.workgroupWidth) * ((rowCount + config.workgroupHeight - 1) / config.workgroupHeight);
+    return std::max(1u, std::min(blocks, uint32_t(PERSISTENT_THREADS_INVOCATIONS) / config.GetInvocations()));
+}
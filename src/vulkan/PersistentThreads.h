@@ -0,0 +1,36 @@
+#ifndef PERSISTENT_THREADS_H
+#define PERSISTENT_THREADS_H
+
+#include <vulkan/vulkan.h>
+#include <memory>
+
+#define PERSISTENT_THREADS_BINDING 64
+// Invocations of a persistent dispatch, enough to keep every compute unit of current GPUs busy.
+// Vulkan has no portable way to query the number of compute units
+#define PERSISTENT_THREADS_INVOCATIONS (512 * 256)
+
+class SSBO;
+
+// Persistent threads for Raytracer.comp.glsl (Params::s_PersistentThreads): instead of one
+// invocation per pixel, a fixed number of workgroups loops until the pixels of the dispatch are
+// exhausted. Every subgroup takes the next batch of pixels from an atomic counter, so subgroups
+// whose paths ended early pick up more work instead of idling next to long refractive paths.
+// Every submission slot has its own counter
+class PersistentThreads {
+public:
+    // Has to run before ComputePipeline::Init, disables Params::s_PersistentThreads without subgroup ballot
+    static void Init(uint32_t slotCount);
+    static void Cleanup();
+    static bool IsSupported() { return s_Supported; }
+
+    // Zeroes the work counter of slot before the dispatch recorded into cmd
+    static void Reset(VkCommandBuffer cmd, uint32_t slot);
+    // Workgroups a persistent dispatch over rowCount full width rows launches
+    static uint32_t GetWorkgroupCount(uint32_t width, uint32_t rowCount);
+
+private:
+    inline static std::shared_ptr<SSBO> s_CounterSSBO;
+    inline static bool s_Supported = false;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "PipelineCache.h"
+#include "VulkanContext.h"
+#include "common/Log.h"
+#include "common/Params.h"
+#include "common/AtomicFile.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Only hands data to the driver whose header matches this device, some drivers do not validate it
+static bool IsCompatible(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+        std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Init() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+
+    std::vector<char> data;
+    const std::string filename = GetCacheFilename();
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (file.is_open()) {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        if (!file || !IsCompatible(data, properties)) {
+            RT_WARN("Pipeline cache {0} does not match this device, starting with an empty cache", filename);
+            data.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+    if (vkCreatePipelineCache(VulkanContext::GetDevice(), &info, nullptr, &s_Cache) != VK_SUCCESS) {
+        RT_WARN("Failed to create the pipeline cache, pipelines are compiled on every launch");
+        s_Cache = VK_NULL_HANDLE;
+    }
+}
+
+void PipelineCache::Cleanup() {
+    if (s_Cache == VK_NULL_HANDLE) {
+        return;
+    }
+    Save();
+    vkDestroyPipelineCache(VulkanContext::GetDevice(), s_Cache, nullptr);
+    s_Cache = VK_NULL_HANDLE;
+}
+
+void PipelineCache::Save() {
+    if (s_Cache == VK_NULL_HANDLE) {
+        return;
+    }
+    size_t size = 0;
+    vkGetPipelineCacheData(VulkanContext::GetDevice(), s_Cache, &size, nullptr);
+    std::vector<char> data(size);
+    if (size == 0 || vkGetPipelineCacheData(VulkanContext::GetDevice(), s_Cache, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    WriteFileAtomically(GetCacheFilename(), [&](std::ostream& file) {
+        file.write(data.data(), size);
+    });
+}
+
+std::string PipelineCache::GetCacheFilename() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    std::string name;
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        char digits[3];
+        snprintf(digits, sizeof(digits), "%02x", properties.pipelineCacheUUID[i]);
+        name += digits;
+    }
+    char driver[32];
+    snprintf(driver, sizeof(driver), "_%08x.bin", properties.driverVersion);
+    return std::string(Params::PIPELINE_CACHE_DIRECTORY) + "/" + name + driver;
+}
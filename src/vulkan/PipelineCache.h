@@ -0,0 +1,26 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+#include <string>
+
+// Driver side pipeline cache shared by all compute pipelines, so relaunches, RecreatePipeline and
+// shader reloads of unchanged SPIR-V skip the driver compilation. Loaded from and saved to
+// Params::PIPELINE_CACHE_DIRECTORY, one file per pipelineCacheUUID (device and driver version)
+class PipelineCache {
+public:
+    // Has to run after VulkanContext::Init and before the first pipeline is created
+    static void Init();
+    // Saves the cache and destroys it
+    static void Cleanup();
+    static void Save();
+
+    static VkPipelineCache Get() { return s_Cache; }
+
+private:
+    static std::string GetCacheFilename();
+
+    inline static VkPipelineCache s_Cache = VK_NULL_HANDLE;
+};
+
+#endif
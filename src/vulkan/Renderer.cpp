@@ -5,18 +5,35 @@
 #include "ComputePipeline.h"
 #include "ImGuiLayer.h"
 #include "Buffer.h"
+#include "StagingRing.h"
+#include "GpuAllocator.h"
 #include "Texture.h"
 #include "Brdf.h"
+#include "EnvironmentMap.h"
+#include "TileScheduler.h"
+#include "WavefrontPipeline.h"
+#include "ShadingStats.h"
+#include "PersistentThreads.h"
+#include "KernelTuner.h"
+#include "PipelineCache.h"
 #include "scene/Scene.h"
 #include "common/Log.h"
 #include "common/Params.h"
 #include "common/Window.h"
 #include <GLFW/glfw3.h>
+#include <cstring>
+#include <chrono>
 
 extern UBO uniformBufferData;
 
+// Uniform data the current interactive pass started with, except for the per-frame fields
+static UBO s_PassSettings;
+static uint32_t s_PassSampleIndex = 0;
+
 void Renderer::Init() {
     VulkanContext::Init();
+    PipelineCache::Init();
+    StagingRing::Init();
 
     if (Params::IsInteractiveMode()) {
         Swapchain::Init();
@@ -26,36 +43,55 @@ void Renderer::Init() {
     Scene::CreateGPUBuffers();
     Texture::CreateGPUBuffers();
     Brdf::CreateGPUBuffers();
+    EnvironmentMap::CreateGPUBuffers();
+    // One timestamp, stats and work counter slot per command buffer that can be in flight
+    const uint32_t slotCount = Params::IsInteractiveMode() ? Params::GetFramesInFlight() : HEADLESS_SUBMITS_IN_FLIGHT;
+    KernelTuner::Init();
+    ShadingStats::Init(slotCount);
+    PersistentThreads::Init(slotCount);
+    const bool wavefront = Params::s_Wavefront || Params::s_BenchmarkRenderRuns > 0;
+    if (wavefront) {
+        WavefrontPipeline::CreateGPUBuffers();
+    }
     ComputePipeline::Init();
+    if (wavefront) {
+        WavefrontPipeline::Init();
+    }
+    TileScheduler::Init(slotCount);
 
     if (Params::IsInteractiveMode()) {
         CreateSyncObjects();
         CreateCommandBuffers();
         ImGuiLayer::Init();
     } else {
-        CreateHeadlessCommandBuffer();
-        RecordHeadlessCommandBuffer();
+        CreateHeadlessResources();
     }
 }
 
 void Renderer::Cleanup() {
     VulkanContext::DeviceWaitIdle();
 
+    StagingRing::Cleanup();
     Buffer::DestroyAllBuffers();
+    Texture::Cleanup();
 
     if (Params::IsInteractiveMode()) {
         ImGuiLayer::Cleanup();
-        vkDestroySemaphore(VulkanContext::GetDevice(), imageAvailableSemaphore, nullptr);
-        vkDestroySemaphore(VulkanContext::GetDevice(), renderingFinishedSemaphore, nullptr);
-        vkDestroyFence(VulkanContext::GetDevice(), inFlightFence, nullptr);
+        DestroySyncObjects();
         FreeCommandBuffers();
         Swapchain::Cleanup();
     } else {
-        vkFreeCommandBuffers(VulkanContext::GetDevice(), VulkanContext::GetCommandPool(), 1, &headlessCommandBuffer);
+        DestroyHeadlessResources();
     }
 
+    TileScheduler::Cleanup();
+    ShadingStats::Cleanup();
+    PersistentThreads::Cleanup();
+    WavefrontPipeline::Cleanup();
     ComputePipeline::Cleanup();
+    PipelineCache::Cleanup();
     OffscreenResources::Cleanup();
+    GpuAllocator::Cleanup();
     VulkanContext::Cleanup();
 }
 
@@ -63,12 +99,13 @@ void Renderer::OnWindowSizeChanged() {
     RT_ASSERT(Params::IsInteractiveMode(), "OnWindowSizeChanged can only be called in interactive mode");
     VulkanContext::DeviceWaitIdle();
 
+    // The compute pipeline and the result image only depend on the render resolution, not the window
     Swapchain::Recreate();
     ImGuiLayer::OnWindowResize();
-    ComputePipeline::RecreatePipeline();
 
-    FreeCommandBuffers();
-    CreateCommandBuffers();
+    // The swapchain image count may have changed and an acquire may have been left unwaited
+    DestroySyncObjects();
+    CreateSyncObjects();
 }
 
 void Renderer::OnRenderResolutionChanged() {
@@ -85,15 +122,41 @@ void Renderer::OnShaderReloaded() {
 
     VulkanContext::DeviceWaitIdle();
     ComputePipeline::RecreatePipeline();
+    WavefrontPipeline::RecreatePipelines();
     uniformBufferData.u_SampleIndex = 0;
 }
 
-void Renderer::Draw() {
-    if (!Params::IsInteractiveMode()) {
-        DrawHeadless();
+void Renderer::OnTexturesChanged(const std::vector<uint32_t>& slots) {
+    if (ComputePipeline::GetDescriptorSet() == VK_NULL_HANDLE) {
+        // Written by ComputePipeline::Init
+        return;
+    }
+
+    // Command buffers are recorded right before their submit, so they pick up the new descriptors
+    VulkanContext::DeviceWaitIdle();
+    ComputePipeline::UpdateTextureDescriptors(slots);
+}
+
+void Renderer::OnBuffersResized() {
+    if (ComputePipeline::GetDescriptorSet() == VK_NULL_HANDLE) {
+        // Written by ComputePipeline::Init
         return;
     }
 
+    VulkanContext::DeviceWaitIdle();
+    ComputePipeline::UpdateDescriptorSets();
+}
+
+uint32_t Renderer::GetFrameCopies() {
+    // Headless renders write the uniform buffer once and every submission reads the same copy
+    return Params::IsInteractiveMode() ? Params::GetFramesInFlight() + 1 : 1;
+}
+
+void Renderer::Draw() {
+    RT_ASSERT(Params::IsInteractiveMode(), "Draw can only be called in interactive mode, headless renders use SubmitHeadlessSamples");
+    // Scene data written since the last frame has to reach the device local buffers first
+    StagingRing::Flush();
+
     // Check if window was resized (some drivers don't return VK_ERROR_OUT_OF_DATE_KHR reliably)
     Window* window = Window::GetInstance();
     if (window->WasWindowResized()) {
@@ -108,10 +171,15 @@ void Renderer::Draw() {
         return;
     }
 
-    vkWaitForFences(VulkanContext::GetDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+    // Only blocks once the GPU is Params::GetFramesInFlight() frames behind
+    const uint32_t frameIndex = currentFrame;
+    FrameData& frame = frames[frameIndex];
+    vkWaitForFences(VulkanContext::GetDevice(), 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+    TileScheduler::CollectTimestamps(frameIndex);
+    ShadingStats::Collect(frameIndex);
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(VulkanContext::GetDevice(), Swapchain::GetHandle(), UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    VkResult result = vkAcquireNextImageKHR(VulkanContext::GetDevice(), Swapchain::GetHandle(), UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         OnWindowSizeChanged();
@@ -121,25 +189,45 @@ void Renderer::Draw() {
         return;
     }
 
-    vkResetFences(VulkanContext::GetDevice(), 1, &inFlightFence);
+    vkResetFences(VulkanContext::GetDevice(), 1, &frame.inFlightFence);
+
+    // A reset accumulation (camera, settings, scene or resolution changed) restarts the pass over the tiles.
+    // The per-frame fields are masked out before comparing the uniform data
+    UBO settings;
+    std::memcpy(&settings, &uniformBufferData, sizeof(UBO));
+    settings.u_SampleIndex = 0;
+    settings.u_Seed = 0.0f;
+    if (uniformBufferData.u_SampleIndex != s_PassSampleIndex || std::memcmp(&settings, &s_PassSettings, sizeof(UBO)) != 0) {
+        TileScheduler::RestartPass();
+        std::memcpy(&s_PassSettings, &settings, sizeof(UBO));
+    }
+
+    // Heavy scenes only trace part of the image per frame, the blit shows the pass in progress
+    const Tile tile = TileScheduler::NextTile(1, TILE_INTERACTIVE_BUDGET_MS);
+    if (tile.lastInPass) {
+        uniformBufferData.u_SampleIndex++;
+    }
+    s_PassSampleIndex = uniformBufferData.u_SampleIndex;
 
     // Reset and record command buffer for this frame (dynamic recording for ImGui)
-    vkResetCommandBuffer(commandBuffers[imageIndex], 0);
-    RecordCommandBuffer(imageIndex);
+    vkResetCommandBuffer(frame.commandBuffer, 0);
+    RecordCommandBuffer(frame.commandBuffer, imageIndex, frameIndex, tile);
 
+    // The swapchain image is first touched by the clear/blit, so the dispatch may start before it was acquired
     VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    VkSemaphore waitSems[] = { imageAvailableSemaphore };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    VkSemaphore waitSems[] = { frame.imageAvailableSemaphore };
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_TRANSFER_BIT };
     submit.waitSemaphoreCount = 1;
     submit.pWaitSemaphores = waitSems;
     submit.pWaitDstStageMask = waitStages;
     submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &commandBuffers[imageIndex];
-    VkSemaphore sigSems[] = { renderingFinishedSemaphore };
+    submit.pCommandBuffers = &frame.commandBuffer;
+    VkSemaphore sigSems[] = { renderingFinishedSemaphores[imageIndex] };
     submit.signalSemaphoreCount = 1;
     submit.pSignalSemaphores = sigSems;
 
-    vkQueueSubmit(VulkanContext::GetGraphicsQueue(), 1, &submit, inFlightFence);
+    vkQueueSubmit(VulkanContext::GetGraphicsQueue(), 1, &submit, frame.inFlightFence);
+    currentFrame = (currentFrame + 1) % frames.size();
 
     VkPresentInfoKHR present = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
     present.waitSemaphoreCount = 1;
@@ -156,50 +244,143 @@ void Renderer::Draw() {
     }
 }
 
-void Renderer::DrawHeadless() {
-    VkSubmitInfo submit{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &headlessCommandBuffer;
+void Renderer::SubmitHeadlessSamples(uint32_t sampleOffset, uint32_t sampleCount) {
+    RT_ASSERT(!Params::IsInteractiveMode(), "SubmitHeadlessSamples can only be called in headless mode");
+    StagingRing::Flush();
+
+    // One submit per tile, so no single submit exceeds TILE_HEADLESS_BUDGET_MS of GPU time
+    TileScheduler::RestartPass();
+    Tile tile;
+    do {
+        tile = TileScheduler::NextTile(sampleCount, TILE_HEADLESS_BUDGET_MS);
+
+        // Reuse the command buffer once its previous submission finished
+        const uint32_t slot = headlessSubmitIndex;
+        headlessSubmitIndex = (headlessSubmitIndex + 1) % HEADLESS_SUBMITS_IN_FLIGHT;
+        VkSemaphoreWaitInfo waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &headlessTimeline;
+        waitInfo.pValues = &headlessSignalValues[slot];
+        vkWaitSemaphores(VulkanContext::GetDevice(), &waitInfo, UINT64_MAX);
+        TileScheduler::CollectTimestamps(slot);
+        ShadingStats::Collect(slot);
+
+        ComputePushConstants pushConstants;
+        pushConstants.sampleOffset = sampleOffset;
+        pushConstants.sampleCount = sampleCount;
+        pushConstants.tileOffsetY = tile.firstRow;
+        const uint64_t pixelSamples = uint64_t(OffscreenResources::GetWidth()) * tile.rowCount * sampleCount;
+        vkResetCommandBuffer(headlessCommandBuffers[slot], 0);
+        RecordHeadlessCommandBuffer(headlessCommandBuffers[slot], slot, pushConstants, tile, pixelSamples);
+
+        headlessSubmittedPixelSamples += pixelSamples;
+        headlessSignalValues[slot] = headlessSubmittedPixelSamples;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &headlessSignalValues[slot];
+
+        VkSubmitInfo submit{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        submit.pNext = &timelineInfo;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &headlessCommandBuffers[slot];
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &headlessTimeline;
+
+        vkQueueSubmit(VulkanContext::GetGraphicsQueue(), 1, &submit, VK_NULL_HANDLE);
+    } while (!tile.lastInPass);
+}
 
-    vkQueueSubmit(VulkanContext::GetGraphicsQueue(), 1, &submit, VK_NULL_HANDLE);
+uint64_t Renderer::GetCompletedHeadlessSamples() {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(VulkanContext::GetDevice(), headlessTimeline, &value);
+    return value / (uint64_t(OffscreenResources::GetWidth()) * OffscreenResources::GetHeight());
+}
 
-    vkQueueWaitIdle(VulkanContext::GetGraphicsQueue());
+void Renderer::WaitForHeadlessSamples() {
+    VkSemaphoreWaitInfo waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &headlessTimeline;
+    waitInfo.pValues = &headlessSubmittedPixelSamples;
+    vkWaitSemaphores(VulkanContext::GetDevice(), &waitInfo, UINT64_MAX);
+    for (uint32_t slot = 0; slot < HEADLESS_SUBMITS_IN_FLIGHT; slot++) {
+        ShadingStats::Collect(slot);
+    }
 }
 
 void Renderer::CreateSyncObjects() {
+    frames.resize(Params::GetFramesInFlight());
+    currentFrame = 0;
+
     VkSemaphoreCreateInfo semInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-    vkCreateSemaphore(VulkanContext::GetDevice(), &semInfo, nullptr, &imageAvailableSemaphore);
-    vkCreateSemaphore(VulkanContext::GetDevice(), &semInfo, nullptr, &renderingFinishedSemaphore);
     VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, VK_FENCE_CREATE_SIGNALED_BIT };
-    vkCreateFence(VulkanContext::GetDevice(), &fenceInfo, nullptr, &inFlightFence);
+    for (FrameData& frame : frames) {
+        vkCreateSemaphore(VulkanContext::GetDevice(), &semInfo, nullptr, &frame.imageAvailableSemaphore);
+        vkCreateFence(VulkanContext::GetDevice(), &fenceInfo, nullptr, &frame.inFlightFence);
+    }
+
+    renderingFinishedSemaphores.resize(Swapchain::GetImages().size());
+    for (VkSemaphore& semaphore : renderingFinishedSemaphores) {
+        vkCreateSemaphore(VulkanContext::GetDevice(), &semInfo, nullptr, &semaphore);
+    }
+}
+
+void Renderer::DestroySyncObjects() {
+    for (FrameData& frame : frames) {
+        vkDestroySemaphore(VulkanContext::GetDevice(), frame.imageAvailableSemaphore, nullptr);
+        vkDestroyFence(VulkanContext::GetDevice(), frame.inFlightFence, nullptr);
+        frame.imageAvailableSemaphore = VK_NULL_HANDLE;
+        frame.inFlightFence = VK_NULL_HANDLE;
+    }
+    for (VkSemaphore semaphore : renderingFinishedSemaphores) {
+        vkDestroySemaphore(VulkanContext::GetDevice(), semaphore, nullptr);
+    }
+    renderingFinishedSemaphores.clear();
 }
 
 void Renderer::CreateCommandBuffers() {
-    commandBuffers.resize(Swapchain::GetImages().size());
+    std::vector<VkCommandBuffer> commandBuffers(frames.size());
     VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
     allocInfo.commandPool = VulkanContext::GetCommandPool();
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
     vkAllocateCommandBuffers(VulkanContext::GetDevice(), &allocInfo, commandBuffers.data());
+    for (size_t i = 0; i < frames.size(); i++) {
+        frames[i].commandBuffer = commandBuffers[i];
+    }
 }
 
 void Renderer::FreeCommandBuffers() {
-    vkFreeCommandBuffers(VulkanContext::GetDevice(), VulkanContext::GetCommandPool(), (uint32_t)commandBuffers.size(), commandBuffers.data());
-    commandBuffers.clear();
+    for (FrameData& frame : frames) {
+        vkFreeCommandBuffers(VulkanContext::GetDevice(), VulkanContext::GetCommandPool(), 1, &frame.commandBuffer);
+        frame.commandBuffer = VK_NULL_HANDLE;
+    }
 }
 
-void Renderer::CreateHeadlessCommandBuffer() {
+void Renderer::CreateHeadlessResources() {
     VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
     allocInfo.commandPool = VulkanContext::GetCommandPool();
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
+    allocInfo.commandBufferCount = HEADLESS_SUBMITS_IN_FLIGHT;
+
+    vkAllocateCommandBuffers(VulkanContext::GetDevice(), &allocInfo, headlessCommandBuffers);
+
+    VkSemaphoreTypeCreateInfo typeInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    semInfo.pNext = &typeInfo;
+    vkCreateSemaphore(VulkanContext::GetDevice(), &semInfo, nullptr, &headlessTimeline);
+}
 
-    vkAllocateCommandBuffers(VulkanContext::GetDevice(), &allocInfo, &headlessCommandBuffer);
+void Renderer::DestroyHeadlessResources() {
+    vkFreeCommandBuffers(VulkanContext::GetDevice(), VulkanContext::GetCommandPool(), HEADLESS_SUBMITS_IN_FLIGHT, headlessCommandBuffers);
+    vkDestroySemaphore(VulkanContext::GetDevice(), headlessTimeline, nullptr);
+    headlessTimeline = VK_NULL_HANDLE;
 }
 
-void Renderer::RecordCommandBuffer(uint32_t imageIndex) {
+void Renderer::RecordCommandBuffer(VkCommandBuffer cmd, uint32_t imageIndex, uint32_t frameIndex, const Tile& tile) {
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-    VkCommandBuffer cmd = commandBuffers[imageIndex];
     vkBeginCommandBuffer(cmd, &beginInfo);
 
     // Get render and display dimensions
@@ -208,21 +389,22 @@ void Renderer::RecordCommandBuffer(uint32_t imageIndex) {
     uint32_t displayWidth = Swapchain::GetExtent().width;
     uint32_t displayHeight = Swapchain::GetExtent().height;
 
-    // Transition offscreen image to GENERAL for compute shader
+    // Transition offscreen image to GENERAL for compute shader. Frames in flight share the image,
+    // this orders the accumulation after the blit (and thereby the dispatch) of the previous frame
     VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
     barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
     barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
     barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
     barrier.image = OffscreenResources::GetImage();
     barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 
     // Dispatch ray tracing compute shader (use render resolution)
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline::GetPipeline());
-    VkDescriptorSet ds = ComputePipeline::GetDescriptorSet();
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline::GetLayout(), 0, 1, &ds, 0, nullptr);
-    vkCmdDispatch(cmd, (renderWidth + 15) / 16, (renderHeight + 15) / 16, 1);
+    // One sample per frame keeps the interactive view responsive
+    ComputePushConstants pushConstants;
+    pushConstants.tileOffsetY = tile.firstRow;
+    RecordTracing(cmd, frameIndex, pushConstants, tile.rowCount, uint64_t(renderWidth) * tile.rowCount);
 
     // Prepare for blit: offscreen -> TRANSFER_SRC, swapchain -> TRANSFER_DST
     VkImageMemoryBarrier barriers[2] = {};
@@ -242,7 +424,8 @@ void Renderer::RecordCommandBuffer(uint32_t imageIndex) {
     barriers[1].image = Swapchain::GetImages()[imageIndex];
     barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
 
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+    // The transfer stage is where the submit waits for the acquire, the swapchain transition has to come after it
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
 
     // Clear swapchain to black first (for letterboxing)
     VkClearColorValue clearColor = { { 0.0f, 0.0f, 0.0f, 1.0f } };
@@ -297,46 +480,60 @@ void Renderer::RecordCommandBuffer(uint32_t imageIndex) {
     vkEndCommandBuffer(cmd);
 }
 
-void Renderer::RecordHeadlessCommandBuffer() {
+void Renderer::RecordHeadlessCommandBuffer(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, const Tile& tile, uint64_t pixelSamples) {
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+    RecordOffscreenTracing(cmd, slot, pushConstants, tile.rowCount, pixelSamples);
+    vkEndCommandBuffer(cmd);
+}
 
-    vkBeginCommandBuffer(headlessCommandBuffer, &beginInfo);
+double Renderer::MeasureTracing() {
+    StagingRing::Flush();
+
+    // One submit per tile like SubmitHeadlessSamples, so slow candidates stay within TILE_HEADLESS_BUDGET_MS
+    TileScheduler::RestartPass();
+    double milliseconds = 0.0;
+    Tile tile;
+    do {
+        tile = TileScheduler::NextTile(1, TILE_HEADLESS_BUDGET_MS);
+        ComputePushConstants pushConstants;
+        pushConstants.sampleCount = 1;
+        pushConstants.tileOffsetY = tile.firstRow;
+        VkCommandBuffer cmd = VulkanContext::BeginSingleTimeCommands();
+        RecordOffscreenTracing(cmd, 0, pushConstants, tile.rowCount, uint64_t(OffscreenResources::GetWidth()) * tile.rowCount);
+
+        auto start = std::chrono::steady_clock::now();
+        VulkanContext::EndSingleTimeCommands(cmd);
+        milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // Slot 0 is idle, its results would otherwise be read by the next submission using it. The
+        // timestamps also size the next tile
+        TileScheduler::CollectTimestamps(0);
+        ShadingStats::Collect(0);
+    } while (!tile.lastInPass);
+    TileScheduler::RestartPass();
+    return milliseconds;
+}
 
+void Renderer::RecordOffscreenTracing(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, uint32_t rowCount, uint64_t pixelSamples) {
+    // Keeps the accumulated image, the previous submission left it in TRANSFER_SRC like OffscreenResources::Init
     VkImageMemoryBarrier toGeneral = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-    toGeneral.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toGeneral.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
     toGeneral.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    toGeneral.srcAccessMask = 0;
-    toGeneral.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    toGeneral.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toGeneral.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
     toGeneral.image = OffscreenResources::GetImage();
     toGeneral.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
 
     vkCmdPipelineBarrier(
-        headlessCommandBuffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         0, 0, nullptr, 0, nullptr, 1, &toGeneral
     );
 
-    vkCmdBindPipeline(
-        headlessCommandBuffer,
-        VK_PIPELINE_BIND_POINT_COMPUTE,
-        ComputePipeline::GetPipeline()
-    );
-
-    VkDescriptorSet ds = ComputePipeline::GetDescriptorSet();
-    vkCmdBindDescriptorSets(
-        headlessCommandBuffer,
-        VK_PIPELINE_BIND_POINT_COMPUTE,
-        ComputePipeline::GetLayout(),
-        0, 1, &ds, 0, nullptr
-    );
-
-    vkCmdDispatch(
-        headlessCommandBuffer,
-        (OffscreenResources::GetWidth() + 15) / 16,
-        (OffscreenResources::GetHeight() + 15) / 16,
-        1
-    );
+    RecordTracing(cmd, slot, pushConstants, rowCount, pixelSamples);
 
     VkImageMemoryBarrier toTransferSrc = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
     toTransferSrc.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -347,13 +544,40 @@ void Renderer::RecordHeadlessCommandBuffer() {
     toTransferSrc.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
 
     vkCmdPipelineBarrier(
-        headlessCommandBuffer,
+        cmd,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         VK_PIPELINE_STAGE_TRANSFER_BIT,
         0, 0, nullptr, 0, nullptr, 1, &toTransferSrc
     );
+}
+
+void Renderer::RecordTracing(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, uint32_t rowCount, uint64_t pixelSamples) {
+    if (Params::s_Wavefront) {
+        TileScheduler::WriteBeginTimestamp(cmd, slot);
+        WavefrontPipeline::Record(cmd, pushConstants, rowCount);
+    } else {
+        ShadingStats::Reset(cmd, slot);
+        PersistentThreads::Reset(cmd, slot);
+        TileScheduler::WriteBeginTimestamp(cmd, slot);
+        ComputePushConstants slotPushConstants = pushConstants;
+        slotPushConstants.slot = slot;
+        slotPushConstants.tileRows = rowCount;
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline::GetPipeline());
+        VkDescriptorSet ds = ComputePipeline::GetDescriptorSet();
+        std::vector<uint32_t> dynamicOffsets = ComputePipeline::GetDynamicOffsets();
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline::GetLayout(), 0, 1, &ds, (uint32_t)dynamicOffsets.size(), dynamicOffsets.data());
+        vkCmdPushConstants(cmd, ComputePipeline::GetLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(slotPushConstants), &slotPushConstants);
+        const KernelConfig& config = KernelTuner::GetConfig();
+        if (Params::s_PersistentThreads) {
+            vkCmdDispatch(cmd, PersistentThreads::GetWorkgroupCount(OffscreenResources::GetWidth(), rowCount), 1, 1);
+        } else {
+            const uint32_t groupsX = (OffscreenResources::GetWidth() + config.workgroupWidth - 1) / config.workgroupWidth;
+            const uint32_t groupsY = (rowCount + config.workgroupHeight - 1) / config.workgroupHeight;
+            vkCmdDispatch(cmd, groupsX, groupsY, 1);
+        }
+    }
 
-    vkEndCommandBuffer(headlessCommandBuffer);
+    TileScheduler::WriteEndTimestamp(cmd, slot, pixelSamples);
 }
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -372,29 +596,13 @@ void Renderer::SaveCurrentFrameToDisk(const std::string& filePath) {
 
     VkCommandBuffer cmd = VulkanContext::BeginSingleTimeCommands();
 
-    VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.image = image;
-    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
+    // Every frame leaves the image in TRANSFER_SRC and already made its shader writes visible to transfers
     VkBufferImageCopy region{};
     region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
     region.imageExtent = { width, height, 1 };
 
     vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
 
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
     VulkanContext::EndSingleTimeCommands(cmd);
 
     float* srcPixels = nullptr;
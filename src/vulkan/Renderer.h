@@ -4,32 +4,72 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <string>
+#include "ComputePipeline.h"
+#include "TileScheduler.h"
+
+// Headless command buffers that may be queued at the same time
+#define HEADLESS_SUBMITS_IN_FLIGHT 2
 
 class Renderer {
 public:
     static void Init();
     static void Cleanup();
+    // One interactive frame, headless renders go through SubmitHeadlessSamples
     static void Draw();
     static void OnWindowSizeChanged();
     static void OnRenderResolutionChanged();
     static void OnShaderReloaded();
+    static void OnTexturesChanged(const std::vector<uint32_t>& slots);
+    // Rewrites the buffer descriptors after Buffer::Resize replaced a VkBuffer
+    static void OnBuffersResized();
     static void SaveCurrentFrameToDisk(const std::string& filePath);
+    // Copies of per-frame data like the uniform buffer: one per frame in flight plus the one being written
+    static uint32_t GetFrameCopies();
+
+    // Queues sampleCount samples per pixel starting at u_SampleIndex + sampleOffset without waiting for them,
+    // split into tiles of one submit each (see TileScheduler).
+    // Only blocks while HEADLESS_SUBMITS_IN_FLIGHT submissions are pending, the uniform buffer must not change meanwhile
+    static void SubmitHeadlessSamples(uint32_t sampleOffset, uint32_t sampleCount);
+    // Samples of all SubmitHeadlessSamples calls the GPU has finished, read from a timeline semaphore
+    static uint64_t GetCompletedHeadlessSamples();
+    static void WaitForHeadlessSamples();
+    // Milliseconds one single sample frame of the loaded scene takes with the current pipeline, traced
+    // tile by tile and waiting for the GPU. Overwrites the result image, only meant to run before rendering starts
+    static double MeasureTracing();
 
 private:
     static void CreateSyncObjects();
+    static void DestroySyncObjects();
     static void CreateCommandBuffers();
-    static void RecordCommandBuffer(uint32_t imageIndex);
+    static void RecordCommandBuffer(VkCommandBuffer cmd, uint32_t imageIndex, uint32_t frameIndex, const Tile& tile);
     static void FreeCommandBuffers();
 
-    static void DrawHeadless();
-    static void CreateHeadlessCommandBuffer();
-    static void RecordHeadlessCommandBuffer();
+    static void CreateHeadlessResources();
+    static void DestroyHeadlessResources();
+    // Raytracing dispatch over rowCount rows at pushConstants.tileOffsetY, either the megakernel or the
+    // wavefront kernels (--wavefront), wrapped in the timestamps of slot. The megakernel uses the
+    // shading stats and work counter of slot as well
+    static void RecordTracing(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, uint32_t rowCount, uint64_t pixelSamples);
+    static void RecordHeadlessCommandBuffer(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, const Tile& tile, uint64_t pixelSamples);
+    // RecordTracing between the transitions of the result image from and back to TRANSFER_SRC
+    static void RecordOffscreenTracing(VkCommandBuffer cmd, uint32_t slot, const ComputePushConstants& pushConstants, uint32_t rowCount, uint64_t pixelSamples);
+
+    // Resources of one interactive frame, reused once its fence signaled
+    struct FrameData {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+        VkFence inFlightFence = VK_NULL_HANDLE;
+    };
 
-    inline static VkCommandBuffer headlessCommandBuffer = VK_NULL_HANDLE;
-    inline static std::vector<VkCommandBuffer> commandBuffers;
-    inline static VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
-    inline static VkSemaphore renderingFinishedSemaphore = VK_NULL_HANDLE;
-    inline static VkFence inFlightFence = VK_NULL_HANDLE;
+    inline static VkCommandBuffer headlessCommandBuffers[HEADLESS_SUBMITS_IN_FLIGHT] = {};
+    inline static uint64_t headlessSignalValues[HEADLESS_SUBMITS_IN_FLIGHT] = {};   // timeline value of the last submit per command buffer
+    inline static uint32_t headlessSubmitIndex = 0;
+    inline static VkSemaphore headlessTimeline = VK_NULL_HANDLE;    // counts the pixel samples finished on the GPU
+    inline static uint64_t headlessSubmittedPixelSamples = 0;
+    inline static std::vector<FrameData> frames;     // Params::GetFramesInFlight() entries
+    inline static uint32_t currentFrame = 0;
+    // One per swapchain image, the presentation engine holds it until the image is acquired again
+    inline static std::vector<VkSemaphore> renderingFinishedSemaphores;
 };
 
 #endif
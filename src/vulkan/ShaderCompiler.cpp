@@ -4,17 +4,172 @@
 
 #include "common/Subprocess.h"
 #include "common/Log.h"
+#include "common/ThreadPool.h"
+#include "common/AtomicFile.h"
 
 #include <fstream>
 #include <filesystem>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <set>
+#include <regex>
+#include <sstream>
+#include <cstdio>
 
-static void CheckGlslangValidatorExists() {
-    SubprocessResult result = RunCommand("glslangValidator --version");
-    if (result.exitCode != 0) {
-        RT_ERROR("glslangValidator not found. Please ensure it is installed and available in your PATH.");
-        exit(1);
+#ifdef RT_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+// Part of every cache key, the flags both compilers are called with
+static constexpr const char* SHADER_COMPILE_OPTIONS = "-V --target-env vulkan1.2 -IShaderCode/include";
+// Compiled binaries by cache key, ShaderCache/<name>.spv is a copy of the current one
+static constexpr const char* SHADER_OBJECT_DIRECTORY = "ShaderCache/objects";
+
+// FNV-1a, 64 bit
+static void HashBytes(uint64_t& hash, const void* data, size_t size) {
+    const byte* bytes = static_cast<const byte*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+static void HashString(uint64_t& hash, const std::string& str) {
+    HashBytes(hash, str.data(), str.size());
+    HashBytes(hash, "", 1);
+}
+
+static bool ReadTextFile(const std::filesystem::path& path, std::string& content) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Resolves #include like glslangValidator -IShaderCode/include: next to the including file first,
+// then in ShaderCode/include. Returns an empty path if neither exists
+static std::filesystem::path ResolveInclude(const std::filesystem::path& includingFile, const std::string& name) {
+    const std::filesystem::path candidates[] = { includingFile.parent_path() / name, std::filesystem::path("ShaderCode/include") / name };
+    for (const auto& candidate : candidates) {
+        if (std::filesystem::is_regular_file(candidate)) {
+            return candidate;
+        }
+    }
+    return {};
+}
+
+#ifdef RT_SHADERC
+class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface {
+public:
+    shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override {
+        auto* include = new IncludeData;
+        const std::filesystem::path path = ResolveInclude(requestingSource, requestedSource);
+        if (!path.empty() && ReadTextFile(path, include->content)) {
+            include->path = path.generic_string();
+        } else {
+            // An empty source name tells shaderc that the include failed, the content is the error
+            include->content = "Cannot find include file " + std::string(requestedSource);
+        }
+
+        auto* result = new shaderc_include_result;
+        result->source_name = include->path.c_str();
+        result->source_name_length = include->path.size();
+        result->content = include->content.c_str();
+        result->content_length = include->content.size();
+        result->user_data = include;
+        return result;
+    }
+
+    void ReleaseInclude(shaderc_include_result* result) override {
+        delete static_cast<IncludeData*>(result->user_data);
+        delete result;
     }
+
+private:
+    struct IncludeData {
+        std::string path;
+        std::string content;
+    };
+};
+
+// The stage comes from the extension before .glsl, like glslangValidator does it
+static bool GetShaderKind(const std::string& shaderPath, shaderc_shader_kind& kind) {
+    const std::string stage = std::filesystem::path(shaderPath).stem().extension().string();
+    if (stage == ".comp") kind = shaderc_compute_shader;
+    else if (stage == ".vert") kind = shaderc_vertex_shader;
+    else if (stage == ".frag") kind = shaderc_fragment_shader;
+    else return false;
+    return true;
+}
+
+// Part of every cache key, a compiler update recompiles all shaders
+static const std::string& GetCompilerIdentity() {
+    static const std::string identity = []() {
+        unsigned int version = 0, revision = 0;
+        shaderc_get_spv_version(&version, &revision);
+        return "shaderc spv " + std::to_string(version) + "." + std::to_string(revision);
+    }();
+    return identity;
+}
+#else
+// Part of every cache key, a compiler update recompiles all shaders. Checked once per run,
+// empty if glslangValidator is missing
+static const std::string& GetCompilerIdentity() {
+    static const std::string identity = []() {
+        SubprocessResult result = RunCommand("glslangValidator --version");
+        return (result.exitCode == 0) ? result.output : std::string();
+    }();
+    return identity;
+}
+#endif
+
+// Hashes the file and its #include closure, every file once in the order its first include appears
+static void HashSourceClosure(const std::filesystem::path& path, uint64_t& hash, std::set<std::string>& visited) {
+    const std::string key = std::filesystem::weakly_canonical(path).generic_string();
+    if (!visited.insert(key).second) {
+        return;
+    }
+    std::string content;
+    if (!ReadTextFile(path, content)) {
+        // Compiling reports the missing file, the name keeps the key distinct meanwhile
+        HashString(hash, "missing " + path.generic_string());
+        return;
+    }
+    HashString(hash, path.generic_string());
+    HashString(hash, content);
+
+    static const std::regex includePattern("^\\s*#\\s*include\\s*\"([^\"]+)\"");
+    std::istringstream lines(content);
+    std::string line;
+    std::smatch match;
+    while (std::getline(lines, line)) {
+        if (!std::regex_search(line, match, includePattern)) {
+            continue;
+        }
+        const std::string name = match[1].str();
+        const std::filesystem::path include = ResolveInclude(path, name);
+        if (include.empty()) {
+            HashString(hash, "missing " + name);
+        } else {
+            HashSourceClosure(include, hash, visited);
+        }
+    }
+}
+
+// Key of the compiled binary: the source with its include closure, the compiler and its options
+static std::string ComputeCacheKey(const std::string& shaderPath) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    HashString(hash, GetCompilerIdentity());
+    HashString(hash, SHADER_COMPILE_OPTIONS);
+    std::set<std::string> visited;
+    HashSourceClosure(shaderPath, hash, visited);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
 }
 
 std::filesystem::file_time_type GetFileModificationTime(const std::string& filePath) {
@@ -42,27 +197,6 @@ std::filesystem::file_time_type GetShaderSourceModificationTime() {
     return newest;
 }
 
-std::filesystem::file_time_type GetCompiledShaderModificationTime() {
-    try {
-        if (!std::filesystem::exists("ShaderCache")) {
-            return std::filesystem::file_time_type::min();
-        }
-    }
-    catch (const std::filesystem::filesystem_error& e) {
-        RT_ERROR("Failed to access ShaderCache directory: {0}", e.what());
-        return std::filesystem::file_time_type::min();
-    }
-
-    auto oldest = std::filesystem::file_time_type::max();
-    for (const auto& entry : std::filesystem::recursive_directory_iterator("ShaderCache")) {
-        if (entry.is_regular_file() && entry.path().extension() == ".spv") {
-            auto modTime = GetFileModificationTime(entry.path().string());
-            if (modTime < oldest) oldest = modTime;
-        }
-    }
-    return oldest;
-}
-
 void PreprocessShader(std::string& src) {
     // Simple include handling (no nested includes for simplicity)
     std::string includeDirective = "#include \"";
@@ -86,17 +220,51 @@ void PreprocessShader(std::string& src) {
     }
 }
 
-void ShaderCompiler::CompileShader(const std::string& shaderPath, const std::string& outputPath) {
-    RT_INFO("Compiling shader: {0}", shaderPath);
-    CheckGlslangValidatorExists();
+bool ShaderCompiler::CompileShader(const std::string& shaderPath, const std::string& outputPath) {
     std::filesystem::create_directories(std::filesystem::path(outputPath).parent_path());
-    SubprocessResult result = RunCommand("glslangValidator -V -IShaderCode/include " + shaderPath + " -o " + outputPath);
+#ifdef RT_SHADERC
+    shaderc_shader_kind kind;
+    if (!GetShaderKind(shaderPath, kind)) {
+        RT_ERROR("Cannot tell the shader stage of {0}, expected <name>.<comp|vert|frag>.glsl", shaderPath);
+        return false;
+    }
+    std::ifstream file(shaderPath);
+    if (!file.is_open()) {
+        RT_ERROR("Failed to open shader {0}", shaderPath);
+        return false;
+    }
+    const std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    shaderc::Compiler compiler;
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+    options.SetIncluder(std::make_unique<ShaderIncluder>());
+    shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, shaderPath.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        RT_ERROR("Failed to compile shader {0}: {1}", shaderPath, result.GetErrorMessage());
+        return false;
+    }
+
+    const std::vector<uint32_t> spirv(result.cbegin(), result.cend());
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+    if (!output.good()) {
+        RT_ERROR("Failed to write shader binary {0}", outputPath);
+        return false;
+    }
+    return true;
+#else
+    if (GetCompilerIdentity().empty()) {
+        RT_ERROR("glslangValidator not found. Please ensure it is installed and available in your PATH.");
+        return false;
+    }
+    SubprocessResult result = RunCommand("glslangValidator -V --target-env vulkan1.2 -IShaderCode/include " + shaderPath + " -o " + outputPath);
     if (result.exitCode != 0) {
         RT_ERROR("Failed to compile shader {0}: {1}", shaderPath, result.output);
-        exit(1);
-    } else {
-        RT_INFO("Compiled shader {0} to {1}", shaderPath, outputPath);
+        return false;
     }
+    return true;
+#endif
 }
 
 void ShaderCompiler::CompileAllShaders() {
@@ -105,8 +273,41 @@ void ShaderCompiler::CompileAllShaders() {
         return;
     }
 
+    // Hashing every source each frame is too slow for the hot reload polling, the keys are only
+    // computed again once any source was written. A touched file then still compiles nothing
+    static auto lastSourceTime = std::filesystem::file_time_type::min();
+    const auto sourceTime = GetShaderSourceModificationTime();
+    if (sourceTime == lastSourceTime) {
+        return;
+    }
+    lastSourceTime = sourceTime;
+
+    struct CacheEntry {
+        std::string shaderPath;
+        std::string outputPath;     // what ShaderBinary loads
+        std::string key;
+        std::string objectPath;     // the binary of key in SHADER_OBJECT_DIRECTORY
+    };
+    std::vector<CacheEntry> outdated;
+    for (const auto& entry : std::filesystem::directory_iterator("ShaderCode")) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".glsl") {
+            continue;
+        }
+        CacheEntry cacheEntry;
+        cacheEntry.shaderPath = entry.path().string();
+        cacheEntry.outputPath = "ShaderCache/" + std::filesystem::relative(entry.path(), "ShaderCode").string() + ".spv";
+        cacheEntry.key = ComputeCacheKey(cacheEntry.shaderPath);
+        cacheEntry.objectPath = std::string(SHADER_OBJECT_DIRECTORY) + "/" + cacheEntry.key + ".spv";
+
+        std::string storedKey;
+        if (std::filesystem::exists(cacheEntry.outputPath) && ReadTextFile(cacheEntry.outputPath + ".key", storedKey) && storedKey == cacheEntry.key) {
+            continue;
+        }
+        outdated.push_back(cacheEntry);
+    }
+
     static bool stopLogSpam = false;
-    if (GetCompiledShaderModificationTime() >= GetShaderSourceModificationTime()) {
+    if (outdated.empty()) {
         if (!stopLogSpam) {
             RT_INFO("All shaders are up to date. No compilation needed.");
         }
@@ -115,20 +316,62 @@ void ShaderCompiler::CompileAllShaders() {
     }
     stopLogSpam = false;
 
-    for (const auto& entry : std::filesystem::directory_iterator("ShaderCode")) {
-        if (entry.is_regular_file() && entry.path().extension() == ".glsl") {
-            std::string shaderPath = entry.path().string();
-            std::string relativePath = std::filesystem::relative(entry.path(), "ShaderCode").string();
-            std::string outputPath = "ShaderCache/" + relativePath + ".spv";
+    // Binaries of earlier sources (e.g. another branch) are still in the object cache. Everything
+    // else compiles in parallel into temporary files, the cache is only updated if all of them
+    // compiled. A broken edit thereby leaves the binaries of the running pipelines untouched
+    std::vector<const CacheEntry*> toCompile;
+    for (const CacheEntry& entry : outdated) {
+        if (!std::filesystem::exists(entry.objectPath)) {
+            toCompile.push_back(&entry);
+        }
+    }
+    // Other instances may compile the same sources at once, each compiles into its own temporary files
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> tempPaths(toCompile.size());
+    for (size_t i = 0; i < toCompile.size(); i++) {
+        tempPaths[i] = GetTemporaryFilename(toCompile[i]->objectPath);
+    }
+    std::vector<char> compiled(toCompile.size(), 0);
+    ThreadPool::Get().ParallelFor(static_cast<uint32_t>(toCompile.size()), [&](uint32_t i) {
+        compiled[i] = CompileShader(toCompile[i]->shaderPath, tempPaths[i]);
+    });
+    const bool success = std::all_of(compiled.begin(), compiled.end(), [](char c) { return c != 0; });
+
+    std::error_code error;
+    for (size_t i = 0; i < toCompile.size(); i++) {
+        if (success) {
+            std::filesystem::rename(tempPaths[i], toCompile[i]->objectPath, error);
+        } else {
+            std::filesystem::remove(tempPaths[i], error);
+        }
+    }
 
-            // Ensure output directory exists
-            std::filesystem::create_directories(std::filesystem::path(outputPath).parent_path());
+    const bool running = VulkanContext::GetDevice() != VK_NULL_HANDLE;
+    if (!success) {
+        if (!running) {
+            RT_ERROR("Shader compilation failed");
+            exit(1);
+        }
+        RT_ERROR("Shader compilation failed, keeping the previous shaders until the sources change again");
+        return;
+    }
 
-            CompileShader(shaderPath, outputPath);
+    // The binary first, a reader that sees the new binary with the old key only compiles it again
+    for (const CacheEntry& entry : outdated) {
+        const bool updated = WriteFileAtomically(entry.outputPath, [&](std::ostream& file) {
+            std::ifstream object(entry.objectPath, std::ios::binary);
+            file << object.rdbuf();
+        }) && WriteFileAtomically(entry.outputPath + ".key", [&](std::ostream& file) {
+            file << entry.key;
+        });
+        if (!updated) {
+            RT_ERROR("Failed to update shader binary {0}", entry.outputPath);
         }
     }
+    RT_INFO("Updated {0} shaders ({1} compiled) in {2:.0f} ms", outdated.size(), toCompile.size(),
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 
-    if (VulkanContext::GetDevice() != VK_NULL_HANDLE) {
+    if (running) {
         Renderer::OnShaderReloaded();
     }
 }
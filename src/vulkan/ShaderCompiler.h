@@ -16,9 +16,16 @@ private:
     byte* m_Data = nullptr;
 };
 
+// Compiles the shaders in ShaderCode to SPIR-V in ShaderCache, in process with shaderc if the build
+// found it (RT_SHADERC) and with glslangValidator otherwise
 class ShaderCompiler {
 public:
-    static void CompileShader(const std::string& shaderPath, const std::string& outputPath);
+    // Thread safe, logs the errors and returns false if the shader does not compile
+    static bool CompileShader(const std::string& shaderPath, const std::string& outputPath);
+    // Brings ShaderCache up to date and reloads the pipelines if any binary changed. Binaries are cached
+    // by the hash of their source with its #include closure, the compiler and its options, only
+    // shaders whose key has no binary yet compile (in parallel). At startup a failure is fatal,
+    // later the previous shaders and pipelines are kept
     static void CompileAllShaders();
 };
 
@@ -0,0 +1,70 @@
+#include "ShadingStats.h"
+#include "VulkanContext.h"
+#include "Buffer.h"
+#include "common/Log.h"
+#include "common/Params.h"
+
+// Matches the uvec4 entries of ShadingStats in ShaderCode/Raytracer.comp.glsl
+struct ShadingStatsEntry {
+    uint32_t activeLanes;
+    uint32_t issuedLanes;
+    uint32_t padding[2];
+};
+
+void ShadingStats::Init(uint32_t slotCount) {
+    // The megakernel always declares the binding, so the buffer exists even with the stats off
+    s_StatsSSBO = SSBO::CreateHostVisible(SHADING_STATS_BINDING, sizeof(ShadingStatsEntry) * slotCount);
+    s_Pending.assign(slotCount, false);
+
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(VulkanContext::GetPhysicalDevice(), &properties);
+
+    const VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    s_Supported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) && (subgroupProperties.supportedOperations & required) == required;
+    if (Params::s_ShadingStats && !s_Supported) {
+        RT_WARN("Device lacks the subgroup operations for --shading-stats, shading stats are disabled");
+        Params::s_ShadingStats = false;
+    }
+}
+
+void ShadingStats::Cleanup() {
+    // Destroyed with all other buffers by Buffer::DestroyAllBuffers
+    s_StatsSSBO.reset();
+    s_Pending.clear();
+}
+
+void ShadingStats::Reset(VkCommandBuffer cmd, uint32_t slot) {
+    if (!Params::s_ShadingStats) {
+        return;
+    }
+    vkCmdFillBuffer(cmd, s_StatsSSBO->GetBuffer(), slot * sizeof(ShadingStatsEntry), sizeof(ShadingStatsEntry), 0);
+
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    s_Pending[slot] = true;
+}
+
+void ShadingStats::Collect(uint32_t slot) {
+    if (!s_StatsSSBO || !s_Pending[slot]) {
+        return;
+    }
+    s_Pending[slot] = false;
+
+    std::vector<ShadingStatsEntry> entries(s_Pending.size());
+    s_StatsSSBO->ReadData(entries.data(), entries.size() * sizeof(ShadingStatsEntry));
+    const ShadingStatsEntry& entry = entries[slot];
+    if (entry.issuedLanes == 0) {
+        return;
+    }
+    s_ActiveLaneRatio = double(entry.activeLanes) / double(entry.issuedLanes);
+    s_TotalActiveLanes += entry.activeLanes;
+    s_TotalIssuedLanes += entry.issuedLanes;
+}
+
+double ShadingStats::GetAverageActiveLaneRatio() {
+    return (s_TotalIssuedLanes > 0) ? double(s_TotalActiveLanes) / double(s_TotalIssuedLanes) : 0.0;
+}
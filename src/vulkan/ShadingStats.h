@@ -0,0 +1,42 @@
+#ifndef SHADING_STATS_H
+#define SHADING_STATS_H
+
+#include <vulkan/vulkan.h>
+#include <memory>
+#include <vector>
+
+#define SHADING_STATS_BINDING 63
+
+class SSBO;
+
+// Divergence of the shading in Raytracer.comp.glsl (Params::s_ShadingStats): a subgroup runs one
+// pass per distinct shader type among its lanes, the active lane ratio is the share of the issued
+// lanes that actually shaded a hit. 1.0 means every subgroup only ever shaded a single shader type.
+// Every submission adds to its own slot of a host visible buffer, read once the submission finished
+class ShadingStats {
+public:
+    // Has to run before ComputePipeline::Init, disables Params::s_ShadingStats without subgroup support
+    static void Init(uint32_t slotCount);
+    static void Cleanup();
+    static bool IsSupported() { return s_Supported; }
+
+    // Clears the counters of slot before the dispatch recorded into cmd
+    static void Reset(VkCommandBuffer cmd, uint32_t slot);
+    // Reads the counters of slot, must only be called once its previous submission finished
+    static void Collect(uint32_t slot);
+
+    // Of the most recently collected submission with shading work
+    static double GetActiveLaneRatio() { return s_ActiveLaneRatio; }
+    // Over all submissions collected so far
+    static double GetAverageActiveLaneRatio();
+
+private:
+    inline static std::shared_ptr<SSBO> s_StatsSSBO;
+    inline static std::vector<bool> s_Pending;     // per slot, true while a submission adds to it
+    inline static bool s_Supported = false;
+    inline static double s_ActiveLaneRatio = 0.0;
+    inline static uint64_t s_TotalActiveLanes = 0;
+    inline static uint64_t s_TotalIssuedLanes = 0;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "StagingRing.h"
+#include "Buffer.h"
+#include "VulkanContext.h"
+#include "common/Log.h"
+#include <algorithm>
+#include <cstring>
+
+// Offsets into the ring are kept aligned for vkCmdCopyBuffer sources
+static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void StagingRing::Init(VkDeviceSize size) {
+    s_Size = size;
+    s_Head = 0;
+    Buffer::Create(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, s_Buffer, s_Memory);
+    vkMapMemory(VulkanContext::GetDevice(), s_Memory, 0, size, 0, &s_Mapped);
+}
+
+void StagingRing::Cleanup() {
+    if (s_Buffer == VK_NULL_HANDLE) {
+        return;
+    }
+    WaitIdle();
+    vkUnmapMemory(VulkanContext::GetDevice(), s_Memory);
+    vkDestroyBuffer(VulkanContext::GetDevice(), s_Buffer, nullptr);
+    vkFreeMemory(VulkanContext::GetDevice(), s_Memory, nullptr);
+    s_Buffer = VK_NULL_HANDLE;
+    s_Memory = VK_NULL_HANDLE;
+    s_Mapped = nullptr;
+}
+
+void StagingRing::Upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, size_t size) {
+    RT_ASSERT(s_Buffer != VK_NULL_HANDLE, "StagingRing::Init has to be called before uploading");
+    const byte* src = static_cast<const byte*>(data);
+
+    while (size > 0) {
+        const VkDeviceSize chunk = std::min<VkDeviceSize>(size, s_Size / 2);
+        const VkDeviceSize offset = Allocate((chunk + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT);
+        std::memcpy(static_cast<byte*>(s_Mapped) + offset, src, chunk);
+
+        if (s_PendingCommandBuffer == VK_NULL_HANDLE) {
+            VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandPool = VulkanContext::GetCommandPool();
+            allocInfo.commandBufferCount = 1;
+            vkAllocateCommandBuffers(VulkanContext::GetDevice(), &allocInfo, &s_PendingCommandBuffer);
+
+            VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(s_PendingCommandBuffer, &beginInfo);
+            s_PendingBegin = offset;
+
+            // Frames submitted earlier may still read the destination buffers
+            vkCmdPipelineBarrier(s_PendingCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+        }
+
+        VkBufferCopy region = {};
+        region.srcOffset = offset;
+        region.dstOffset = dstOffset;
+        region.size = chunk;
+        vkCmdCopyBuffer(s_PendingCommandBuffer, s_Buffer, dst, 1, &region);
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+}
+
+void StagingRing::Flush() {
+    if (s_PendingCommandBuffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Make the copies visible to every compute dispatch submitted afterwards
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(s_PendingCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(s_PendingCommandBuffer);
+
+    VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    VkFence fence;
+    vkCreateFence(VulkanContext::GetDevice(), &fenceInfo, nullptr, &fence);
+
+    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &s_PendingCommandBuffer;
+    vkQueueSubmit(VulkanContext::GetGraphicsQueue(), 1, &submitInfo, fence);
+
+    s_Submissions.push_back({ fence, s_PendingCommandBuffer, s_PendingBegin });
+    s_PendingCommandBuffer = VK_NULL_HANDLE;
+}
+
+void StagingRing::WaitIdle() {
+    Flush();
+    while (!s_Submissions.empty()) {
+        WaitOldest();
+    }
+}
+
+VkDeviceSize StagingRing::GetTail() {
+    if (!s_Submissions.empty()) {
+        return s_Submissions.front().begin;
+    }
+    return s_PendingCommandBuffer != VK_NULL_HANDLE ? s_PendingBegin : s_Head;
+}
+
+void StagingRing::RetireCompleted() {
+    while (!s_Submissions.empty() && vkGetFenceStatus(VulkanContext::GetDevice(), s_Submissions.front().fence) == VK_SUCCESS) {
+        const Submission& submission = s_Submissions.front();
+        vkDestroyFence(VulkanContext::GetDevice(), submission.fence, nullptr);
+        vkFreeCommandBuffers(VulkanContext::GetDevice(), VulkanContext::GetCommandPool(), 1, &submission.commandBuffer);
+        s_Submissions.pop_front();
+    }
+}
+
+void StagingRing::WaitOldest() {
+    vkWaitForFences(VulkanContext::GetDevice(), 1, &s_Submissions.front().fence, VK_TRUE, UINT64_MAX);
+    RetireCompleted();
+}
+
+VkDeviceSize StagingRing::Allocate(VkDeviceSize size) {
+    for (;;) {
+        RetireCompleted();
+        const bool empty = s_Submissions.empty() && s_PendingCommandBuffer == VK_NULL_HANDLE;
+        if (empty) {
+            s_Head = 0;
+        }
+
+        // Live bytes run from the tail to the head and may wrap around the end of the ring.
+        // The head never catches up with the tail, so head == tail always means empty
+        const VkDeviceSize tail = GetTail();
+        VkDeviceSize offset = s_Size;
+        if (empty || s_Head >= tail) {
+            if (s_Head + size <= s_Size) {
+                offset = s_Head;
+            } else if (size < tail) {
+                offset = 0;
+            }
+        } else if (s_Head + size < tail) {
+            offset = s_Head;
+        }
+
+        if (offset != s_Size) {
+            s_Head = offset + size;
+            return offset;
+        }
+
+        // Full, wait for the GPU to consume older uploads
+        if (s_PendingCommandBuffer != VK_NULL_HANDLE) {
+            Flush();
+        }
+        WaitOldest();
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include <vulkan/vulkan.h>
+#include <deque>
+
+#define STAGING_RING_SIZE (64 * 1024 * 1024) // 64 MB
+
+// Persistently mapped host visible ring that stages uploads into device local buffers.
+// Copies are recorded into one command buffer and submitted by Flush (or once the ring runs full),
+// memory of a submission is reused as soon as its fence signaled.
+class StagingRing {
+public:
+    static void Init(VkDeviceSize size = STAGING_RING_SIZE);
+    static void Cleanup();
+
+    // Copies size bytes from data to dstOffset of dst, larger uploads are split into several copies
+    static void Upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, size_t size);
+    // Submits all recorded copies without waiting, later submissions on the queue see the data
+    static void Flush();
+    // Flushes and blocks until every staged upload reached its buffer
+    static void WaitIdle();
+
+private:
+    struct Submission {
+        VkFence fence;
+        VkCommandBuffer commandBuffer;
+        VkDeviceSize begin;     // first byte of the ring used by this submission
+    };
+
+    static VkDeviceSize Allocate(VkDeviceSize size);
+    static VkDeviceSize GetTail();
+    static void RetireCompleted();
+    static void WaitOldest();
+
+    inline static VkBuffer s_Buffer = VK_NULL_HANDLE;
+    inline static VkDeviceMemory s_Memory = VK_NULL_HANDLE;
+    inline static void* s_Mapped = nullptr;
+    inline static VkDeviceSize s_Size = 0;
+    inline static VkDeviceSize s_Head = 0;
+
+    // Copies recorded since the last Flush
+    inline static VkCommandBuffer s_PendingCommandBuffer = VK_NULL_HANDLE;
+    inline static VkDeviceSize s_PendingBegin = 0;
+    inline static std::deque<Submission> s_Submissions;
+};
+
+#endif
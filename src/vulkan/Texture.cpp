@@ -1,139 +1,823 @@
 #include "Texture.h"
 #include "Buffer.h"
+#include "Renderer.h"
+#include "TextureCompression.h"
+#include "VulkanContext.h"
 #include "common/Log.h"
+#include "common/Params.h"
+#include "common/ThreadPool.h"
 #include <stdexcept>
 #include <fstream>
 #include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <set>
+#include <future>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <third-party/stb_image.h>
 
-// Custom PPM loader (supports P3 ASCII and P6 binary formats)
-static bool LoadPPM(const std::string& filepath, int32_t& width, int32_t& height, std::vector<Vec4>& data) {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) return false;
+#define TEXTURE_FLAG_VALID 1u
+#define TEXTURE_FLAG_RG_NORMAL 2u   // normal map with only xy stored (BC5), z is reconstructed in the shader
 
-    std::string magic;
-    file >> magic;
-    if (magic != "P3" && magic != "P6") return false;
+// Skips whitespace and '#' comments
+static void SkipPPMWhitespace(const char*& cursor, const char* end) {
+    while (cursor < end) {
+        if (*cursor == '#') {
+            while (cursor < end && *cursor != '\n') cursor++;
+        } else if (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r') {
+            cursor++;
+        } else {
+            return;
+        }
+    }
+}
 
-    // Skip comments
-    char c;
-    file.get(c);
-    while (file.peek() == '#') {
-        std::string comment;
-        std::getline(file, comment);
+static bool ParsePPMValue(const char*& cursor, const char* end, uint32_t& value) {
+    SkipPPMWhitespace(cursor, end);
+    if (cursor == end || *cursor < '0' || *cursor > '9') return false;
+    value = 0;
+    while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+        value = value * 10 + uint32_t(*cursor - '0');
+        if (value > 0xFFFFFF) return false;
+        cursor++;
     }
+    return true;
+}
 
-    int maxVal;
-    file >> width >> height >> maxVal;
-    file.get(c); // consume whitespace after maxVal
+// Custom PPM loader (supports P3 ASCII and P6 binary formats)
+// The file is read in one go and parsed in memory, which keeps large P3 files fast.
+// 8 bit images are kept as RGBA8, images with a larger maxVal are stored as RGBA32F
+static bool LoadPPM(const std::string& filepath, int32_t& width, int32_t& height, std::vector<byte>& texels, VkFormat& format) {
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    std::vector<char> contents(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(contents.data(), contents.size())) return false;
+
+    const char* cursor = contents.data();
+    const char* end = contents.data() + contents.size();
+    if (contents.size() < 2 || cursor[0] != 'P' || (cursor[1] != '3' && cursor[1] != '6')) return false;
+    const bool isBinary = cursor[1] == '6';
+    cursor += 2;
 
-    data.reserve(width * height);
+    uint32_t w, h, maxVal;
+    if (!ParsePPMValue(cursor, end, w) || !ParsePPMValue(cursor, end, h) || !ParsePPMValue(cursor, end, maxVal)) return false;
+    if (w == 0 || h == 0 || maxVal == 0 || maxVal > 65535) return false;
+    width = int32_t(w);
+    height = int32_t(h);
 
-    if (magic == "P3") {
+    const size_t pixelCount = size_t(width) * height;
+    std::vector<uint32_t> values(pixelCount * 3);
+
+    if (!isBinary) {
         // ASCII format
-        for (int i = 0; i < width * height; ++i) {
-            int r, g, b;
-            file >> r >> g >> b;
-            data.emplace_back(r / float(maxVal), g / float(maxVal), b / float(maxVal), 1.0f);
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (!ParsePPMValue(cursor, end, values[i])) return false;
         }
     } else {
-        // P6 binary format
-        std::vector<unsigned char> pixels(width * height * 3);
-        file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
-        for (int i = 0; i < width * height; ++i) {
-            int idx = i * 3;
-            data.emplace_back(pixels[idx] / float(maxVal), pixels[idx + 1] / float(maxVal), pixels[idx + 2] / float(maxVal), 1.0f);
+        // P6 binary format, a single whitespace separates the header from the samples.
+        // 16 bit samples are big endian
+        cursor++;
+        const size_t bytesPerSample = maxVal > 255 ? 2 : 1;
+        if (size_t(end - cursor) < values.size() * bytesPerSample) return false;
+        const unsigned char* raw = reinterpret_cast<const unsigned char*>(cursor);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = bytesPerSample == 2 ? (uint32_t(raw[i * 2]) << 8) | raw[i * 2 + 1] : raw[i];
+        }
+    }
+
+    if (maxVal <= 255) {
+        format = VK_FORMAT_R8G8B8A8_UNORM;
+        texels.resize(pixelCount * 4);
+        for (size_t i = 0; i < pixelCount; ++i) {
+            for (int ch = 0; ch < 3; ++ch) {
+                texels[i * 4 + ch] = byte((std::min<uint32_t>(values[i * 3 + ch], maxVal) * 255u + maxVal / 2) / maxVal);
+            }
+            texels[i * 4 + 3] = 255;
+        }
+    } else {
+        format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        texels.resize(pixelCount * sizeof(Vec4));
+        Vec4* dst = reinterpret_cast<Vec4*>(texels.data());
+        for (size_t i = 0; i < pixelCount; ++i) {
+            dst[i] = Vec4(values[i * 3] / float(maxVal), values[i * 3 + 1] / float(maxVal), values[i * 3 + 2] / float(maxVal), 1.0f);
         }
     }
 
     return true;
 }
 
-static std::vector<Texture*> s_AllTextures;
-static std::shared_ptr<SSBO> s_TextureSSBO;
-static std::shared_ptr<SSBO> s_DataSSBO;
-#define SSBO_TEXTURE_DATA_SIZE (512 * 1024 * 1024) /* 512 Mb */
+static size_t GetBytesPerPixel(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            return 4;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return 16;
+        default:
+            RT_ASSERT(false, "Unsupported texture format");
+            return 0;
+    }
+}
 
-void Texture::CreateGPUBuffers() {
-    s_TextureSSBO = SSBO::Create(51);
-    s_DataSSBO = SSBO::Create(52, SSBO_TEXTURE_DATA_SIZE);
+static uint32_t GetMipLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while ((width | height) > 1) {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        levels++;
+    }
+    return levels;
 }
 
-Texture::Texture(const std::string& filepath) {
-    id = s_AllTextures.size();
-    s_AllTextures.push_back(this);
+static float SRGBToLinear(byte value) {
+    static const auto s_Table = []() {
+        std::array<float, 256> table;
+        for (int i = 0; i < 256; i++) {
+            const float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+    return s_Table[value];
+}
+
+static byte LinearToSRGB(float value) {
+    const float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return byte(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+// Source texels one destination texel covers along one axis. Even sizes average pairs, odd sizes
+// spread 2n+1 texels over n and weight the three texels each destination texel overlaps by the overlap
+struct FilterTaps {
+    uint32_t index[3];
+    float weight[3];
+    uint32_t count;
+};
+
+static FilterTaps GetFilterTaps(uint32_t srcSize, uint32_t dstSize, uint32_t x) {
+    if (srcSize == 1) {
+        return { { 0 }, { 1.0f }, 1 };
+    }
+    if (srcSize % 2 == 0) {
+        return { { 2 * x, 2 * x + 1 }, { 0.5f, 0.5f }, 2 };
+    }
+    const float scale = 1.0f / float(srcSize);
+    return { { 2 * x, 2 * x + 1, 2 * x + 2 }, { float(dstSize - x) * scale, float(dstSize) * scale, float(x + 1) * scale }, 3 };
+}
+
+// Filters the footprint of texel (x, y) of dstLevel in src into dst
+static void DownsampleTexel(VkFormat format, const byte* src, const MipLevel& srcLevel, const MipLevel& dstLevel, byte* dst, uint32_t x, uint32_t y) {
+    const FilterTaps tapsX = GetFilterTaps(srcLevel.width, dstLevel.width, x);
+    const FilterTaps tapsY = GetFilterTaps(srcLevel.height, dstLevel.height, y);
+
+    if (format == VK_FORMAT_R32G32B32A32_SFLOAT) {
+        const Vec4* texels = reinterpret_cast<const Vec4*>(src);
+        Vec4 sum(0.0f);
+        for (uint32_t j = 0; j < tapsY.count; j++) {
+            for (uint32_t i = 0; i < tapsX.count; i++) {
+                sum += texels[size_t(tapsY.index[j]) * srcLevel.width + tapsX.index[i]] * (tapsX.weight[i] * tapsY.weight[j]);
+            }
+        }
+        *reinterpret_cast<Vec4*>(dst) = sum;
+        return;
+    }
+
+    const bool isSRGB = format == VK_FORMAT_R8G8B8A8_SRGB;
+    for (int ch = 0; ch < 4; ch++) {
+        // sRGB colors are filtered in linear space, alpha is always linear
+        const bool linearize = isSRGB && ch < 3;
+        float sum = 0.0f;
+        for (uint32_t j = 0; j < tapsY.count; j++) {
+            for (uint32_t i = 0; i < tapsX.count; i++) {
+                const byte value = src[(size_t(tapsY.index[j]) * srcLevel.width + tapsX.index[i]) * 4 + ch];
+                sum += (linearize ? SRGBToLinear(value) : float(value)) * (tapsX.weight[i] * tapsY.weight[j]);
+            }
+        }
+        dst[ch] = linearize ? LinearToSRGB(sum) : byte(std::clamp(sum + 0.5f, 0.0f, 255.0f));
+    }
+}
+
+// Builds the full mip chain behind level 0, rows of each level are filtered in parallel
+static TextureMipChain GenerateMipChain(uint32_t width, uint32_t height, VkFormat format, const void* texels, size_t size) {
+    const size_t bytesPerPixel = GetBytesPerPixel(format);
+    const uint32_t levelCount = Params::s_TextureMipmaps ? GetMipLevelCount(width, height) : 1;
+
+    TextureMipChain chain;
+    chain.format = format;
+    chain.levels.resize(levelCount);
+    size_t chainSize = 0;
+    for (uint32_t i = 0; i < levelCount; i++) {
+        chain.levels[i] = { width, height, chainSize };
+        chainSize += size_t(width) * height * bytesPerPixel;
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+
+    chain.data.resize(chainSize);
+    std::memcpy(chain.data.data(), texels, size);
+    for (uint32_t i = 1; i < levelCount; i++) {
+        const MipLevel& srcLevel = chain.levels[i - 1];
+        const MipLevel& dstLevel = chain.levels[i];
+        const byte* src = chain.data.data() + srcLevel.offset;
+        byte* dst = chain.data.data() + dstLevel.offset;
+        ThreadPool::Get().ParallelFor(dstLevel.height, [&](uint32_t y) {
+            for (uint32_t x = 0; x < dstLevel.width; x++) {
+                DownsampleTexel(format, src, srcLevel, dstLevel, dst + (size_t(y) * dstLevel.width + x) * bytesPerPixel, x, y);
+            }
+        });
+    }
+    return chain;
+}
+
+// Mip chain in the format the image is created with, block compressed chains come from
+// TEXTURE_CACHE_DIRECTORY when the same texels were compressed before
+static TextureMipChain PrepareMipChain(uint32_t width, uint32_t height, VkFormat format, const void* texels, size_t size, TextureUsage usage) {
+    VkFormat compressedFormat = VK_FORMAT_UNDEFINED;
+    if (Params::s_TextureCompression && VulkanContext::SupportsBCTextures()) {
+        compressedFormat = TextureCompression::GetCompressedFormat(format, usage);
+    }
+    if (compressedFormat != VK_FORMAT_UNDEFINED && (width % 4 != 0 || height % 4 != 0)) {
+        RT_WARN("Texture of size {0}x{1} is not a multiple of the 4x4 block size, keeping it uncompressed", width, height);
+        compressedFormat = VK_FORMAT_UNDEFINED;
+    }
+    if (compressedFormat == VK_FORMAT_UNDEFINED) {
+        return GenerateMipChain(width, height, format, texels, size);
+    }
+
+    const uint32_t levelCount = Params::s_TextureMipmaps ? GetMipLevelCount(width, height) : 1;
+    const uint64_t key = TextureCompression::ComputeCacheKey(format, compressedFormat, width, height, levelCount, texels, size);
+    char keyString[17];
+    snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(key));
+    const std::string filename = (std::filesystem::path(Params::TEXTURE_CACHE_DIRECTORY) / (std::string(keyString) + ".bctex")).string();
+
+    TextureMipChain chain;
+    if (TextureCompression::LoadFromCache(filename, key, chain)) {
+        return chain;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    chain = TextureCompression::Compress(GenerateMipChain(width, height, format, texels, size), compressedFormat);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    RT_INFO("Compressed {0}x{1} texture in {2:.2f} ms", width, height, elapsed);
+    TextureCompression::SaveToCache(filename, key, chain);
+    return chain;
+}
+
+// Result of decoding an image file on a worker thread
+struct DecodedImage {
+    std::vector<byte> texels;
+    int32_t width = 0;
+    int32_t height = 0;
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    TextureMipChain chain;  // prepared on the worker as well once the GPU resources exist
+    std::string error;
+    double milliseconds = 0.0;
+};
+
+static DecodedImage DecodeImage(const std::string& filepath, bool isSRGB) {
+    DecodedImage decoded;
 
     // Check for PPM extension
     bool isPPM = filepath.size() >= 4 &&
         (filepath.substr(filepath.size() - 4) == ".ppm" || filepath.substr(filepath.size() - 4) == ".PPM");
 
     if (isPPM) {
-        if (!LoadPPM(filepath, width, height, data)) {
-            throw std::runtime_error("Failed to load PPM texture: " + filepath);
+        if (!LoadPPM(filepath, decoded.width, decoded.height, decoded.texels, decoded.format)) {
+            decoded.error = "Failed to load PPM texture: " + filepath;
+        }
+    } else if (stbi_is_hdr(filepath.c_str())) {
+        int32_t c;
+        float* pixels = stbi_loadf(filepath.c_str(), &decoded.width, &decoded.height, &c, STBI_rgb_alpha);
+        if (!pixels) {
+            decoded.error = "Failed to load texture: " + filepath;
+            return decoded;
         }
+        decoded.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        decoded.texels.assign(reinterpret_cast<byte*>(pixels), reinterpret_cast<byte*>(pixels) + size_t(decoded.width) * decoded.height * sizeof(Vec4));
+        stbi_image_free(pixels);
     } else {
         int32_t c;
-        stbi_uc* pixels = stbi_load(filepath.c_str(), &width, &height, &c, STBI_rgb_alpha);
-        if (!pixels) throw std::runtime_error("Failed to load texture: " + filepath);
-
-        data.reserve(width * height);
-        for (int i = 0; i < width * height; ++i) {
-            int idx = i * 4;
-            float r = pixels[idx] / 255.0f;
-            float g = pixels[idx + 1] / 255.0f;
-            float b = pixels[idx + 2] / 255.0f;
-            float a = pixels[idx + 3] / 255.0f;
-            data.emplace_back(r, g, b, a);
+        stbi_uc* pixels = stbi_load(filepath.c_str(), &decoded.width, &decoded.height, &c, STBI_rgb_alpha);
+        if (!pixels) {
+            decoded.error = "Failed to load texture: " + filepath;
+            return decoded;
         }
+        decoded.format = VK_FORMAT_R8G8B8A8_UNORM;
+        decoded.texels.assign(pixels, pixels + size_t(decoded.width) * decoded.height * 4);
         stbi_image_free(pixels);
     }
 
-    RT_INFO("Loaded Texture. Width: {} Height: {} Data Total: {} bytes", width, height, sizeof(Vec4) * data.size());
-    Texture::UploadToGPU();
+    if (isSRGB && decoded.format == VK_FORMAT_R8G8B8A8_UNORM) {
+        decoded.format = VK_FORMAT_R8G8B8A8_SRGB;
+    }
+    return decoded;
 }
 
-Texture::~Texture() {
-    s_AllTextures[GetId()] = nullptr;
-    data.clear();
-    Texture::UploadToGPU();
+struct PendingDecode {
+    Texture* texture;
+    std::string filepath;
+    std::future<DecodedImage> result;
+};
+static std::vector<PendingDecode> s_PendingDecodes;
+static TextureLoadStats s_LoadStats;
+
+static std::vector<Texture*> s_AllTextures;
+static std::shared_ptr<SSBO> s_TextureSSBO;
+static VkSampler s_Sampler = VK_NULL_HANDLE;
+
+// Slots of destroyed textures, handed out again before s_AllTextures grows
+static std::set<TextureID> s_FreeSlots;
+// Slots whose table entry and descriptor have to be rewritten
+static std::vector<uint32_t> s_DirtySlots;
+
+// 1x1 texture bound to every unused slot of the sampler array
+static VkImage s_PlaceholderImage = VK_NULL_HANDLE;
+static GpuAllocation s_PlaceholderMemory;
+static VkImageView s_PlaceholderView = VK_NULL_HANDLE;
+
+// Upload batching (see Texture::BeginUploadBatch)
+struct StagingBuffer {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    size_t size;
+};
+static uint32_t s_BatchDepth = 0;
+static VkCommandBuffer s_BatchCommandBuffer = VK_NULL_HANDLE;
+static std::vector<StagingBuffer> s_BatchStagingBuffers;
+static size_t s_BatchStagingSize = 0;
+// Pending copies are submitted early once their staging memory exceeds this
+static constexpr size_t MAX_BATCH_STAGING_SIZE = 256 * 1024 * 1024;
+// Set while DestroyAllTextures deletes the textures, it already waited for the device once
+static bool s_DeviceIdleForDestroy = false;
+
+// Submits all copies recorded since the last submit and frees their staging buffers
+static void SubmitBatchedUploads() {
+    if (s_BatchCommandBuffer == VK_NULL_HANDLE) {
+        return;
+    }
+    VulkanContext::EndSingleTimeCommands(s_BatchCommandBuffer);
+    s_BatchCommandBuffer = VK_NULL_HANDLE;
+
+    for (const StagingBuffer& staging : s_BatchStagingBuffers) {
+        vkDestroyBuffer(VulkanContext::GetDevice(), staging.buffer, nullptr);
+        vkFreeMemory(VulkanContext::GetDevice(), staging.memory, nullptr);
+    }
+    s_BatchStagingBuffers.clear();
+    s_BatchStagingSize = 0;
 }
 
-void Texture::UploadToGPU() {
-    if (VulkanContext::GetDevice() == VK_NULL_HANDLE) {
+static void CreateImageResources(const TextureMipChain& chain, VkImage& image, GpuAllocation& memory, VkImageView& imageView) {
+    auto device = VulkanContext::GetDevice();
+    const uint32_t width = chain.levels[0].width;
+    const uint32_t height = chain.levels[0].height;
+    const VkFormat format = chain.format;
+    const uint32_t mipLevels = static_cast<uint32_t>(chain.levels.size());
+    const auto& levels = chain.levels;
+
+    VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = { width, height, 1 };
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+        RT_ERROR("failed to create texture image"); exit(1);
+    }
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(device, image, &memReqs);
+
+    memory = GpuAllocator::Allocate(memReqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Image);
+    vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+    VkImageViewCreateInfo viewInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+    if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+        RT_ERROR("failed to create texture view"); exit(1);
+    }
+
+    // Copy the texels through a staging buffer
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+    Buffer::Create(chain.data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
+    void* data;
+    vkMapMemory(device, stagingMemory, 0, chain.data.size(), 0, &data);
+    std::memcpy(data, chain.data.data(), chain.data.size());
+    vkUnmapMemory(device, stagingMemory);
+
+    // Inside an upload batch all copies go into one command buffer
+    if (s_BatchDepth > 0 && s_BatchCommandBuffer == VK_NULL_HANDLE) {
+        s_BatchCommandBuffer = VulkanContext::BeginSingleTimeCommands();
+    }
+    VkCommandBuffer cmd = s_BatchDepth > 0 ? s_BatchCommandBuffer : VulkanContext::BeginSingleTimeCommands();
+
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+    for (uint32_t i = 0; i < mipLevels; i++) {
+        regions[i] = {};
+        regions[i].bufferOffset = levels[i].offset;
+        regions[i].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+        regions[i].imageExtent = { levels[i].width, levels[i].height, 1 };
+    }
+    vkCmdCopyBufferToImage(cmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    if (s_BatchDepth > 0) {
+        s_BatchStagingBuffers.push_back({ stagingBuffer, stagingMemory, chain.data.size() });
+        s_BatchStagingSize += chain.data.size();
+        if (s_BatchStagingSize > MAX_BATCH_STAGING_SIZE) {
+            SubmitBatchedUploads();
+        }
         return;
     }
 
-    int32_t dataCount = 0;
-    size_t GPUDataSize = sizeof(uint32_t) + sizeof(uint32_t) * 3 * s_AllTextures.size();
-    void* DataGPU = s_TextureSSBO->MapData(GPUDataSize);
+    VulkanContext::EndSingleTimeCommands(cmd);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingMemory, nullptr);
+}
 
-    const uint32_t count = static_cast<uint32_t>(s_AllTextures.size());
-    std::memcpy(DataGPU, &count, sizeof(uint32_t));
+static void DestroyImageResources(VkImage& image, GpuAllocation& memory, VkImageView& imageView) {
+    auto device = VulkanContext::GetDevice();
+    if (device == VK_NULL_HANDLE) {
+        return;
+    }
+    if (imageView != VK_NULL_HANDLE) vkDestroyImageView(device, imageView, nullptr);
+    if (image != VK_NULL_HANDLE) vkDestroyImage(device, image, nullptr);
+    GpuAllocator::Free(memory);
+    imageView = VK_NULL_HANDLE;
+    image = VK_NULL_HANDLE;
+}
 
-    for (uint32_t i = 0; i < s_AllTextures.size(); i++) {
-        if (!s_AllTextures[i]) {
+void Texture::CreateGPUBuffers() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    if (properties.limits.maxPerStageDescriptorSamplers < MAX_TEXTURES || properties.limits.maxPerStageDescriptorSampledImages < MAX_TEXTURES) {
+        RT_ERROR("Device supports only {0} samplers per stage, {1} are required for the texture array",
+            std::min(properties.limits.maxPerStageDescriptorSamplers, properties.limits.maxPerStageDescriptorSampledImages), MAX_TEXTURES);
+        exit(1);
+    }
+
+    s_TextureSSBO = SSBO::Create(TEXTURE_TABLE_BINDING);
+
+    VkSamplerCreateInfo samplerInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    if (vkCreateSampler(VulkanContext::GetDevice(), &samplerInfo, nullptr, &s_Sampler) != VK_SUCCESS) {
+        RT_ERROR("failed to create texture sampler"); exit(1);
+    }
+
+    TextureMipChain white;
+    white.format = VK_FORMAT_R8G8B8A8_UNORM;
+    white.levels = { { 1, 1, 0 } };
+    white.data = { 255, 255, 255, 255 };
+    CreateImageResources(white, s_PlaceholderImage, s_PlaceholderMemory, s_PlaceholderView);
+
+    // Textures created before the device existed
+    BeginUploadBatch();
+    for (Texture* texture : s_AllTextures) {
+        if (texture && !texture->texels.empty()) {
+            texture->CreateImage(texture->texels.data(), texture->texels.size());
+        }
+    }
+    for (uint32_t slot = 0; slot < s_AllTextures.size(); slot++) {
+        s_DirtySlots.push_back(slot);
+    }
+    EndUploadBatch();
+}
+
+void Texture::Cleanup() {
+    SubmitBatchedUploads();
+    for (Texture* texture : s_AllTextures) {
+        if (texture) {
+            texture->DestroyImage();
+        }
+    }
+    DestroyImageResources(s_PlaceholderImage, s_PlaceholderMemory, s_PlaceholderView);
+    if (s_Sampler != VK_NULL_HANDLE) {
+        vkDestroySampler(VulkanContext::GetDevice(), s_Sampler, nullptr);
+        s_Sampler = VK_NULL_HANDLE;
+    }
+}
+
+void Texture::DestroyAllTextures() {
+    std::vector<Texture*> textures = s_AllTextures;
+    BeginUploadBatch();
+    if (VulkanContext::GetDevice() != VK_NULL_HANDLE && !textures.empty()) {
+        // One wait for all images instead of one per texture
+        VulkanContext::DeviceWaitIdle();
+        SubmitBatchedUploads();
+        s_DeviceIdleForDestroy = true;
+    }
+    for (Texture* texture : textures) {
+        delete texture;
+    }
+    s_DeviceIdleForDestroy = false;
+    s_AllTextures.clear();
+    s_FreeSlots.clear();
+    EndUploadBatch();
+}
+
+void Texture::BeginUploadBatch() {
+    s_BatchDepth++;
+}
+
+void Texture::EndUploadBatch() {
+    RT_ASSERT(s_BatchDepth > 0, "EndUploadBatch without BeginUploadBatch");
+    if (s_BatchDepth == 1) {
+        // Still batching, so the finished textures are flushed together below
+        Texture::FinishPendingDecodes();
+    }
+    if (--s_BatchDepth == 0) {
+        Texture::FlushUpdates();
+    }
+}
+
+void Texture::FinishPendingDecodes() {
+    // Textures may be destroyed (and erase their entry) while the list is processed
+    std::vector<PendingDecode> pending = std::move(s_PendingDecodes);
+    s_PendingDecodes.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    for (PendingDecode& decode : pending) {
+        DecodedImage decoded = decode.result.get();
+        Texture* texture = decode.texture;
+        s_LoadStats.decodeMilliseconds += decoded.milliseconds;
+
+        if (!decoded.error.empty()) {
+            // The slot stays invalid and samples as black
+            RT_ERROR("{0}", decoded.error);
             continue;
         }
-        std::memcpy(static_cast<byte*>(DataGPU) + sizeof(uint32_t) + i * sizeof(uint32_t) * 3 + sizeof(uint32_t) * 0, &dataCount, sizeof(uint32_t));
-        std::memcpy(static_cast<byte*>(DataGPU) + sizeof(uint32_t) + i * sizeof(uint32_t) * 3 + sizeof(uint32_t) * 1, &s_AllTextures[i]->width, sizeof(uint32_t));
-        std::memcpy(static_cast<byte*>(DataGPU) + sizeof(uint32_t) + i * sizeof(uint32_t) * 3 + sizeof(uint32_t) * 2, &s_AllTextures[i]->height, sizeof(uint32_t));
-        dataCount += s_AllTextures[i]->data.size();
+        s_LoadStats.decodedCount++;
+
+        texture->width = decoded.width;
+        texture->height = decoded.height;
+        texture->format = decoded.format;
+        texture->texels = std::move(decoded.texels);
+        RT_INFO("Loaded Texture {0}. Width: {1} Height: {2} Data Total: {3} bytes (level 0)", decode.filepath, texture->width, texture->height, texture->texels.size());
+
+        if (!decoded.chain.levels.empty()) {
+            texture->CreateImage(decoded.chain);
+        } else {
+            texture->CreateImage(texture->texels.data(), texture->texels.size());
+        }
+        MarkDirty(texture->id);
+    }
+    s_LoadStats.waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+TextureLoadStats Texture::GetLoadStats() {
+    return s_LoadStats;
+}
+
+void Texture::ResetLoadStats() {
+    s_LoadStats = {};
+}
+
+TextureID Texture::AllocateSlot(Texture* texture) {
+    if (!s_FreeSlots.empty()) {
+        const TextureID slot = *s_FreeSlots.begin();
+        s_FreeSlots.erase(s_FreeSlots.begin());
+        s_AllTextures[slot] = texture;
+        return slot;
+    }
+    s_AllTextures.push_back(texture);
+    return static_cast<TextureID>(s_AllTextures.size() - 1);
+}
+
+void Texture::ReleaseSlot(TextureID slot) {
+    if (slot >= static_cast<TextureID>(s_AllTextures.size()) || s_AllTextures[slot] != this) {
+        return;
+    }
+    s_AllTextures[slot] = nullptr;
+    s_FreeSlots.insert(slot);
+    // Trailing free slots shrink the table instead
+    while (!s_AllTextures.empty() && s_AllTextures.back() == nullptr) {
+        s_FreeSlots.erase(static_cast<TextureID>(s_AllTextures.size() - 1));
+        s_AllTextures.pop_back();
+    }
+}
+
+void Texture::MarkDirty(TextureID slot) {
+    s_DirtySlots.push_back(static_cast<uint32_t>(slot));
+    if (s_BatchDepth == 0) {
+        Texture::FlushUpdates();
+    }
+}
+
+void Texture::LogMemoryUsage() {
+    size_t gpuSize = 0;
+    size_t uncompressedSize = 0;
+    uint32_t compressedCount = 0;
+    for (const Texture* texture : s_AllTextures) {
+        if (texture && texture->image != VK_NULL_HANDLE) {
+            gpuSize += texture->gpuSize;
+            uncompressedSize += texture->uncompressedSize;
+            compressedCount += TextureCompression::IsBlockCompressed(texture->gpuFormat) ? 1 : 0;
+        }
+    }
+    if (uncompressedSize == 0) {
+        return;
+    }
+    RT_INFO("Texture memory: {0:.2f} MB for {1} textures ({2} block compressed), {3:.2f} MB uncompressed, {4:.2f} MB saved",
+        gpuSize / (1024.0 * 1024.0), s_AllTextures.size(), compressedCount, uncompressedSize / (1024.0 * 1024.0),
+        (uncompressedSize - gpuSize) / (1024.0 * 1024.0));
+}
+
+const std::vector<Texture*>& Texture::GetAllTextures() {
+    return s_AllTextures;
+}
+
+Texture::Texture(const std::string& filepath, TextureUsage usage, bool isSRGB) : usage(usage) {
+    id = AllocateSlot(this);
+
+    // Decoding (and mip/compression work) runs on the thread pool, the texture is finished
+    // when the outermost upload batch ends, which is right away outside of a batch
+    BeginUploadBatch();
+    const bool prepareChain = VulkanContext::GetDevice() != VK_NULL_HANDLE && s_Sampler != VK_NULL_HANDLE;
+    auto result = ThreadPool::Get().Enqueue([filepath, usage, isSRGB, prepareChain]() {
+        auto start = std::chrono::steady_clock::now();
+        DecodedImage decoded = DecodeImage(filepath, isSRGB);
+        if (decoded.error.empty() && prepareChain) {
+            decoded.chain = PrepareMipChain(decoded.width, decoded.height, decoded.format, decoded.texels.data(), decoded.texels.size(), usage);
+        }
+        decoded.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return decoded;
+    });
+    s_PendingDecodes.push_back({ this, filepath, std::move(result) });
+    EndUploadBatch();
+}
+
+Texture::Texture(int32_t width, int32_t height, VkFormat format, const void* texels, size_t size, TextureUsage usage)
+    : width(width), height(height), format(format), usage(usage) {
+    id = AllocateSlot(this);
+
+    RT_ASSERT(size == size_t(width) * height * GetBytesPerPixel(format), "Texel data size does not match the texture dimensions");
+    this->texels.assign(static_cast<const byte*>(texels), static_cast<const byte*>(texels) + size);
+
+    CreateImage(this->texels.data(), this->texels.size());
+    MarkDirty(id);
+}
+
+Texture::~Texture() {
+    for (auto it = s_PendingDecodes.begin(); it != s_PendingDecodes.end(); ++it) {
+        if (it->texture == this) {
+            it->result.wait();
+            s_PendingDecodes.erase(it);
+            break;
+        }
+    }
+    ReleaseSlot(id);
+    if (VulkanContext::GetDevice() != VK_NULL_HANDLE && image != VK_NULL_HANDLE) {
+        // The image may still be referenced by in-flight work, pending batched copies and the descriptor set
+        if (!s_DeviceIdleForDestroy) {
+            VulkanContext::DeviceWaitIdle();
+            SubmitBatchedUploads();
+        }
+        DestroyImage();
+        MarkDirty(id);
+    }
+}
+
+void Texture::CreateImage(const void* texels, size_t size) {
+    if (VulkanContext::GetDevice() == VK_NULL_HANDLE || s_Sampler == VK_NULL_HANDLE) {
+        // Uploaded once the GPU resources exist (see CreateGPUBuffers)
+        return;
+    }
+    CreateImage(PrepareMipChain(width, height, format, texels, size, usage));
+}
+
+void Texture::CreateImage(const TextureMipChain& chain) {
+    CreateImageResources(chain, image, memory, imageView);
+    mipLevels = static_cast<uint32_t>(chain.levels.size());
+    gpuFormat = chain.format;
+    gpuSize = chain.data.size();
+    uncompressedSize = 0;
+    for (const MipLevel& level : chain.levels) {
+        uncompressedSize += TextureCompression::GetLevelSize(format, level.width, level.height);
+    }
+
+    // The GPU copy is authoritative, only keep the texels around if they still have to be exported
+    // or an environment distribution is built from them (see EnvironmentMap::Build)
+    if (Params::GetExportBinaryFilename().empty() && usage != TextureUsage::Environment) {
+        this->texels.clear();
+        this->texels.shrink_to_fit();
+    }
+}
+
+void Texture::DestroyImage() {
+    DestroyImageResources(image, memory, imageView);
+}
+
+VkDescriptorImageInfo Texture::GetDescriptorImageInfo(uint32_t slot) {
+    const Texture* texture = slot < s_AllTextures.size() ? s_AllTextures[slot] : nullptr;
+    VkDescriptorImageInfo info = {};
+    info.sampler = s_Sampler;
+    info.imageView = (texture && texture->imageView != VK_NULL_HANDLE) ? texture->imageView : s_PlaceholderView;
+    info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return info;
+}
+
+std::vector<VkDescriptorImageInfo> Texture::GetDescriptorImageInfos() {
+    std::vector<VkDescriptorImageInfo> infos(MAX_TEXTURES);
+    for (uint32_t i = 0; i < MAX_TEXTURES; i++) {
+        infos[i] = GetDescriptorImageInfo(i);
+    }
+    return infos;
+}
+
+void Texture::FlushUpdates() {
+    if (VulkanContext::GetDevice() == VK_NULL_HANDLE || !s_TextureSSBO) {
+        // CreateGPUBuffers writes every slot
+        s_DirtySlots.clear();
+        return;
+    }
+    SubmitBatchedUploads();
+    if (s_DirtySlots.empty()) {
+        return;
     }
-    s_TextureSSBO->UnmapData();
 
-    // Upload Data
-    DataGPU = s_DataSSBO->MapData(sizeof(Vec4) * dataCount);
-    int32_t dataWritten = 0;
-    for (uint32_t i = 0; i < s_AllTextures.size(); i++) {
-        if (!s_AllTextures[i]) {
+    if (s_AllTextures.size() > MAX_TEXTURES) {
+        RT_ERROR("Too many textures: {0} (maximum is {1})", s_AllTextures.size(), MAX_TEXTURES);
+        exit(1);
+    }
+
+    // Texture table layout:
+    // uint textureCount
+    // uint padding[3]
+    // { int width, int height, uint mipLevels, uint flags } textures[]
+    struct GPUTextureInfo {
+        int32_t width;
+        int32_t height;
+        uint32_t mipLevels;
+        uint32_t flags;
+    };
+    const size_t headerSize = sizeof(uint32_t) * 4;
+    const uint32_t header[4] = { static_cast<uint32_t>(s_AllTextures.size()), 0, 0, 0 };
+    s_TextureSSBO->UploadRegion(header, 0, headerSize);
+
+    // Only the entries of changed slots are rewritten, slots behind textureCount are never read
+    std::sort(s_DirtySlots.begin(), s_DirtySlots.end());
+    s_DirtySlots.erase(std::unique(s_DirtySlots.begin(), s_DirtySlots.end()), s_DirtySlots.end());
+    for (uint32_t slot : s_DirtySlots) {
+        if (slot >= s_AllTextures.size()) {
             continue;
         }
-        std::memcpy(static_cast<byte*>(DataGPU) + sizeof(Vec4) * dataWritten, &s_AllTextures[i]->data[0], sizeof(Vec4) * s_AllTextures[i]->data.size());
-        dataWritten += s_AllTextures[i]->data.size();
+        const Texture* texture = s_AllTextures[slot];
+        const bool valid = texture && texture->imageView != VK_NULL_HANDLE;
+        GPUTextureInfo info = {};
+        info.width = valid ? texture->width : 0;
+        info.height = valid ? texture->height : 0;
+        info.mipLevels = valid ? texture->mipLevels : 0;
+        info.flags = valid ? TEXTURE_FLAG_VALID : 0;
+        if (valid && texture->gpuFormat == VK_FORMAT_BC5_UNORM_BLOCK) {
+            info.flags |= TEXTURE_FLAG_RG_NORMAL;
+        }
+        s_TextureSSBO->UploadRegion(&info, headerSize + sizeof(GPUTextureInfo) * slot, sizeof(GPUTextureInfo));
     }
-    if (dataWritten > 0) {
-        s_DataSSBO->UnmapData();
+
+    // Freed slots behind textureCount still need their descriptor reset to the placeholder
+    std::vector<uint32_t> slots;
+    for (uint32_t slot : s_DirtySlots) {
+        if (slot < MAX_TEXTURES) slots.push_back(slot);
     }
-}
\ No newline at end of file
+    s_DirtySlots.clear();
+    Renderer::OnTexturesChanged(slots);
+}
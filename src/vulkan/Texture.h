@@ -1,31 +1,95 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <vulkan/vulkan.h>
 #include <string>
 #include <vector>
 #include "common/Types.h"
+#include "TextureCompression.h"
+#include "GpuAllocator.h"
 
 using TextureID = int32_t;
 
 static constexpr TextureID NULL_TEXTURE = -1;
 
+// Size of the sampler2D array at binding 52 (must match MAX_TEXTURES in ShaderCode/include/Textures.glsl)
+#define MAX_TEXTURES 256
+#define TEXTURE_TABLE_BINDING 51
+#define TEXTURE_SAMPLER_BINDING 52
+
+// Accumulated file decoding statistics, see Texture::GetLoadStats
+struct TextureLoadStats {
+    uint32_t decodedCount = 0;
+    double decodeMilliseconds = 0.0;    // summed over all worker threads
+    double waitMilliseconds = 0.0;      // main thread time spent joining decodes and uploading
+};
+
 class Texture {
 public:
-    Texture(const std::string& filepath);
+    // Decodes filepath on the thread pool, the texture becomes valid once the current upload batch ends.
+    // usage selects the block compressed format the texels are stored in on the GPU
+    Texture(const std::string& filepath, TextureUsage usage = TextureUsage::Color, bool isSRGB = false);
+    // Creates a texture from already decoded texels in the given format
+    Texture(int32_t width, int32_t height, VkFormat format, const void* texels, size_t size, TextureUsage usage = TextureUsage::Color);
     ~Texture();
 
     TextureID GetId() const { return id; }
+    int32_t GetWidth() const { return width; }
+    int32_t GetHeight() const { return height; }
+    uint32_t GetMipLevels() const { return mipLevels; }
+    VkFormat GetFormat() const { return format; }
+    TextureUsage GetUsage() const { return usage; }
+    // CPU copy of mip level 0, only kept for environment maps and while exporting a binary scene
+    const std::vector<byte>& GetTexels() const { return texels; }
 
     static void CreateGPUBuffers();
+    static void Cleanup();
+    static void DestroyAllTextures();
+    // Textures created between these calls upload their texels in one submit and update
+    // the texture table and descriptors once at the end (calls may be nested)
+    static void BeginUploadBatch();
+    static void EndUploadBatch();
+
+    static TextureLoadStats GetLoadStats();
+    static void ResetLoadStats();
+    static const std::vector<Texture*>& GetAllTextures();
+    // Logs the GPU memory of all textures and how much block compression saved
+    static void LogMemoryUsage();
+
+    // One entry per sampler array slot, unused slots point at a 1x1 placeholder
+    static VkDescriptorImageInfo GetDescriptorImageInfo(uint32_t slot);
+    static std::vector<VkDescriptorImageInfo> GetDescriptorImageInfos();
 
 private:
-    static void UploadToGPU();
+    void CreateImage(const void* texels, size_t size);
+    void CreateImage(const TextureMipChain& chain);
+    void DestroyImage();
+
+    // TextureIDs are stable, freed slots are reused by the next texture
+    static TextureID AllocateSlot(Texture* texture);
+    void ReleaseSlot(TextureID slot);
+    // Rewrites the table entry and descriptor of slot, deferred while batching
+    static void MarkDirty(TextureID slot);
+    static void FlushUpdates();
+    // Joins the decode tasks of all file textures and creates their images
+    static void FinishPendingDecodes();
 
-    std::vector<Vec4> data;
-    int32_t width;
-    int32_t height;
+    std::vector<byte> texels;
+    int32_t width = 0;
+    int32_t height = 0;
+    uint32_t mipLevels = 1;   // generated on the CPU when the image is created
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;     // format of texels
+    TextureUsage usage = TextureUsage::Color;
     TextureID id;
+
+    VkFormat gpuFormat = VK_FORMAT_UNDEFINED;       // format of the image, block compressed if possible
+    size_t gpuSize = 0;
+    size_t uncompressedSize = 0;
+
+    VkImage image = VK_NULL_HANDLE;
+    GpuAllocation memory;
+    VkImageView imageView = VK_NULL_HANDLE;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,330 @@
+#include "TextureCompression.h"
+#include "common/Log.h"
+#include "common/ThreadPool.h"
+#include "common/AtomicFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+struct TextureCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;        // VkFormat of the stored chain
+    uint32_t levelCount;
+    uint64_t dataSize;
+};
+
+static void HashBytes(uint64_t& hash, const void* data, size_t size) {
+    const byte* bytes = static_cast<const byte*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+static size_t GetBlockSize(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            return 8;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// ---------- Block encoders ----------
+
+static uint16_t PackRGB565(const float color[3]) {
+    const uint32_t r = uint32_t(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    const uint32_t g = uint32_t(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+    const uint32_t b = uint32_t(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(uint16_t packed, float color[3]) {
+    color[0] = ((packed >> 11) & 31) * 255.0f / 31.0f;
+    color[1] = ((packed >> 5) & 63) * 255.0f / 63.0f;
+    color[2] = (packed & 31) * 255.0f / 31.0f;
+}
+
+// Endpoints along the principal axis of the block colors, 4 color mode
+static void EncodeBC1Block(const byte pixels[16][4], byte* out) {
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) mean[c] += pixels[i][c] / 16.0f;
+    }
+
+    float covariance[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        const float d[3] = { pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2] };
+        covariance[0] += d[0] * d[0]; covariance[1] += d[0] * d[1]; covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1]; covariance[4] += d[1] * d[2]; covariance[5] += d[2] * d[2];
+    }
+
+    // A few power iterations are enough to find the dominant direction
+    float axis[3] = { 1, 1, 1 };
+    for (int iteration = 0; iteration < 4; iteration++) {
+        const float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+        };
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f) break;
+        for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+    }
+
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        const float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float endpoint0[3], endpoint1[3];
+    for (int c = 0; c < 3; c++) {
+        endpoint0[c] = mean[c] + axis[c] * maxT;
+        endpoint1[c] = mean[c] + axis[c] * minT;
+    }
+
+    uint16_t color0 = PackRGB565(endpoint0);
+    uint16_t color1 = PackRGB565(endpoint1);
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        float palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        for (int i = 0; i < 16; i++) {
+            uint32_t best = 0;
+            float bestDistance = INFINITY;
+            for (uint32_t p = 0; p < 4; p++) {
+                float distance = 0.0f;
+                for (int c = 0; c < 3; c++) {
+                    const float d = pixels[i][c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    std::memcpy(out, &color0, 2);
+    std::memcpy(out + 2, &color1, 2);
+    std::memcpy(out + 4, &indices, 4);
+}
+
+// Single channel block, 8 value mode between the channel minimum and maximum
+static void EncodeBC4Block(const byte pixels[16][4], int channel, byte* out) {
+    byte minValue = 255, maxValue = 0;
+    for (int i = 0; i < 16; i++) {
+        minValue = std::min(minValue, pixels[i][channel]);
+        maxValue = std::max(maxValue, pixels[i][channel]);
+    }
+
+    uint64_t indices = 0;
+    if (minValue != maxValue) {
+        float palette[8];
+        palette[0] = maxValue;
+        palette[1] = minValue;
+        for (int p = 2; p < 8; p++) {
+            palette[p] = ((8 - p) * float(maxValue) + (p - 1) * float(minValue)) / 7.0f;
+        }
+        for (int i = 0; i < 16; i++) {
+            uint64_t best = 0;
+            float bestDistance = INFINITY;
+            for (uint64_t p = 0; p < 8; p++) {
+                const float distance = std::abs(pixels[i][channel] - palette[p]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (3 * i);
+        }
+    }
+
+    out[0] = maxValue;
+    out[1] = minValue;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = byte(indices >> (8 * i));
+    }
+}
+
+// ---------- TextureCompression ----------
+
+VkFormat TextureCompression::GetCompressedFormat(VkFormat format, TextureUsage usage) {
+    if (format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB) {
+        // HDR texels would need BC6H, keep them as they are
+        return VK_FORMAT_UNDEFINED;
+    }
+    switch (usage) {
+        case TextureUsage::Color: return format == VK_FORMAT_R8G8B8A8_SRGB ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case TextureUsage::Normal: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case TextureUsage::Mask: return VK_FORMAT_BC4_UNORM_BLOCK;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+bool TextureCompression::IsBlockCompressed(VkFormat format) {
+    return GetBlockSize(format) != 0;
+}
+
+size_t TextureCompression::GetLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+    if (IsBlockCompressed(format)) {
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+    }
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            return size_t(width) * height * 4;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return size_t(width) * height * 16;
+        default:
+            RT_ASSERT(false, "Unsupported texture format");
+            return 0;
+    }
+}
+
+TextureMipChain TextureCompression::Compress(const TextureMipChain& source, VkFormat format) {
+    RT_ASSERT(source.format == VK_FORMAT_R8G8B8A8_UNORM || source.format == VK_FORMAT_R8G8B8A8_SRGB, "Only RGBA8 textures can be block compressed");
+
+    TextureMipChain chain;
+    chain.format = format;
+    chain.levels.resize(source.levels.size());
+    size_t chainSize = 0;
+    for (size_t i = 0; i < source.levels.size(); i++) {
+        chain.levels[i] = { source.levels[i].width, source.levels[i].height, chainSize };
+        chainSize += GetLevelSize(format, source.levels[i].width, source.levels[i].height);
+    }
+    chain.data.resize(chainSize);
+
+    const size_t blockSize = GetBlockSize(format);
+    for (size_t i = 0; i < source.levels.size(); i++) {
+        const MipLevel& level = source.levels[i];
+        const byte* src = source.data.data() + level.offset;
+        byte* dst = chain.data.data() + chain.levels[i].offset;
+        const uint32_t blocksX = (level.width + 3) / 4;
+        const uint32_t blocksY = (level.height + 3) / 4;
+
+        ThreadPool::Get().ParallelFor(blocksY, [&](uint32_t by) {
+            byte pixels[16][4];
+            for (uint32_t bx = 0; bx < blocksX; bx++) {
+                // Levels smaller than a block repeat their last row/column
+                for (uint32_t y = 0; y < 4; y++) {
+                    for (uint32_t x = 0; x < 4; x++) {
+                        const uint32_t sx = std::min(bx * 4 + x, level.width - 1);
+                        const uint32_t sy = std::min(by * 4 + y, level.height - 1);
+                        std::memcpy(pixels[y * 4 + x], src + (size_t(sy) * level.width + sx) * 4, 4);
+                    }
+                }
+
+                byte* block = dst + (size_t(by) * blocksX + bx) * blockSize;
+                if (format == VK_FORMAT_BC5_UNORM_BLOCK) {
+                    EncodeBC4Block(pixels, 0, block);
+                    EncodeBC4Block(pixels, 1, block + 8);
+                } else if (format == VK_FORMAT_BC4_UNORM_BLOCK) {
+                    EncodeBC4Block(pixels, 0, block);
+                } else {
+                    EncodeBC1Block(pixels, block);
+                }
+            }
+        });
+    }
+    return chain;
+}
+
+uint64_t TextureCompression::ComputeCacheKey(VkFormat sourceFormat, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount, const void* texels, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint32_t version = TEXTURE_CACHE_VERSION;
+    HashBytes(hash, &version, sizeof(version));
+    HashBytes(hash, &sourceFormat, sizeof(sourceFormat));
+    HashBytes(hash, &format, sizeof(format));
+    HashBytes(hash, &width, sizeof(width));
+    HashBytes(hash, &height, sizeof(height));
+    HashBytes(hash, &levelCount, sizeof(levelCount));
+    HashBytes(hash, texels, size);
+    return hash;
+}
+
+bool TextureCompression::LoadFromCache(const std::string& filename, uint64_t key, TextureMipChain& chain) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    TextureCacheHeader header;
+    if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        RT_WARN("Texture cache {0} is truncated, recompressing", filename);
+        return false;
+    }
+    if (std::memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != TEXTURE_CACHE_VERSION) {
+        RT_WARN("Texture cache {0} has an unknown format, recompressing", filename);
+        return false;
+    }
+    const VkFormat format = static_cast<VkFormat>(header.format);
+    if (header.key != key || !IsBlockCompressed(format) || header.levelCount == 0 || header.levelCount > 32) {
+        RT_WARN("Texture cache {0} does not match the texture, recompressing", filename);
+        return false;
+    }
+
+    std::vector<MipLevel> levels(header.levelCount);
+    uint32_t width = header.width, height = header.height;
+    size_t chainSize = 0;
+    for (auto& level : levels) {
+        level = { width, height, chainSize };
+        chainSize += GetLevelSize(format, width, height);
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    if (header.dataSize != chainSize || fileSize != sizeof(header) + chainSize) {
+        RT_WARN("Texture cache {0} has an unexpected size, recompressing", filename);
+        return false;
+    }
+
+    chain.data.resize(chainSize);
+    if (!file.read(reinterpret_cast<char*>(chain.data.data()), chainSize)) {
+        RT_WARN("Texture cache {0} could not be read, recompressing", filename);
+        return false;
+    }
+    chain.format = format;
+    chain.levels = std::move(levels);
+    return true;
+}
+
+bool TextureCompression::SaveToCache(const std::string& filename, uint64_t key, const TextureMipChain& chain) {
+    TextureCacheHeader header = {};
+    std::memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TEXTURE_CACHE_VERSION;
+    header.key = key;
+    header.width = chain.levels[0].width;
+    header.height = chain.levels[0].height;
+    header.format = chain.format;
+    header.levelCount = static_cast<uint32_t>(chain.levels.size());
+    header.dataSize = chain.data.size();
+
+    // Identical textures may be compressed on several threads at once, each call gets its own temporary file
+    return WriteFileAtomically(filename, [&](std::ostream& file) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(chain.data.data()), chain.data.size());
+    });
+}
@@ -0,0 +1,49 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include "common/Types.h"
+
+// What a texture is sampled for, decides the block compressed format
+enum class TextureUsage : uint32_t {
+    Color = 0,          // diffuse/specular color -> BC1
+    Normal = 1,         // tangent space normal map, only xy are stored -> BC5
+    Mask = 2,           // single channel (alpha, reflectance) -> BC4
+    Environment = 3,    // environment map, kept uncompressed
+};
+
+struct MipLevel {
+    uint32_t width;
+    uint32_t height;
+    size_t offset;  // byte offset into the mip chain
+};
+
+struct TextureMipChain {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    std::vector<MipLevel> levels;
+    std::vector<byte> data;
+};
+
+// On disk cache of compressed mip chains (<cache directory>/<key>.bctex)
+#define TEXTURE_CACHE_MAGIC "TXCC"
+#define TEXTURE_CACHE_VERSION 2   // 2: odd sized mip levels filter all source texels
+
+class TextureCompression {
+public:
+    // Block compressed format for texels of the given format and usage, VK_FORMAT_UNDEFINED if there is none
+    static VkFormat GetCompressedFormat(VkFormat format, TextureUsage usage);
+    static bool IsBlockCompressed(VkFormat format);
+    // Bytes of one level of the given extent
+    static size_t GetLevelSize(VkFormat format, uint32_t width, uint32_t height);
+
+    // Encodes every level of an RGBA8 chain into the block compressed format
+    static TextureMipChain Compress(const TextureMipChain& source, VkFormat format);
+
+    static uint64_t ComputeCacheKey(VkFormat sourceFormat, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount, const void* texels, size_t size);
+    static bool LoadFromCache(const std::string& filename, uint64_t key, TextureMipChain& chain);
+    static bool SaveToCache(const std::string& filename, uint64_t key, const TextureMipChain& chain);
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "TileScheduler.h"
+#include "OffscreenResources.h"
+#include "VulkanContext.h"
+#include "common/Log.h"
+#include <algorithm>
+
+// Weight of a new measurement in the moving average of the GPU cost
+static constexpr double COST_SMOOTHING = 0.3;
+
+void TileScheduler::Init(uint32_t slotCount) {
+    s_PendingPixelSamples.assign(slotCount, 0);
+    s_NanosecondsPerPixelSample = 0.0;
+    s_NextRow = 0;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(VulkanContext::GetPhysicalDevice(), &properties);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(VulkanContext::GetPhysicalDevice(), &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(VulkanContext::GetPhysicalDevice(), &familyCount, families.data());
+
+    if (!properties.limits.timestampComputeAndGraphics || families[VulkanContext::GetQueueFamilyIndex()].timestampValidBits == 0) {
+        RT_WARN("Device does not support compute timestamps, render tiles keep their initial size");
+        return;
+    }
+    s_TimestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = slotCount * 2;
+    vkCreateQueryPool(VulkanContext::GetDevice(), &info, nullptr, &s_QueryPool);
+}
+
+void TileScheduler::Cleanup() {
+    if (s_QueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(VulkanContext::GetDevice(), s_QueryPool, nullptr);
+        s_QueryPool = VK_NULL_HANDLE;
+    }
+    s_PendingPixelSamples.clear();
+}
+
+Tile TileScheduler::NextTile(uint32_t samplesPerPixel, double budgetMilliseconds) {
+    const uint32_t width = OffscreenResources::GetWidth();
+    const uint32_t height = OffscreenResources::GetHeight();
+    if (s_NextRow >= height) {
+        s_NextRow = 0;
+    }
+
+    double pixels = double(TILE_INITIAL_PIXEL_SAMPLES) / samplesPerPixel;
+    if (s_NanosecondsPerPixelSample > 0.0) {
+        pixels = budgetMilliseconds * 1e6 / (s_NanosecondsPerPixelSample * samplesPerPixel);
+    }
+    uint32_t rows = static_cast<uint32_t>(std::min(pixels / width, double(height)));
+    rows = std::max<uint32_t>(rows / TILE_ROW_ALIGNMENT * TILE_ROW_ALIGNMENT, TILE_ROW_ALIGNMENT);
+
+    Tile tile;
+    tile.firstRow = s_NextRow;
+    tile.rowCount = std::min(rows, height - s_NextRow);
+    tile.lastInPass = tile.firstRow + tile.rowCount >= height;
+    s_NextRow += tile.rowCount;
+    return tile;
+}
+
+void TileScheduler::RestartPass() {
+    s_NextRow = 0;
+}
+
+void TileScheduler::WriteBeginTimestamp(VkCommandBuffer cmd, uint32_t slot) {
+    if (s_QueryPool == VK_NULL_HANDLE) {
+        return;
+    }
+    vkCmdResetQueryPool(cmd, s_QueryPool, slot * 2, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, s_QueryPool, slot * 2);
+}
+
+void TileScheduler::WriteEndTimestamp(VkCommandBuffer cmd, uint32_t slot, uint64_t pixelSamples) {
+    if (s_QueryPool == VK_NULL_HANDLE) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, s_QueryPool, slot * 2 + 1);
+    s_PendingPixelSamples[slot] = pixelSamples;
+}
+
+void TileScheduler::CollectTimestamps(uint32_t slot) {
+    if (s_QueryPool == VK_NULL_HANDLE || s_PendingPixelSamples[slot] == 0) {
+        return;
+    }
+
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(VulkanContext::GetDevice(), s_QueryPool, slot * 2, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    const uint64_t pixelSamples = s_PendingPixelSamples[slot];
+    s_PendingPixelSamples[slot] = 0;
+    if (result != VK_SUCCESS || timestamps[1] <= timestamps[0]) {
+        return;
+    }
+
+    const double cost = double(timestamps[1] - timestamps[0]) * s_TimestampPeriod / double(pixelSamples);
+    s_NanosecondsPerPixelSample = (s_NanosecondsPerPixelSample > 0.0)
+        ? (1.0 - COST_SMOOTHING) * s_NanosecondsPerPixelSample + COST_SMOOTHING * cost
+        : cost;
+}
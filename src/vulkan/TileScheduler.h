@@ -0,0 +1,49 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+// Rows of a tile are a multiple of the workgroup height, so the dispatches of a pass never overlap
+#define TILE_ROW_ALIGNMENT 16
+// GPU time one interactive frame or one headless submit may spend on the raytracing dispatch
+#define TILE_INTERACTIVE_BUDGET_MS 12.0
+#define TILE_HEADLESS_BUDGET_MS 250.0
+// Size of the first tile, before any GPU time was measured
+#define TILE_INITIAL_PIXEL_SAMPLES (2 * 1024 * 1024)
+
+// Band of full width rows of the render target
+struct Tile {
+    uint32_t firstRow = 0;
+    uint32_t rowCount = 0;
+    bool lastInPass = false;    // the pass covered every row once this tile is done
+};
+
+// Splits a pass over the render target into horizontal tiles whose dispatch fits a GPU time budget.
+// Every submission writes timestamps around its dispatch into its own query slot, the measured
+// cost per pixel sample sizes the following tiles.
+class TileScheduler {
+public:
+    static void Init(uint32_t slotCount);
+    static void Cleanup();
+
+    // Next tile of the current pass, a new pass starts after the tile with lastInPass
+    static Tile NextTile(uint32_t samplesPerPixel, double budgetMilliseconds);
+    // Discards the rest of the current pass, the next tile starts at the top again
+    static void RestartPass();
+
+    // Timestamps around the dispatch recorded into cmd, slot identifies the submission
+    static void WriteBeginTimestamp(VkCommandBuffer cmd, uint32_t slot);
+    static void WriteEndTimestamp(VkCommandBuffer cmd, uint32_t slot, uint64_t pixelSamples);
+    // Reads the timestamps of slot, must only be called once its previous submission finished
+    static void CollectTimestamps(uint32_t slot);
+
+private:
+    inline static VkQueryPool s_QueryPool = VK_NULL_HANDLE;    // two queries per slot, null without timestamp support
+    inline static std::vector<uint64_t> s_PendingPixelSamples;  // per slot, 0 if no timestamps are pending
+    inline static double s_TimestampPeriod = 1.0;               // nanoseconds per tick
+    inline static double s_NanosecondsPerPixelSample = 0.0;     // moving average, 0 until the first measurement
+    inline static uint32_t s_NextRow = 0;
+};
+
+#endif
@@ -107,7 +107,30 @@ void VulkanContext::CreateLogicalDevice() {
     queueInfo.queueCount = 1;
     queueInfo.pQueuePriorities = &priority;
 
+    // Textures are a sampler2D array indexed with nonuniformEXT(TextureID)
+    VkPhysicalDeviceVulkan12Features supported12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+    VkPhysicalDeviceFeatures2 supported = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+    supported.pNext = &supported12;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+    if (!supported12.shaderSampledImageArrayNonUniformIndexing) {
+        RT_WARN("Device does not support non-uniform sampler array indexing, texture lookups may be incorrect");
+    }
+
+    // Block compressed textures (see TextureCompression)
+    VkPhysicalDeviceFeatures features = {};
+    features.textureCompressionBC = supported.features.textureCompressionBC;
+    bcTexturesSupported = supported.features.textureCompressionBC == VK_TRUE;
+    if (!bcTexturesSupported) {
+        RT_WARN("Device does not support BC texture compression, textures stay uncompressed");
+    }
+
+    VkPhysicalDeviceVulkan12Features features12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+    features12.shaderSampledImageArrayNonUniformIndexing = supported12.shaderSampledImageArrayNonUniformIndexing;
+    // Headless rendering reports its progress through a timeline semaphore (core in Vulkan 1.2)
+    features12.timelineSemaphore = VK_TRUE;
+
     VkPhysicalDeviceVulkan13Features features13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+    features13.pNext = &features12;
     features13.dynamicRendering = VK_TRUE;
 
     const char* ext = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
@@ -115,6 +138,7 @@ void VulkanContext::CreateLogicalDevice() {
     deviceCreateInfo.pNext = &features13;
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &queueInfo;
+    deviceCreateInfo.pEnabledFeatures = &features;
 
     if (Params::IsInteractiveMode()) {
         deviceCreateInfo.enabledExtensionCount = 1;
@@ -15,6 +15,7 @@ public:
     static VkCommandPool GetCommandPool() { return commandPool; }
     static VkSurfaceKHR GetSurface() { return surface; }
     static uint32_t GetQueueFamilyIndex() { return graphicsQueueFamily; }
+    static bool SupportsBCTextures() { return bcTexturesSupported; }
 
     static uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     static VkCommandBuffer BeginSingleTimeCommands();
@@ -34,6 +35,7 @@ private:
     inline static VkQueue graphicsQueue = VK_NULL_HANDLE;
     inline static VkCommandPool commandPool = VK_NULL_HANDLE;
     inline static uint32_t graphicsQueueFamily = 0;
+    inline static bool bcTexturesSupported = false;
 };
 
 #endif
@@ -0,0 +1,203 @@
+#include "WavefrontPipeline.h"
+#include "VulkanContext.h"
+#include "OffscreenResources.h"
+#include "Buffer.h"
+#include "ShaderCompiler.h"
+#include "KernelTuner.h"
+#include "PipelineCache.h"
+#include "scene/Scene.h"
+#include "common/Log.h"
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+extern UBO uniformBufferData;
+
+static_assert(sizeof(WavefrontDispatchArgs) == 16, "WavefrontDispatchArgs must match a uvec4");
+
+static VkShaderModule LoadKernel(const std::string& name) {
+    ShaderBinary binary("ShaderCache/" + name + ".comp.glsl.spv");
+    return CreateShaderModule(binary);
+}
+
+// specializationValue sets constant_id 0 of the kernel, nullptr keeps its default. The kd-tree stack
+// size (constant_id 10) follows KernelTuner::GetConfig() like in the single raytracing kernel
+static VkPipeline CreateKernelPipeline(VkShaderModule module, VkPipelineLayout layout, const uint32_t* specializationValue = nullptr) {
+    const uint32_t data[] = { KernelTuner::GetConfig().maxStack, specializationValue ? *specializationValue : 0u };
+    VkSpecializationMapEntry entries[] = {
+        { 10, 0, sizeof(uint32_t) },
+        { 0, sizeof(uint32_t), sizeof(uint32_t) },
+    };
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = specializationValue ? 2 : 1;
+    specialization.pMapEntries = entries;
+    specialization.dataSize = sizeof(data);
+    specialization.pData = data;
+
+    VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    info.stage.module = module;
+    info.stage.pName = "main";
+    info.stage.pSpecializationInfo = &specialization;
+    info.layout = layout;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    vkCreateComputePipelines(VulkanContext::GetDevice(), PipelineCache::Get(), 1, &info, nullptr, &pipeline);
+    return pipeline;
+}
+
+// Makes the queue and path state writes of one kernel visible to the next one and its indirect arguments
+static void KernelBarrier(VkCommandBuffer cmd) {
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void WavefrontPipeline::CreateGPUBuffers() {
+    s_PathsSSBO = SSBO::Create(WAVEFRONT_PATHS_BINDING, VkDeviceSize(WAVEFRONT_PATH_POOL_SIZE) * WAVEFRONT_PATH_STATE_SIZE);
+    s_QueuesSSBO = SSBO::Create(WAVEFRONT_QUEUES_BINDING, VkDeviceSize(WAVEFRONT_PATH_POOL_SIZE) * 3 * sizeof(uint32_t));
+    s_ControlSSBO = SSBO::Create(WAVEFRONT_CONTROL_BINDING, sizeof(WavefrontControl), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+}
+
+void WavefrontPipeline::Init() {
+    RT_ASSERT(s_ControlSSBO, "WavefrontPipeline::CreateGPUBuffers has to be called before WavefrontPipeline::Init");
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = sizeof(WavefrontPushConstants);
+
+    VkDescriptorSetLayout descriptorSetLayout = ComputePipeline::GetDescriptorSetLayout();
+    VkPipelineLayoutCreateInfo layoutInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &descriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    vkCreatePipelineLayout(VulkanContext::GetDevice(), &layoutInfo, nullptr, &s_Layout);
+
+    CreatePipelines();
+}
+
+void WavefrontPipeline::Cleanup() {
+    if (!IsInitialized()) {
+        return;
+    }
+    DestroyPipelines();
+    vkDestroyPipelineLayout(VulkanContext::GetDevice(), s_Layout, nullptr);
+    s_Layout = VK_NULL_HANDLE;
+
+    // The buffers themselves are destroyed with all others by Buffer::DestroyAllBuffers
+    s_PathsSSBO.reset();
+    s_QueuesSSBO.reset();
+    s_ControlSSBO.reset();
+}
+
+void WavefrontPipeline::RecreatePipelines() {
+    if (!IsInitialized()) {
+        return;
+    }
+    VulkanContext::DeviceWaitIdle();
+    DestroyPipelines();
+    CreatePipelines();
+}
+
+void WavefrontPipeline::CreatePipelines() {
+    VkShaderModule generate = LoadKernel("WavefrontGenerate");
+    VkShaderModule control = LoadKernel("WavefrontControl");
+    VkShaderModule extend = LoadKernel("WavefrontExtend");
+    VkShaderModule sort = LoadKernel("WavefrontSort");
+    VkShaderModule shade = LoadKernel("WavefrontShade");
+    VkShaderModule accumulate = LoadKernel("WavefrontAccumulate");
+
+    s_GeneratePipeline = CreateKernelPipeline(generate, s_Layout);
+    for (uint32_t stage = 0; stage < 2; stage++) {
+        s_ControlPipelines[stage] = CreateKernelPipeline(control, s_Layout, &stage);
+    }
+    s_ExtendPipeline = CreateKernelPipeline(extend, s_Layout);
+    s_SortPipeline = CreateKernelPipeline(sort, s_Layout);
+    // One pipeline per shader type, the specialization removes the code of all other shaders
+    for (uint32_t type = 1; type < WAVEFRONT_SHADER_TYPE_COUNT; type++) {
+        s_ShadePipelines[type] = CreateKernelPipeline(shade, s_Layout, &type);
+    }
+    s_AccumulatePipeline = CreateKernelPipeline(accumulate, s_Layout);
+
+    for (VkShaderModule module : { generate, control, extend, sort, shade, accumulate }) {
+        vkDestroyShaderModule(VulkanContext::GetDevice(), module, nullptr);
+    }
+}
+
+void WavefrontPipeline::DestroyPipelines() {
+    std::vector<VkPipeline*> pipelines = { &s_GeneratePipeline, &s_ControlPipelines[0], &s_ControlPipelines[1], &s_ExtendPipeline, &s_SortPipeline, &s_AccumulatePipeline };
+    for (VkPipeline& pipeline : s_ShadePipelines) {
+        pipelines.push_back(&pipeline);
+    }
+    for (VkPipeline* pipeline : pipelines) {
+        vkDestroyPipeline(VulkanContext::GetDevice(), *pipeline, nullptr);
+        *pipeline = VK_NULL_HANDLE;
+    }
+}
+
+void WavefrontPipeline::Record(VkCommandBuffer cmd, const ComputePushConstants& pushConstants, uint32_t rowCount) {
+    RT_ASSERT(IsInitialized(), "WavefrontPipeline is not initialized");
+    const uint32_t width = OffscreenResources::GetWidth();
+    RT_ASSERT(width <= WAVEFRONT_PATH_POOL_SIZE, "render width exceeds the wavefront path pool");
+    const uint32_t rowsPerChunk = WAVEFRONT_PATH_POOL_SIZE / width;
+    // Every extend/shade round consumes at most one bounce, except for refraction
+    const uint32_t bounces = uniformBufferData.u_Raybounces;
+    const uint32_t segments = (bounces > 0) ? bounces + WAVEFRONT_EXTRA_PATH_SEGMENTS : 0;
+
+    VkDescriptorSet ds = ComputePipeline::GetDescriptorSet();
+    std::vector<uint32_t> dynamicOffsets = ComputePipeline::GetDynamicOffsets();
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_Layout, 0, 1, &ds, (uint32_t)dynamicOffsets.size(), dynamicOffsets.data());
+
+    const VkBuffer control = s_ControlSSBO->GetBuffer();
+    WavefrontPushConstants wavefrontConstants;
+    wavefrontConstants.sampleOffset = pushConstants.sampleOffset;
+    wavefrontConstants.sampleCount = pushConstants.sampleCount;
+    wavefrontConstants.tileOffsetX = pushConstants.tileOffsetX;
+    wavefrontConstants.tileWidth = width;
+
+    for (uint32_t chunkRow = 0; chunkRow < rowCount; chunkRow += rowsPerChunk) {
+        wavefrontConstants.tileOffsetY = pushConstants.tileOffsetY + chunkRow;
+        wavefrontConstants.tileHeight = std::min(rowsPerChunk, rowCount - chunkRow);
+
+        for (uint32_t sample = 0; sample < pushConstants.sampleCount; sample++) {
+            wavefrontConstants.sample = sample;
+            vkCmdPushConstants(cmd, s_Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(wavefrontConstants), &wavefrontConstants);
+
+            // The previous sample or chunk still uses the path state
+            KernelBarrier(cmd);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_GeneratePipeline);
+            vkCmdDispatch(cmd, (width + 15) / 16, (wavefrontConstants.tileHeight + 15) / 16, 1);
+
+            for (uint32_t segment = 0; segment < segments; segment++) {
+                KernelBarrier(cmd);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_ControlPipelines[0]);
+                vkCmdDispatch(cmd, 1, 1, 1);
+                KernelBarrier(cmd);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_ExtendPipeline);
+                vkCmdDispatchIndirect(cmd, control, offsetof(WavefrontControl, extendArgs));
+
+                KernelBarrier(cmd);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_ControlPipelines[1]);
+                vkCmdDispatch(cmd, 1, 1, 1);
+                KernelBarrier(cmd);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_SortPipeline);
+                vkCmdDispatchIndirect(cmd, control, offsetof(WavefrontControl, sortArgs));
+
+                // The shade kernels touch disjoint paths and only share the ray queue counter, no barriers between them
+                KernelBarrier(cmd);
+                for (uint32_t type = 1; type < WAVEFRONT_SHADER_TYPE_COUNT; type++) {
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_ShadePipelines[type]);
+                    vkCmdDispatchIndirect(cmd, control, offsetof(WavefrontControl, shadeArgs) + type * sizeof(WavefrontDispatchArgs));
+                }
+            }
+
+            KernelBarrier(cmd);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, s_AccumulatePipeline);
+            vkCmdDispatch(cmd, (width + 15) / 16, (wavefrontConstants.tileHeight + 15) / 16, 1);
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef WAVEFRONT_PIPELINE_H
+#define WAVEFRONT_PIPELINE_H
+
+#include <vulkan/vulkan.h>
+#include <memory>
+#include "ComputePipeline.h"
+
+// Paths traced at once, chunks of a tile are at most this many pixels.
+// Must match WAVEFRONT_PATH_POOL_SIZE in ShaderCode/include/Wavefront.glsl
+#define WAVEFRONT_PATH_POOL_SIZE (256 * 1024)
+// Shader types 1..11 of ShaderType, 0 is unused
+#define WAVEFRONT_SHADER_TYPE_COUNT 12
+// Size of PathState in ShaderCode/include/Wavefront.glsl
+#define WAVEFRONT_PATH_STATE_SIZE 176
+// Refraction does not consume bounces, so a path may have more segments than u_RayBounces.
+// The extend/shade loop runs this many extra times, paths still alive afterwards are cut off
+#define WAVEFRONT_EXTRA_PATH_SEGMENTS 8
+#define WAVEFRONT_PATHS_BINDING 60
+#define WAVEFRONT_QUEUES_BINDING 61
+#define WAVEFRONT_CONTROL_BINDING 62
+
+// Must match the push_constant block in ShaderCode/include/Wavefront.glsl
+struct WavefrontPushConstants {
+    uint32_t sampleOffset = 0;
+    uint32_t sampleCount = 1;
+    uint32_t tileOffsetX = 0;
+    uint32_t tileOffsetY = 0;
+    uint32_t tileWidth = 0;     // pixels of the chunk, one path each
+    uint32_t tileHeight = 0;
+    uint32_t sample = 0;        // sample the paths currently trace
+};
+
+// VkDispatchIndirectCommand padded to a uvec4
+struct WavefrontDispatchArgs {
+    uint32_t x, y, z, padding;
+};
+
+// Must match WavefrontControl in ShaderCode/include/Wavefront.glsl
+struct WavefrontControl {
+    WavefrontDispatchArgs extendArgs;
+    WavefrontDispatchArgs sortArgs;
+    WavefrontDispatchArgs shadeArgs[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint32_t rayCount;
+    uint32_t hitCount;
+    uint32_t binCount[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint32_t binOffset[WAVEFRONT_SHADER_TYPE_COUNT];
+    uint32_t binCursor[WAVEFRONT_SHADER_TYPE_COUNT];
+};
+
+class SSBO;
+
+// Alternative to the Raytracer.comp.glsl megakernel that splits the path loop into small kernels
+// (ShaderCode/Wavefront*.comp.glsl): generate camera rays, extend them to the next hit, sort the
+// hits by shader type and run one specialized shade kernel per type, then accumulate the samples.
+// Path indices travel through queues in SSBOs and the kernels are dispatched indirectly, so
+// terminated paths drop out of the queues instead of idling in their workgroup.
+// The wavefront buffers are bound through the descriptor set of ComputePipeline
+class WavefrontPipeline {
+public:
+    // Has to run before ComputePipeline::Init, which builds the descriptor set layout from all buffers
+    static void CreateGPUBuffers();
+    static void Init();
+    static void Cleanup();
+    static void RecreatePipelines();
+    static bool IsInitialized() { return s_Layout != VK_NULL_HANDLE; }
+
+    // Records the wavefront counterpart of one Raytracer.comp.glsl dispatch over rowCount rows starting at
+    // pushConstants.tileOffsetY. The offscreen image has to be in GENERAL layout
+    static void Record(VkCommandBuffer cmd, const ComputePushConstants& pushConstants, uint32_t rowCount);
+
+private:
+    static void CreatePipelines();
+    static void DestroyPipelines();
+
+    inline static std::shared_ptr<SSBO> s_PathsSSBO;
+    inline static std::shared_ptr<SSBO> s_QueuesSSBO;
+    inline static std::shared_ptr<SSBO> s_ControlSSBO;
+
+    inline static VkPipelineLayout s_Layout = VK_NULL_HANDLE;
+    inline static VkPipeline s_GeneratePipeline = VK_NULL_HANDLE;
+    inline static VkPipeline s_ControlPipelines[2] = {};     // before extend, before sort
+    inline static VkPipeline s_ExtendPipeline = VK_NULL_HANDLE;
+    inline static VkPipeline s_SortPipeline = VK_NULL_HANDLE;
+    inline static VkPipeline s_ShadePipelines[WAVEFRONT_SHADER_TYPE_COUNT] = {};   // index 0 stays null
+    inline static VkPipeline s_AccumulatePipeline = VK_NULL_HANDLE;
+};
+
+#endif